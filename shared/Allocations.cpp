@@ -0,0 +1,100 @@
+#include "Allocations.h"
+
+#ifndef TRACKER_COUNT_ALLOCATIONS
+#error "Allocations.cpp is built only with TRACKER_COUNT_ALLOCATIONS, see CMakeLists.txt"
+#endif
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+
+namespace
+{
+	std::atomic<size_t> g_allocations{ 0 };
+}
+
+#if defined(__GLIBC__)
+
+/*Исполняемый файл перекрывает malloc из libc для всех библиотек процесса.
+Сами выделения выполняют внутренние функции glibc*/
+extern "C"
+{
+	void* __libc_malloc(size_t size);
+	void* __libc_calloc(size_t count, size_t size);
+	void* __libc_realloc(void* ptr, size_t size);
+	void* __libc_memalign(size_t alignment, size_t size);
+	void* __libc_valloc(size_t size);
+	void* __libc_pvalloc(size_t size);
+
+	void* malloc(size_t size)
+	{
+		g_allocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_malloc(size);
+	}
+
+	void* calloc(size_t count, size_t size)
+	{
+		g_allocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_calloc(count, size);
+	}
+
+	void* realloc(void* ptr, size_t size)
+	{
+		g_allocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_realloc(ptr, size);
+	}
+
+	void* memalign(size_t alignment, size_t size)
+	{
+		g_allocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_memalign(alignment, size);
+	}
+
+	void* aligned_alloc(size_t alignment, size_t size)
+	{
+		return memalign(alignment, size);
+	}
+
+	void* valloc(size_t size)
+	{
+		g_allocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_valloc(size);
+	}
+
+	void* pvalloc(size_t size)
+	{
+		g_allocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_pvalloc(size);
+	}
+
+	int posix_memalign(void** ptr, size_t alignment, size_t size)
+	{
+		//Выравнивание - степень двойки, кратная размеру указателя. При ошибке *ptr не меняется
+		if (alignment == 0 || alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+			return EINVAL;
+		void* memory = memalign(alignment, size);
+		if (!memory)
+			return ENOMEM;
+		*ptr = memory;
+		return 0;
+	}
+}
+
+bool allocationCountingSupported()
+{
+	return true;
+}
+
+#else
+
+bool allocationCountingSupported()
+{
+	return false;
+}
+
+#endif
+
+size_t allocationCount()
+{
+	return g_allocations.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+
+/*Счетчик выделений памяти во всем процессе, нужен для проверки, что установившийся
+режим инференса память не выделяет. Считаются вызовы malloc и всех его вариантов,
+поэтому учитываются и new, и буферы cv::Mat, и выделения внутри TensorRT и CUDA.
+Подменить malloc можно только с glibc, на остальных платформах счетчик всегда 0.
+Счетчик есть только в сборках с TRACKER_COUNT_ALLOCATIONS и Allocations.cpp
+(tracker_*_alloc в CMakeLists.txt), в остальных malloc не подменяется*/
+#ifdef TRACKER_COUNT_ALLOCATIONS
+size_t allocationCount();
+bool allocationCountingSupported();
+#else
+inline size_t allocationCount() { return 0; }
+inline bool allocationCountingSupported() { return false; }
+#endif
@@ -0,0 +1,363 @@
+#include "FrameSource.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#define TRACKER_OPENCV_AT_LEAST(major, minor, revision) (CV_VERSION_MAJOR > (major) || \
+	(CV_VERSION_MAJOR == (major) && (CV_VERSION_MINOR > (minor) || \
+	(CV_VERSION_MINOR == (minor) && CV_VERSION_REVISION >= (revision)))))
+
+namespace
+{
+	/*Видео через cv::VideoCapture. Кадр декодируется сразу в буфер из пула:
+	read не выделяет память, если размер и тип буфера уже подходят*/
+	class VideoSource : public FrameSource
+	{
+	public:
+		explicit VideoSource(FramePool& pool) : m_pool(pool) {};
+
+		bool open(const std::string& path, const FrameSourceOptions& options)
+		{
+			std::vector<int> params;
+#if TRACKER_OPENCV_AT_LEAST(4, 5, 2)
+			if (options.m_hardware)
+				params.insert(params.end(), { cv::CAP_PROP_HW_ACCELERATION, cv::VIDEO_ACCELERATION_ANY });
+#endif
+#if TRACKER_OPENCV_AT_LEAST(4, 6, 0)
+			if (options.m_threads > 0)
+				params.insert(params.end(), { cv::CAP_PROP_N_THREADS, options.m_threads });
+#endif
+			/*Не все способы чтения принимают эти параметры, тогда открываем без них*/
+			if (!params.empty() && m_video.open(path, cv::CAP_ANY, params))
+				return true;
+			return m_video.open(path);
+		};
+
+		bool read(Frame& frame) override
+		{
+			Frame next = m_pool.acquire(m_index);
+			if (!m_video.read(FramePool::pixels(next)))
+				return false;
+			++m_index;
+			frame = std::move(next);
+			return true;
+		};
+
+	private:
+		FramePool& m_pool;
+		cv::VideoCapture m_video;
+		size_t m_index = 0;
+	};
+
+	/*Декодер картинок name % (first + index). Файл читается в свой буфер и декодируется
+	imdecode прямо в кадр. У каждого потока свой декодер*/
+	class ImageDecoder
+	{
+	public:
+		ImageDecoder(const std::string& pattern, const int first) : m_pattern(pattern), m_first(first) {};
+
+		std::string name(const size_t index) const
+		{
+			char name[4096];
+			std::snprintf(name, sizeof(name), m_pattern.c_str(), m_first + int(index));
+			return name;
+		};
+
+		bool decode(const size_t index, cv::Mat& image)
+		{
+			std::FILE* file = std::fopen(name(index).c_str(), "rb");
+			if (file == nullptr)
+				return false;
+			std::fseek(file, 0, SEEK_END);
+			const long size = std::ftell(file);
+			std::fseek(file, 0, SEEK_SET);
+			m_bytes.resize(size > 0 ? size_t(size) : 0);
+			const bool read = size > 0 && std::fread(m_bytes.data(), 1, m_bytes.size(), file) == m_bytes.size();
+			std::fclose(file);
+			if (!read)
+				return false;
+
+			cv::imdecode(m_bytes, cv::IMREAD_COLOR, &image);
+			return !image.empty();
+		};
+
+	private:
+		std::string m_pattern;
+		int m_first;
+		std::vector<uchar> m_bytes;
+	};
+
+	struct FileCloser
+	{
+		void operator()(std::FILE* file) const
+		{
+			if (file != stdin)
+				std::fclose(file);
+		};
+	};
+	using File = std::unique_ptr<std::FILE, FileCloser>;
+
+	/*Заголовок Y4M: YUV4MPEG2 W<ширина> H<высота> [C<цвет>] ...*/
+	struct Y4mFormat
+	{
+		int m_width = 0;
+		int m_height = 0;
+		bool m_gray = false;
+
+		/*Байт от начала файла до первого кадра*/
+		int64_t m_header = 0;
+
+		size_t frameBytes() const { return size_t(m_width) * m_height * (m_gray ? 2 : 3) / 2; };
+	};
+
+	/*Строка до \n без него. false в конце файла или если строка длиннее limit*/
+	bool readLine(std::FILE* file, std::string& line, const size_t limit)
+	{
+		line.clear();
+		for (int c = std::fgetc(file); c != '\n'; c = std::fgetc(file))
+		{
+			if (c == EOF || line.size() >= limit)
+				return false;
+			line += char(c);
+		}
+		return true;
+	}
+
+	bool readY4mHeader(std::FILE* file, Y4mFormat& format)
+	{
+		std::string line;
+		if (!readLine(file, line, 1024) || line.compare(0, 10, "YUV4MPEG2 ") != 0)
+			return false;
+
+		std::string color = "420";
+		size_t begin = 10;
+		while (begin < line.size())
+		{
+			size_t end = line.find(' ', begin);
+			if (end == std::string::npos)
+				end = line.size();
+			const std::string token = line.substr(begin, end - begin);
+			if (!token.empty() && token[0] == 'W')
+				format.m_width = std::atoi(token.c_str() + 1);
+			else if (!token.empty() && token[0] == 'H')
+				format.m_height = std::atoi(token.c_str() + 1);
+			else if (!token.empty() && token[0] == 'C')
+				color = token.substr(1);
+			begin = end + 1;
+		}
+
+		/*4:2:0 с любым положением цветности и оттенки серого, остальное сначала
+		переводится, например ffmpeg -pix_fmt yuv420p*/
+		format.m_gray = color == "mono";
+		if (!format.m_gray && color.compare(0, 3, "420") != 0)
+		{
+			std::cout << "unsupported Y4M color space " << color << std::endl;
+			return false;
+		}
+		if (format.m_width <= 0 || format.m_height <= 0 || (!format.m_gray && (format.m_width % 2 || format.m_height % 2)))
+		{
+			std::cout << "unsupported Y4M frame size " << format.m_width << 'x' << format.m_height << std::endl;
+			return false;
+		}
+		format.m_header = std::ftell(file);
+		return true;
+	}
+
+	bool seek(std::FILE* file, const int64_t offset)
+	{
+#ifdef _WIN32
+		return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+		return fseeko(file, off_t(offset), SEEK_SET) == 0;
+#endif
+	}
+
+	/*Декодер кадров Y4M. Из файла кадр index читается по смещению, поэтому у каждого
+	потока свой файл. Из канала кадры читаются только подряд*/
+	class Y4mDecoder
+	{
+	public:
+		Y4mDecoder(File file, const Y4mFormat& format, const bool seekable) :
+			m_file(std::move(file)), m_format(format), m_seekable(seekable), m_raw(format.frameBytes()) {};
+
+		bool decode(const size_t index, cv::Mat& image)
+		{
+			/*В файлах, где можно читать по смещению, заголовок кадра - ровно "FRAME\n"*/
+			if (m_seekable && !seek(m_file.get(), m_format.m_header + int64_t(index) * int64_t(m_raw.size() + 6)))
+				return false;
+			if (!readLine(m_file.get(), m_line, 256) || m_line.compare(0, 5, "FRAME") != 0
+				|| (m_seekable && m_line.size() != 5))
+				return false;
+			if (std::fread(m_raw.data(), 1, m_raw.size(), m_file.get()) != m_raw.size())
+				return false;
+
+			if (m_format.m_gray)
+				cv::cvtColor(cv::Mat(m_format.m_height, m_format.m_width, CV_8UC1, m_raw.data()), image, cv::COLOR_GRAY2BGR);
+			else
+			{
+				cv::cvtColor(cv::Mat(m_format.m_height * 3 / 2, m_format.m_width, CV_8UC1, m_raw.data()), image,
+					cv::COLOR_YUV2BGR_I420);
+			}
+			return true;
+		};
+
+	private:
+		File m_file;
+		Y4mFormat m_format;
+		bool m_seekable;
+		std::vector<uchar> m_raw;
+		std::string m_line;
+	};
+
+	/*Декодирование в читающем потоке*/
+	template <class Decoder>
+	class SequentialSource : public FrameSource
+	{
+	public:
+		SequentialSource(Decoder decoder, FramePool& pool) : m_decoder(std::move(decoder)), m_pool(pool) {};
+
+		bool read(Frame& frame) override
+		{
+			Frame next = m_pool.acquire(m_index);
+			if (!m_decoder.decode(m_index, FramePool::pixels(next)))
+				return false;
+			++m_index;
+			frame = std::move(next);
+			return true;
+		};
+
+	private:
+		Decoder m_decoder;
+		FramePool& m_pool;
+		size_t m_index = 0;
+	};
+
+	/*Поток i из N декодирует кадры i, i + N, i + 2N... в свою очередь, а read забирает
+	кадры из очередей по кругу, поэтому они выдаются по порядку без общих блокировок.
+	Кадры кончаются на первом кадре, который не удалось декодировать*/
+	template <class Decoder>
+	class ParallelSource : public FrameSource
+	{
+	public:
+		ParallelSource(std::vector<Decoder> decoders, FramePool& pool) : m_decoders(std::move(decoders)), m_pool(pool)
+		{
+			for (size_t i = 0; i < m_decoders.size(); ++i)
+				m_queues.emplace_back(std::make_unique<RingBuffer<Frame>>(QUEUE_SIZE, QueuePolicy::Block));
+			for (size_t i = 0; i < m_decoders.size(); ++i)
+				m_workers.emplace_back(&ParallelSource::run, this, i);
+		};
+
+		~ParallelSource()
+		{
+			for (auto& queue : m_queues)
+				queue->close();
+			for (auto& worker : m_workers)
+				worker.join();
+		};
+
+		bool read(Frame& frame) override
+		{
+			if (!m_queues[m_next % m_queues.size()]->pop(frame))
+				return false;
+			++m_next;
+			return true;
+		};
+
+	private:
+		/*Кадров, декодированных каждым потоком наперед*/
+		static constexpr size_t QUEUE_SIZE = 2;
+
+		void run(const size_t worker)
+		{
+			RingBuffer<Frame>& queue = *m_queues[worker];
+			for (size_t index = worker; ; index += m_decoders.size())
+			{
+				Frame frame = m_pool.acquire(index);
+				if (!m_decoders[worker].decode(index, FramePool::pixels(frame)) || !queue.push(std::move(frame)))
+					break;
+			}
+			queue.close();
+		};
+
+		std::vector<Decoder> m_decoders;
+		FramePool& m_pool;
+		std::vector<std::unique_ptr<RingBuffer<Frame>>> m_queues;
+		std::vector<std::thread> m_workers;
+		size_t m_next = 0;
+	};
+
+	template <class Decoder>
+	std::unique_ptr<FrameSource> makeSource(std::vector<Decoder> decoders, FramePool& pool)
+	{
+		if (decoders.size() == 1)
+			return std::make_unique<SequentialSource<Decoder>>(std::move(decoders.front()), pool);
+		return std::make_unique<ParallelSource<Decoder>>(std::move(decoders), pool);
+	}
+}
+
+std::unique_ptr<FrameSource> makeFrameSource(const std::string& path, FramePool& pool, const FrameSourceOptions& options)
+{
+	const size_t threads = size_t(std::max(options.m_threads, 1));
+
+	if (path == "-")
+	{
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
+		Y4mFormat format;
+		if (!readY4mHeader(stdin, format))
+			return nullptr;
+		return std::make_unique<SequentialSource<Y4mDecoder>>(Y4mDecoder(File(stdin), format, false), pool);
+	}
+
+	if (path.size() > 4 && path.compare(path.size() - 4, 4, ".y4m") == 0)
+	{
+		Y4mFormat format;
+		std::vector<Y4mDecoder> decoders;
+		for (size_t i = 0; i < threads; ++i)
+		{
+			File file(std::fopen(path.c_str(), "rb"));
+			if (file == nullptr || (i == 0 && !readY4mHeader(file.get(), format)))
+				return nullptr;
+			decoders.emplace_back(std::move(file), format, true);
+		}
+		return makeSource(std::move(decoders), pool);
+	}
+
+	/*Последовательность картинок начинается с номера 0 или 1*/
+	if (path.find('%') != std::string::npos)
+	{
+		int first = -1;
+		for (int candidate : { 0, 1 })
+		{
+			std::FILE* file = std::fopen(ImageDecoder(path, candidate).name(0).c_str(), "rb");
+			if (file != nullptr)
+			{
+				std::fclose(file);
+				first = candidate;
+				break;
+			}
+		}
+		if (first < 0)
+			return nullptr;
+		return makeSource(std::vector<ImageDecoder>(threads, ImageDecoder(path, first)), pool);
+	}
+
+	auto video = std::make_unique<VideoSource>(pool);
+	if (!video->open(path, options))
+		return nullptr;
+	return video;
+}
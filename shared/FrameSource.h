@@ -0,0 +1,154 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <opencv2/core/core.hpp>
+
+#include "RingBuffer.h"
+
+class FramePool;
+
+/*Кадр из пула FramePool. Копия кадра - это еще одна ссылка на тот же буфер, пиксели
+между стадиями не копируются. Доступ только на чтение: рисовать на кадре нельзя,
+т.к. его могут читать другие стадии. Когда пропадает последняя ссылка, буфер
+возвращается в пул и в него декодируется следующий кадр*/
+class Frame
+{
+public:
+	Frame() = default;
+	Frame(const Frame& other) : m_buffer(other.m_buffer)
+	{
+		if (m_buffer != nullptr)
+			m_buffer->m_refs.fetch_add(1, std::memory_order_relaxed);
+	};
+	Frame(Frame&& other) noexcept : m_buffer(other.m_buffer) { other.m_buffer = nullptr; };
+	Frame& operator=(Frame other) noexcept
+	{
+		std::swap(m_buffer, other.m_buffer);
+		return *this;
+	};
+	~Frame() { reset(); };
+
+	inline void reset();
+	bool empty() const { return m_buffer == nullptr; };
+
+	const cv::Mat& image() const { return m_buffer->m_image; };
+
+	/*Номер кадра в источнике*/
+	size_t index() const { return m_buffer->m_index; };
+
+private:
+	friend class FramePool;
+
+	struct Buffer
+	{
+		cv::Mat m_image;
+		size_t m_index = 0;
+		std::atomic<int> m_refs{ 0 };
+		FramePool* m_pool = nullptr;
+	};
+
+	explicit Frame(Buffer* buffer) : m_buffer(buffer) {};
+
+	Buffer* m_buffer = nullptr;
+};
+
+/*Буферы кадров одного источника. Буфер создается, только если все прежние заняты,
+поэтому в установившемся режиме кадры декодируются в уже выделенную память: cv::Mat
+нужного размера и типа не выделяется заново. Брать и возвращать кадры можно из
+разных потоков. Пул должен пережить все свои кадры*/
+class FramePool
+{
+public:
+	/*Сколько свободных буферов хранить. Лишние освобождаются*/
+	explicit FramePool(const size_t capacity = 64) : m_free(capacity, QueuePolicy::Block) {};
+
+	~FramePool()
+	{
+		Frame::Buffer* buffer;
+		while (m_free.tryPop(buffer))
+			delete buffer;
+	};
+
+	FramePool(const FramePool&) = delete;
+	FramePool& operator=(const FramePool&) = delete;
+
+	Frame acquire(const size_t index)
+	{
+		Frame::Buffer* buffer = nullptr;
+		if (!m_free.tryPop(buffer))
+		{
+			buffer = new Frame::Buffer;
+			buffer->m_pool = this;
+			m_allocated.fetch_add(1, std::memory_order_relaxed);
+		}
+		buffer->m_index = index;
+		buffer->m_refs.store(1, std::memory_order_relaxed);
+		return Frame(buffer);
+	};
+
+	/*Пиксели для записи. Пишет только декодер, взявший кадр, пока кадр не отдан дальше*/
+	static cv::Mat& pixels(Frame& frame)
+	{
+		assert(frame.m_buffer != nullptr && frame.m_buffer->m_refs.load() == 1);
+		return frame.m_buffer->m_image;
+	};
+
+	/*Сколько буферов создано за все время*/
+	size_t allocated() const { return m_allocated.load(); };
+
+private:
+	friend class Frame;
+
+	void release(Frame::Buffer* buffer)
+	{
+		if (!m_free.tryPush(buffer))
+			delete buffer;
+	};
+
+	RingBuffer<Frame::Buffer*> m_free;
+	std::atomic<size_t> m_allocated{ 0 };
+};
+
+inline void Frame::reset()
+{
+	if (m_buffer != nullptr && m_buffer->m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		m_buffer->m_pool->release(m_buffer);
+	m_buffer = nullptr;
+}
+
+/*Откуда читать кадры:
+"-" - поток Y4M со стандартного входа, например ffmpeg ... -f yuv4mpegpipe - | tracker -;
+*.y4m - файл Y4M (YUV 4:2:0 или оттенки серого без сжатия);
+путь с %, например frames/%05d.jpg - последовательность картинок с номерами от 0 или 1;
+остальное - видео или поток, который открывает cv::VideoCapture*/
+struct FrameSourceOptions
+{
+	/*Потоки декодирования. У видео это потоки кодека (OpenCV 4.6 и новее). У картинок и
+	файла Y4M - свои потоки, каждый декодирует свою часть кадров, а выдаются кадры
+	по порядку. 0 - у видео решает OpenCV, картинки и Y4M декодируются в читающем
+	потоке. Поток Y4M со стандартного входа всегда читается в читающем потоке*/
+	int m_threads = 0;
+
+	/*Аппаратное декодирование видео, если его поддерживает сборка OpenCV (4.5.2 и новее).
+	Если ускорителя нет, видео декодируется на процессоре*/
+	bool m_hardware = false;
+};
+
+class FrameSource
+{
+public:
+	virtual ~FrameSource() = default;
+
+	/*Следующий кадр в буфере из пула. false, когда кадры кончились*/
+	virtual bool read(Frame& frame) = 0;
+};
+
+/*nullptr, если path не открывается. pool должен пережить источник и все его кадры*/
+std::unique_ptr<FrameSource> makeFrameSource(const std::string& path, FramePool& pool,
+	const FrameSourceOptions& options = FrameSourceOptions());
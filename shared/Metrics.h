@@ -0,0 +1,369 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/*Стадии обработки кадра, время которых замеряется. Одни стадии есть только у
+Tracker SSD (сеть), другие только у Tracker common (фон, трекеры объектов)*/
+enum class Stage : uint8_t
+{
+	/*Чтение и декодирование кадра*/
+	Capture,
+	/*Подготовка входа сети*/
+	Preprocess,
+	Inference,
+	/*Отбор выходов сети по порогам*/
+	Decode,
+	Nms,
+	/*Сопоставление боксов с треками и повторная идентификация*/
+	Association,
+	/*Поиск движения (вычитание фона)*/
+	Motion,
+	/*Дескриптор бокса для повторной идентификации*/
+	Histogram,
+	/*Обновление одного трекера объекта*/
+	ObjectTracker,
+	/*Весь шаг трекинга кадра*/
+	Tracking,
+	/*Отрисовка и imshow*/
+	Draw,
+	Count
+};
+
+inline const char* stageName(const Stage stage)
+{
+	static const char* names[] = { "capture", "preprocess", "inference", "decode", "nms", "association", "motion",
+		"histogram", "object tracker", "tracking", "draw" };
+	static_assert(sizeof(names) / sizeof(names[0]) == size_t(Stage::Count), "every stage needs a name");
+	return names[size_t(stage)];
+}
+
+enum class MetricsFormat
+{
+	/*Таблица через табуляцию, как у замеров --bench*/
+	Text,
+	/*{"stages":[{"camera":0,"stage":"inference","count":...,"mean_us":...,"p50_us":...,"p99_us":...,"max_us":...}]}*/
+	Json
+};
+
+/*Время стадий по камерам. Каждый поток пишет в свои гистограммы без блокировок
+и без общих с другими потоками кэш-линий, а snapshot суммирует гистограммы всех
+потоков, в том числе уже завершившихся. Гистограмма логарифмическая с 8 корзинами
+на каждую степень двойки, поэтому процентили точны до 12.5%.
+Замеры выключены, пока не вызван setEnabled(true): тогда MEASURE_STAGE стоит одну
+проверку флага. С TRACKER_NO_METRICS макрос не компилируется вовсе*/
+class Metrics
+{
+public:
+	/*Камеры с большими номерами учитываются вместе с последней*/
+	static constexpr int MAX_CAMERAS = 64;
+
+	struct Summary
+	{
+		int m_camera = 0;
+		Stage m_stage = Stage::Capture;
+		uint64_t m_count = 0;
+
+		/*Микросекунды*/
+		double m_mean = 0;
+		double m_p50 = 0;
+		double m_p99 = 0;
+		double m_max = 0;
+	};
+
+	static void setEnabled(const bool enabled) { enabledFlag().store(enabled, std::memory_order_relaxed); };
+	static bool enabled() { return enabledFlag().load(std::memory_order_relaxed); };
+
+	/*Добавляет замер стадии в гистограмму текущего потока*/
+	static void record(const Stage stage, const int camera, const uint64_t nanoseconds)
+	{
+		local().camera(camera).m_stages[size_t(stage)].add(nanoseconds);
+	};
+
+	/*Итоги по всем камерам и стадиям, у которых были замеры, по порядку камер и стадий*/
+	static std::vector<Summary> snapshot()
+	{
+		std::vector<Summary> summaries;
+		std::lock_guard<std::mutex> lock(registryMutex());
+		Histogram merged;
+		for (int camera = 0; camera < MAX_CAMERAS; ++camera)
+		{
+			for (size_t stage = 0; stage < size_t(Stage::Count); ++stage)
+			{
+				merged.clear();
+				for (auto& thread : registry())
+				{
+					const CameraHistograms* histograms = thread->m_cameras[camera].load(std::memory_order_acquire);
+					if (histograms != nullptr)
+						merged.merge(histograms->m_stages[stage]);
+				}
+				if (merged.m_count.load() == 0)
+					continue;
+
+				Summary summary;
+				summary.m_camera = camera;
+				summary.m_stage = Stage(stage);
+				summary.m_count = merged.m_count.load();
+				summary.m_mean = merged.m_sum.load() / 1000.0 / summary.m_count;
+				summary.m_p50 = merged.percentile(0.5) / 1000.0;
+				summary.m_p99 = merged.percentile(0.99) / 1000.0;
+				summary.m_max = merged.m_max.load() / 1000.0;
+				summaries.push_back(summary);
+			}
+		}
+		return summaries;
+	};
+
+	static void write(std::ostream& out, const MetricsFormat format)
+	{
+		auto summaries = snapshot();
+		if (format == MetricsFormat::Text)
+		{
+			out << "camera\tstage\tcount\tmean, us\tp50, us\tp99, us\tmax, us\n";
+			for (auto& summary : summaries)
+			{
+				out << summary.m_camera << '\t' << stageName(summary.m_stage) << '\t' << summary.m_count << '\t'
+					<< summary.m_mean << '\t' << summary.m_p50 << '\t' << summary.m_p99 << '\t' << summary.m_max << '\n';
+			}
+			out.flush();
+			return;
+		}
+
+		out << "{\"stages\":[";
+		for (size_t i = 0; i < summaries.size(); ++i)
+		{
+			const Summary& summary = summaries[i];
+			out << (i > 0 ? "," : "") << "\n{\"camera\":" << summary.m_camera << ",\"stage\":\""
+				<< stageName(summary.m_stage) << "\",\"count\":" << summary.m_count << ",\"mean_us\":" << summary.m_mean
+				<< ",\"p50_us\":" << summary.m_p50 << ",\"p99_us\":" << summary.m_p99 << ",\"max_us\":"
+				<< summary.m_max << '}';
+		}
+		out << "\n]}" << std::endl;
+	};
+
+	/*Обнуляет все гистограммы. Замеры, идущие в это время в других потоках, могут
+	потеряться, поэтому вызывается между прогонами*/
+	static void reset()
+	{
+		std::lock_guard<std::mutex> lock(registryMutex());
+		for (auto& thread : registry())
+		{
+			for (auto& camera : thread->m_cameras)
+			{
+				CameraHistograms* histograms = camera.load(std::memory_order_acquire);
+				if (histograms == nullptr)
+					continue;
+				for (auto& histogram : histograms->m_stages)
+					histogram.clear();
+			}
+		}
+	};
+
+private:
+	/*Значения меньше 16 нс - по корзине на наносекунду, дальше по 8 корзин на
+	степень двойки до 2^48 нс*/
+	static constexpr int LINEAR = 16;
+	static constexpr int SUB_BITS = 3;
+	static constexpr int MAX_EXPONENT = 47;
+	static constexpr size_t BUCKETS = LINEAR + (MAX_EXPONENT - 3) * (1 << SUB_BITS);
+
+	/*Номер старшего единичного бита*/
+	static int highestBit(const uint64_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return int(index);
+#else
+		return 63 - __builtin_clzll(value);
+#endif
+	};
+
+	static size_t bucketOf(const uint64_t value)
+	{
+		if (value < uint64_t(LINEAR))
+			return size_t(value);
+		const int exponent = highestBit(value);
+		if (exponent > MAX_EXPONENT)
+			return BUCKETS - 1;
+		const size_t sub = size_t(value >> (exponent - SUB_BITS)) & ((1 << SUB_BITS) - 1);
+		return LINEAR + size_t(exponent - 4) * (1 << SUB_BITS) + sub;
+	};
+
+	/*Середина корзины*/
+	static double valueOf(const size_t bucket)
+	{
+		if (bucket < size_t(LINEAR))
+			return double(bucket);
+		const int exponent = 4 + int(bucket - LINEAR) / (1 << SUB_BITS);
+		const uint64_t sub = (bucket - LINEAR) % (1 << SUB_BITS);
+		const uint64_t width = uint64_t(1) << (exponent - SUB_BITS);
+		return double(((1 << SUB_BITS) + sub) * width) + width / 2.0;
+	};
+
+	/*Гистограмму пишет один поток, поэтому вместо атомарного сложения достаточно
+	чтения и записи. Атомарные они только для того, чтобы snapshot мог читать их
+	из другого потока*/
+	struct Histogram
+	{
+		std::atomic<uint64_t> m_buckets[BUCKETS] = {};
+		std::atomic<uint64_t> m_count{ 0 };
+		std::atomic<uint64_t> m_sum{ 0 };
+		std::atomic<uint64_t> m_max{ 0 };
+
+		void add(const uint64_t value)
+		{
+			auto increment = [](std::atomic<uint64_t>& counter, const uint64_t amount)
+			{
+				counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+			};
+			increment(m_buckets[bucketOf(value)], 1);
+			increment(m_count, 1);
+			increment(m_sum, value);
+			if (value > m_max.load(std::memory_order_relaxed))
+				m_max.store(value, std::memory_order_relaxed);
+		};
+
+		void merge(const Histogram& other)
+		{
+			for (size_t i = 0; i < BUCKETS; ++i)
+				m_buckets[i].store(m_buckets[i].load() + other.m_buckets[i].load());
+			m_count.store(m_count.load() + other.m_count.load());
+			m_sum.store(m_sum.load() + other.m_sum.load());
+			m_max.store(std::max(m_max.load(), other.m_max.load()));
+		};
+
+		void clear()
+		{
+			for (auto& bucket : m_buckets)
+				bucket.store(0);
+			m_count.store(0);
+			m_sum.store(0);
+			m_max.store(0);
+		};
+
+		/*Наносекунды*/
+		double percentile(const double fraction) const
+		{
+			const uint64_t count = m_count.load();
+			const uint64_t rank = std::max<uint64_t>(uint64_t(fraction * count + 0.5), 1);
+			uint64_t seen = 0;
+			for (size_t i = 0; i < BUCKETS; ++i)
+			{
+				seen += m_buckets[i].load();
+				if (seen >= rank)
+					return std::min(valueOf(i), double(m_max.load()));
+			}
+			return double(m_max.load());
+		};
+	};
+
+	struct CameraHistograms
+	{
+		Histogram m_stages[size_t(Stage::Count)];
+	};
+
+	/*Гистограммы одного потока. Гистограммы камеры создаются при первом замере*/
+	struct ThreadHistograms
+	{
+		std::atomic<CameraHistograms*> m_cameras[MAX_CAMERAS] = {};
+
+		~ThreadHistograms()
+		{
+			for (auto& camera : m_cameras)
+				delete camera.load();
+		};
+
+		CameraHistograms& camera(int index)
+		{
+			index = std::min(std::max(index, 0), MAX_CAMERAS - 1);
+			CameraHistograms* histograms = m_cameras[index].load(std::memory_order_relaxed);
+			if (histograms == nullptr)
+			{
+				histograms = new CameraHistograms();
+				m_cameras[index].store(histograms, std::memory_order_release);
+			}
+			return *histograms;
+		};
+	};
+
+	static std::atomic<bool>& enabledFlag()
+	{
+		static std::atomic<bool> enabled{ false };
+		return enabled;
+	};
+
+	static std::mutex& registryMutex()
+	{
+		static std::mutex mutex;
+		return mutex;
+	};
+
+	/*Гистограммы всех потоков, когда-либо делавших замеры. Переживают свои потоки*/
+	static std::vector<std::shared_ptr<ThreadHistograms>>& registry()
+	{
+		static std::vector<std::shared_ptr<ThreadHistograms>> threads;
+		return threads;
+	};
+
+	static ThreadHistograms& local()
+	{
+		thread_local std::shared_ptr<ThreadHistograms> histograms = []
+		{
+			auto created = std::make_shared<ThreadHistograms>();
+			std::lock_guard<std::mutex> lock(registryMutex());
+			registry().push_back(created);
+			return created;
+		}();
+		return *histograms;
+	};
+};
+
+/*Замеряет время от создания до конца области видимости, если замеры включены*/
+class ScopedTimer
+{
+public:
+	ScopedTimer(const Stage stage, const int camera) : m_stage(stage), m_camera(camera), m_enabled(Metrics::enabled())
+	{
+		if (m_enabled)
+			m_start = std::chrono::steady_clock::now();
+	};
+
+	~ScopedTimer()
+	{
+		if (!m_enabled)
+			return;
+		auto elapsed = std::chrono::steady_clock::now() - m_start;
+		Metrics::record(m_stage, m_camera,
+			uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+	};
+
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+	Stage m_stage;
+	int m_camera;
+	bool m_enabled;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+/*MEASURE_STAGE(Stage::Inference, camera); замеряет остаток текущего блока*/
+#ifndef TRACKER_NO_METRICS
+#define METRICS_JOIN_IMPL(a, b) a##b
+#define METRICS_JOIN(a, b) METRICS_JOIN_IMPL(a, b)
+#define MEASURE_STAGE(stage, camera) ScopedTimer METRICS_JOIN(stageTimer, __LINE__)(stage, camera)
+#else
+#define MEASURE_STAGE(stage, camera) ((void)0)
+#endif
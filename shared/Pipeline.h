@@ -0,0 +1,338 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "FrameSource.h"
+#include "Metrics.h"
+#include "RingBuffer.h"
+#include "TrackEvents.h"
+
+/*Общая часть конвейеров обоих трекеров: захват кадра -> трекинг -> вывод (отрисовка и imshow).
+Стадии работают в разных потоках и связаны ограниченными очередями, поэтому медленный
+трекинг не задерживает чтение кадров, а медленная камера - остальные камеры. Кадры
+декодируются в буферы из пула камеры (FrameSource.h) и передаются между стадиями по
+ссылке, без копирования. Захват, вывод, запись событий и итоги здесь, а стадию трекинга
+и отрисовку треков задает каждый трекер в своем Pipeline.cpp*/
+
+/*Настройки стадий, общие для обоих трекеров*/
+struct StageOptions
+{
+	bool m_display = true;
+
+	/*Выдавать ли кадры с частотой 30 в секунду, как это делает камера.
+	Для замеров производительности выключается*/
+	bool m_paced = true;
+
+	/*Сколько кадров прочитать с каждой камеры. 0 - до конца видео*/
+	size_t m_maxFrames = 0;
+
+	/*Потоки и аппаратное декодирование, см. FrameSourceOptions*/
+	FrameSourceOptions m_source;
+
+	/*Размер очередей между стадиями и поведение при их переполнении*/
+	size_t m_queueSize = 4;
+	QueuePolicy m_policy = QueuePolicy::DropOldest;
+
+	/*Куда записывать треки каждого кадра, строками camera,frame,id,x,y,width,height.
+	Пустая строка - не записывать*/
+	std::string m_tracksPath;
+
+	/*Куда записывать события треков всех камер и в каком формате, см. EventWriter.
+	Пустая строка - не записывать*/
+	std::string m_eventsPath;
+	EventFormat m_eventFormat = EventFormat::Lines;
+
+	/*Пакетная обработка записанного видео: без окон, без ожидания между кадрами
+	и без выброса кадров*/
+	void setHeadless(const std::string& tracksPath)
+	{
+		m_display = false;
+		m_paced = false;
+		m_policy = QueuePolicy::Block;
+		m_tracksPath = tracksPath;
+	};
+};
+
+/*Итоги работы одной камеры*/
+struct StreamReport
+{
+	size_t m_captured = 0;
+	size_t m_shown = 0;
+
+	/*Выброшено кадров перед стадией трекинга и перед стадией вывода*/
+	size_t m_droppedTracking = 0;
+	size_t m_droppedOutput = 0;
+
+	/*Задержка от захвата кадра до вывода результата, мс*/
+	double m_meanLatency = 0;
+	double m_maxLatency = 0;
+};
+
+struct PipelineStats
+{
+	/*Суммарное количество кадров, прошедших все стадии, со всех камер*/
+	size_t m_frames = 0;
+	double m_seconds = 0;
+	std::vector<StreamReport> m_streams;
+
+	/*Записано и выброшено событий треков, байт в файле событий*/
+	size_t m_events = 0;
+	size_t m_droppedEvents = 0;
+	size_t m_eventBytes = 0;
+
+	double fps() const { return m_seconds > 0 ? m_frames / m_seconds : 0; };
+};
+
+/*Кадр, проходящий через стадии конвейера. Пиксели только для чтения*/
+struct PipelineFrame
+{
+	Frame m_frame;
+	size_t m_index = 0;
+	std::chrono::steady_clock::time_point m_captured;
+
+	/*id и координаты треков для tracks.csv, заполняется стадией трекинга,
+	только если файл треков задан*/
+	std::vector<std::pair<int, cv::Rect>> m_tracks;
+
+	/*События треков этого кадра и треки для отрисовки, собранные из событий*/
+	std::vector<TrackEvent> m_events;
+	std::vector<std::pair<int, cv::Rect>> m_drawn;
+};
+
+/*Очереди одной камеры. Каждую очередь пишет и читает ровно по одной стадии*/
+struct PipelineStream
+{
+	PipelineStream(const StageOptions& options) :
+		m_captured(options.m_queueSize, options.m_policy),
+		m_processed(options.m_queueSize, options.m_policy) {};
+
+	/*Объявлен до очередей, т.к. должен пережить кадры в них*/
+	FramePool m_pool;
+
+	RingBuffer<PipelineFrame> m_captured;
+	RingBuffer<PipelineFrame> m_processed;
+
+	/*Заполняются стадиями захвата и вывода соответственно*/
+	size_t m_frames = 0;
+	StreamReport m_report;
+	bool m_finished = false;
+
+	/*Треки камеры по событиям. Собираются в стадии трекинга, т.к. кадры с
+	событиями могут быть выброшены из очереди перед выводом*/
+	TrackView m_view;
+
+	/*Копия кадра для отрисовки треков, заполняется стадией вывода*/
+	cv::Mat m_canvas;
+};
+
+inline void captureStage(const int id, const std::string& path, const StageOptions& options, PipelineStream& stream)
+{
+	/*Основная единица времени, равная (1 / FPS_видео)*/
+	using FPS = std::chrono::duration<uint64_t, std::ratio<1, 30>>;
+	const auto frameTime = std::chrono::duration_cast<std::chrono::steady_clock::duration>(FPS(1));
+
+	auto source = makeFrameSource(path, stream.m_pool, options.m_source);
+	if (source == nullptr)
+		std::cout << "cannot open " << path << std::endl;
+	auto next = std::chrono::steady_clock::now();
+
+	size_t index = 0;
+	while (source != nullptr && (options.m_maxFrames == 0 || index < options.m_maxFrames))
+	{
+		PipelineFrame item;
+		{
+			MEASURE_STAGE(Stage::Capture, id);
+			if (!source->read(item.m_frame))
+				break;
+		}
+		item.m_index = index++;
+		item.m_captured = std::chrono::steady_clock::now();
+		stream.m_captured.push(std::move(item));
+
+		if (options.m_paced)
+		{
+			next += frameTime;
+			std::this_thread::sleep_until(next);
+		}
+	}
+
+	stream.m_frames = index;
+	stream.m_captured.close();
+}
+
+/*Конец шага стадии трекинга для кадра item: события трекера получают номер кадра и
+уходят в events (nullptr, если не записываются) и в треки для отрисовки, затем кадр
+передается на вывод*/
+template <class Tracker>
+void publishFrame(Tracker& tracker, EventWriter* events, const StageOptions& options, PipelineStream& stream,
+	PipelineFrame& item)
+{
+	tracker.takeEvents(item.m_events);
+	stampEvents(item.m_events, item.m_index);
+	if (events != nullptr)
+		events->write(item.m_events);
+	if (options.m_display)
+	{
+		stream.m_view.apply(item.m_events);
+		item.m_drawn = stream.m_view.tracks();
+	}
+	if (!options.m_tracksPath.empty())
+		item.m_tracks = tracker.visibleTracks();
+	stream.m_processed.push(std::move(item));
+}
+
+/*Стадия вывода всех камер. Выполняется в вызывающем потоке, т.к. imshow можно вызывать
+только из основного. show(camera, canvas, tracks) рисует треки на копии кадра и показывает ее*/
+template <class Show>
+void outputStage(std::vector<std::unique_ptr<PipelineStream>>& streams, const StageOptions& options, Show show)
+{
+	std::ofstream tracksFile;
+	if (!options.m_tracksPath.empty())
+		tracksFile.open(options.m_tracksPath);
+
+	size_t running = streams.size();
+	while (running > 0)
+	{
+		bool shown = false;
+		for (size_t i = 0; i < streams.size(); ++i)
+		{
+			PipelineStream& stream = *streams[i];
+			if (stream.m_finished)
+				continue;
+
+			PipelineFrame item;
+			bool closed = stream.m_processed.closed();
+			if (!stream.m_processed.tryPop(item))
+			{
+				if (closed)
+				{
+					stream.m_finished = true;
+					--running;
+				}
+				continue;
+			}
+
+			/*Кадр могут читать другие стадии, поэтому треки рисуются на копии*/
+			if (options.m_display)
+			{
+				MEASURE_STAGE(Stage::Draw, int(i));
+				item.m_frame.image().copyTo(stream.m_canvas);
+				show(i, stream.m_canvas, item.m_drawn);
+			}
+
+			for (auto& track : item.m_tracks)
+			{
+				if (!tracksFile.is_open())
+					break;
+				const cv::Rect& box = track.second;
+				tracksFile << i << ',' << item.m_index << ',' << track.first << ',' << box.x << ','
+					<< box.y << ',' << box.width << ',' << box.height << '\n';
+			}
+
+			double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+				item.m_captured).count();
+			StreamReport& report = stream.m_report;
+			report.m_meanLatency += (latency - report.m_meanLatency) / double(++report.m_shown);
+			report.m_maxLatency = std::max(report.m_maxLatency, latency);
+			shown = true;
+		}
+
+		/*waitKey нужен, иначе imshow может не отработать. Клавиша m печатает
+		текущие замеры стадий*/
+		if (options.m_display && shown)
+		{
+			if (cv::waitKey(1) == 'm' && Metrics::enabled())
+				Metrics::write(std::cout, MetricsFormat::Text);
+		}
+		else if (!shown)
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+}
+
+/*Запускает по конвейеру на каждое видео из paths и ждет, пока все они закончатся.
+startTracking(camera, stream, events) запускает поток стадии трекинга камеры и возвращает
+его, events - nullptr, если события не записываются. show - как в outputStage*/
+template <class StartTracking, class Show>
+PipelineStats runStages(const std::vector<std::string>& paths, const StageOptions& options,
+	StartTracking startTracking, Show show)
+{
+	std::vector<std::unique_ptr<PipelineStream>> streams;
+	for (size_t i = 0; i < paths.size(); ++i)
+		streams.emplace_back(std::make_unique<PipelineStream>(options));
+
+	std::unique_ptr<EventWriter> events;
+	if (!options.m_eventsPath.empty())
+	{
+		events = std::make_unique<EventWriter>(options.m_eventsPath, options.m_eventFormat);
+		if (!events->isOpen())
+		{
+			std::cout << "cannot open " << options.m_eventsPath << std::endl;
+			events.reset();
+		}
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < paths.size(); ++i)
+	{
+		workers.emplace_back(captureStage, int(i), std::cref(paths[i]), std::cref(options), std::ref(*streams[i]));
+		workers.push_back(startTracking(i, *streams[i], events.get()));
+	}
+
+	outputStage(streams, options, show);
+
+	for (auto& worker : workers)
+		worker.join();
+
+	PipelineStats stats;
+	stats.m_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (events != nullptr)
+	{
+		events->close();
+		stats.m_events = events->written();
+		stats.m_droppedEvents = events->dropped();
+		stats.m_eventBytes = events->bytes();
+	}
+	for (auto& stream : streams)
+	{
+		StreamReport report = stream->m_report;
+		report.m_captured = stream->m_frames;
+		report.m_droppedTracking = stream->m_captured.dropped();
+		report.m_droppedOutput = stream->m_processed.dropped();
+		stats.m_frames += report.m_shown;
+		stats.m_streams.push_back(report);
+	}
+	return stats;
+}
+
+/*Печатает количество выброшенных кадров и задержку по каждой камере*/
+inline void printStats(const PipelineStats& stats)
+{
+	std::cout << "stream\tcaptured\tshown\tdropped before tracking\tdropped before output\t"
+		"mean latency, ms\tmax latency, ms\n";
+	for (size_t i = 0; i < stats.m_streams.size(); ++i)
+	{
+		const StreamReport& report = stats.m_streams[i];
+		std::cout << i << '\t' << report.m_captured << '\t' << report.m_shown << '\t'
+			<< report.m_droppedTracking << '\t' << report.m_droppedOutput << '\t'
+			<< report.m_meanLatency << '\t' << report.m_maxLatency << '\n';
+	}
+	if (stats.m_events > 0 || stats.m_droppedEvents > 0)
+	{
+		std::cout << "events written: " << stats.m_events << ", dropped: " << stats.m_droppedEvents << ", bytes: "
+			<< stats.m_eventBytes << '\n';
+	}
+	std::cout << "total fps: " << stats.fps() << std::endl;
+}
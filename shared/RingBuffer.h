@@ -0,0 +1,187 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+/*Что делать стадии-производителю, если очередь к следующей стадии заполнена*/
+enum class QueuePolicy
+{
+	/*Ждать, пока следующая стадия освободит место. Кадры не теряются*/
+	Block,
+
+	/*Выбросить самый старый кадр. Задержка остается постоянной даже если
+	следующая стадия не успевает*/
+	DropOldest
+};
+
+/*Ограниченная lock-free очередь между стадиями конвейера (алгоритм Вьюкова).
+Каждая ячейка хранит счетчик, по которому производитель и потребитель понимают,
+свободна ли она. Выброс старого элемента - это обычное извлечение со стороны
+производителя, поэтому очередь допускает нескольких потребителей*/
+template <class T>
+class RingBuffer
+{
+public:
+	/*Емкость округляется вверх до степени двойки*/
+	RingBuffer(const size_t capacity, const QueuePolicy policy) : m_policy(policy)
+	{
+		size_t size = 2;
+		while (size < capacity)
+			size *= 2;
+
+		m_cells = std::vector<Cell>(size);
+		m_mask = size - 1;
+		for (size_t i = 0; i < size; ++i)
+			m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+	};
+
+	RingBuffer(const RingBuffer&) = delete;
+	RingBuffer& operator=(const RingBuffer&) = delete;
+
+	/*Кладет элемент, если есть место. При неудаче item не меняется*/
+	bool tryPush(T& item)
+	{
+		Cell* cell;
+		size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			cell = &m_cells[pos & m_mask];
+			size_t seq = cell->m_sequence.load(std::memory_order_acquire);
+			intptr_t diff = intptr_t(seq) - intptr_t(pos);
+			if (diff == 0)
+			{
+				if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = m_enqueuePos.load(std::memory_order_relaxed);
+		}
+
+		cell->m_data = std::move(item);
+		cell->m_sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	};
+
+	/*Достает самый старый элемент, если очередь не пуста*/
+	bool tryPop(T& item)
+	{
+		Cell* cell;
+		size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			cell = &m_cells[pos & m_mask];
+			size_t seq = cell->m_sequence.load(std::memory_order_acquire);
+			intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+			if (diff == 0)
+			{
+				if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = m_dequeuePos.load(std::memory_order_relaxed);
+		}
+
+		item = std::move(cell->m_data);
+		cell->m_sequence.store(pos + m_mask + 1, std::memory_order_release);
+		return true;
+	};
+
+	/*Кладет элемент согласно политике очереди. Возвращает false, только если очередь закрыта*/
+	bool push(T item)
+	{
+		for (int attempt = 0; ; ++attempt)
+		{
+			if (m_closed.load())
+				return false;
+			if (tryPush(item))
+				return true;
+
+			if (m_policy == QueuePolicy::DropOldest)
+			{
+				T oldest;
+				if (tryPop(oldest))
+					m_dropped.fetch_add(1, std::memory_order_relaxed);
+			}
+			else
+				wait(attempt);
+		}
+	};
+
+	/*Ждет элемент. Возвращает false, когда очередь закрыта и в ней ничего не осталось*/
+	bool pop(T& item)
+	{
+		for (int attempt = 0; ; ++attempt)
+		{
+			/*Флаг читаем до попытки извлечения: если очередь уже была закрыта и
+			извлечь ничего не удалось, новых элементов точно не будет*/
+			bool closed = m_closed.load();
+			if (tryPop(item))
+				return true;
+			if (closed)
+				return false;
+			wait(attempt);
+		}
+	};
+
+	/*Как pop, но ждет не дольше timeout. false и когда время вышло, и когда очередь
+	закрыта и пуста, различить можно по closed()*/
+	bool popFor(T& item, const std::chrono::microseconds timeout)
+	{
+		const auto deadline = std::chrono::steady_clock::now() + timeout;
+		for (int attempt = 0; ; ++attempt)
+		{
+			bool closed = m_closed.load();
+			if (tryPop(item))
+				return true;
+			if (closed || std::chrono::steady_clock::now() >= deadline)
+				return false;
+			wait(attempt);
+		}
+	};
+
+	/*Производитель больше ничего не положит*/
+	void close() { m_closed.store(true); };
+	bool closed() const { return m_closed.load(); };
+
+	/*Сколько элементов выброшено из-за переполнения*/
+	size_t dropped() const { return m_dropped.load(std::memory_order_relaxed); };
+
+	size_t capacity() const { return m_cells.size(); };
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> m_sequence{ 0 };
+		T m_data;
+	};
+
+	/*Сначала немного крутимся, потом уступаем процессор, потом спим.
+	Так короткие ожидания не стоят переключения контекста, а длинные не жгут ядро*/
+	static void wait(const int attempt)
+	{
+		if (attempt < 16)
+			return;
+		else if (attempt < 64)
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+	};
+
+	std::vector<Cell> m_cells;
+	size_t m_mask = 0;
+	QueuePolicy m_policy;
+
+	/*Индексы на разных кэш-линиях, чтобы производитель и потребитель не мешали друг другу*/
+	alignas(64) std::atomic<size_t> m_enqueuePos{ 0 };
+	alignas(64) std::atomic<size_t> m_dequeuePos{ 0 };
+	alignas(64) std::atomic<size_t> m_dropped{ 0 };
+	std::atomic<bool> m_closed{ false };
+};
@@ -0,0 +1,315 @@
+#include "SelfTest.h"
+#include "RingBuffer.h"
+#include "SlotMap.h"
+#include "ThreadPool.h"
+#include "TrackEvents.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	/*Печатает проверку и ее результат, считает проваленные*/
+	class Checks
+	{
+	public:
+		explicit Checks(const char* name) : m_name(name) {};
+
+		void operator()(const bool passed, const std::string& what)
+		{
+			std::cout << m_name << ": " << what << (passed ? " - ok" : " - FAILED") << std::endl;
+			m_failed += !passed;
+		};
+
+		bool passed() const { return m_failed == 0; };
+
+	private:
+		const char* m_name;
+		int m_failed = 0;
+	};
+}
+
+bool testRingBuffer()
+{
+	Checks check("ring buffer");
+	{
+		RingBuffer<int> queue(5, QueuePolicy::Block);
+		check(queue.capacity() == 8, "capacity is rounded up to a power of two");
+
+		bool order = true;
+		for (int i = 0; i < 8; ++i)
+		{
+			int item = i;
+			order = order && queue.tryPush(item);
+		}
+		int extra = 100;
+		check(order && !queue.tryPush(extra) && extra == 100, "tryPush fails on a full queue and keeps the item");
+		for (int i = 0; i < 8; ++i)
+		{
+			int item = -1;
+			order = order && queue.tryPop(item) && item == i;
+		}
+		int item = -1;
+		check(order && !queue.tryPop(item), "items come out in FIFO order, tryPop fails on an empty queue");
+	}
+	{
+		RingBuffer<int> queue(4, QueuePolicy::DropOldest);
+		for (int i = 0; i < 10; ++i)
+			queue.push(i);
+		std::vector<int> left;
+		int item;
+		while (queue.tryPop(item))
+			left.push_back(item);
+		check(queue.dropped() == 6 && left == std::vector<int>({ 6, 7, 8, 9 }),
+			"DropOldest keeps the newest items and counts the dropped ones");
+	}
+	{
+		RingBuffer<int> queue(4, QueuePolicy::Block);
+		queue.push(1);
+		queue.close();
+		int item = 0;
+		check(!queue.push(2) && queue.pop(item) && item == 1 && !queue.pop(item),
+			"a closed queue rejects push and drains before pop returns false");
+	}
+	{
+		RingBuffer<int> queue(4, QueuePolicy::Block);
+		int item = 0;
+		check(!queue.popFor(item, std::chrono::microseconds(1000)) && !queue.closed(), "popFor times out on an open queue");
+	}
+
+	/*Несколько производителей и потребителей через маленькую очередь: каждое значение
+	доходит ровно один раз, а значения одного производителя - по порядку*/
+	{
+		constexpr int PRODUCERS = 3, CONSUMERS = 3, COUNT = 100000;
+		RingBuffer<int> queue(4, QueuePolicy::Block);
+		std::vector<std::vector<int>> received(CONSUMERS);
+		std::vector<std::thread> consumers;
+		for (int c = 0; c < CONSUMERS; ++c)
+		{
+			consumers.emplace_back([&, c] {
+				int item;
+				while (queue.pop(item))
+					received[c].push_back(item);
+			});
+		}
+		std::vector<std::thread> producers;
+		for (int p = 0; p < PRODUCERS; ++p)
+		{
+			producers.emplace_back([&, p] {
+				for (int i = 0; i < COUNT; ++i)
+					queue.push(p * COUNT + i);
+			});
+		}
+		for (auto& producer : producers)
+			producer.join();
+		queue.close();
+		for (auto& consumer : consumers)
+			consumer.join();
+
+		std::vector<int> seen(PRODUCERS * COUNT, 0);
+		bool ordered = true;
+		for (auto& items : received)
+		{
+			std::vector<int> last(PRODUCERS, -1);
+			for (int item : items)
+			{
+				++seen[item];
+				ordered = ordered && item > last[item / COUNT];
+				last[item / COUNT] = item;
+			}
+		}
+		bool once = true;
+		for (int count : seen)
+			once = once && count == 1;
+		check(once && ordered && queue.dropped() == 0,
+			"3 producers and 3 consumers pass 300000 items exactly once and in order per producer");
+	}
+	return check.passed();
+}
+
+bool testThreadPool()
+{
+	Checks check("thread pool");
+	for (size_t threads : { 1, 4 })
+	{
+		ThreadPool pool(threads);
+		bool covered = true;
+		for (size_t count : { 0, 1, 2, 1000 })
+		{
+			std::vector<std::atomic<int>> calls(count);
+			pool.parallelFor(count, [&](const size_t i) { calls[i].fetch_add(1); });
+			for (auto& call : calls)
+				covered = covered && call.load() == 1;
+		}
+		check(covered, "parallelFor calls every index exactly once with " + std::to_string(threads) + " threads");
+	}
+
+	ThreadPool pool(4);
+	{
+		/*Несколько камер делят пул, их циклы стоят в одной очереди*/
+		constexpr int CALLERS = 4, LOOPS = 200, COUNT = 64;
+		std::vector<std::vector<std::atomic<int>>> calls(CALLERS);
+		for (auto& perCaller : calls)
+			perCaller = std::vector<std::atomic<int>>(COUNT);
+		std::vector<std::thread> callers;
+		for (int c = 0; c < CALLERS; ++c)
+		{
+			callers.emplace_back([&, c] {
+				for (int loop = 0; loop < LOOPS; ++loop)
+					pool.parallelFor(COUNT, [&](const size_t i) { calls[c][i].fetch_add(1); });
+			});
+		}
+		for (auto& caller : callers)
+			caller.join();
+		bool covered = true;
+		for (auto& perCaller : calls)
+			for (auto& call : perCaller)
+				covered = covered && call.load() == LOOPS;
+		check(covered, "4 callers sharing the pool each get all of their iterations");
+	}
+	{
+		std::atomic<int> inner{ 0 };
+		pool.parallelFor(8, [&](size_t) { pool.parallelFor(8, [&](size_t) { inner.fetch_add(1); }); });
+		check(inner.load() == 64, "nested parallelFor completes");
+	}
+	{
+		/*parallelFor возвращается только после всех итераций*/
+		std::vector<int> values(10000, 0);
+		pool.parallelFor(values.size(), [&](const size_t i) { values[i] = int(i); });
+		bool complete = true;
+		for (size_t i = 0; i < values.size(); ++i)
+			complete = complete && values[i] == int(i);
+		check(complete, "results of every iteration are visible after parallelFor returns");
+	}
+	return check.passed();
+}
+
+bool testSlotMap()
+{
+	Checks check("slot map");
+	{
+		SlotMap<int> map;
+		SlotHandle a = map.insert(1), b = map.insert(2), c = map.insert(3);
+		check(map.size() == 3 && *map.get(a) == 1 && *map.get(b) == 2 && *map.get(c) == 3, "inserted values are found");
+
+		check(map.erase(a) && !map.contains(a) && map.get(a) == nullptr && !map.erase(a),
+			"an erased handle no longer finds anything");
+		check(map.size() == 2 && map[0] == 3 && map[1] == 2 && *map.get(c) == 3,
+			"erase moves the last value into the hole and its handle still works");
+
+		SlotHandle d = map.insert(4);
+		check(d.m_slot == a.m_slot && d.m_generation != a.m_generation && map.get(a) == nullptr && *map.get(d) == 4,
+			"a reused slot gets a new generation and the old handle stays invalid");
+		check(map.slots() == 3 && map.handleOfSlot(d.m_slot) == d && !map.handleOfSlot(100).valid(),
+			"slots are reused and handleOfSlot finds the live value");
+	}
+
+	/*Случайные вставки и удаления против std::map с теми же ссылками*/
+	SlotMap<int> map;
+	std::map<int, SlotHandle> reference;
+	std::vector<SlotHandle> erased;
+	std::mt19937 random(3);
+	bool consistent = true;
+	size_t largest = 0;
+	for (int step = 0; step < 20000 && consistent; ++step)
+	{
+		if (reference.empty() || random() % 3 != 0)
+			reference[step] = map.insert(step);
+		else
+		{
+			auto victim = std::next(reference.begin(), random() % reference.size());
+			consistent = map.erase(victim->second);
+			erased.push_back(victim->second);
+			reference.erase(victim);
+		}
+		largest = std::max(largest, reference.size());
+
+		if (step % 100 != 0)
+			continue;
+		consistent = consistent && map.size() == reference.size();
+		for (auto& entry : reference)
+			consistent = consistent && map.get(entry.second) != nullptr && *map.get(entry.second) == entry.first;
+		for (auto& handle : erased)
+			consistent = consistent && map.get(handle) == nullptr;
+	}
+	check(consistent, "20000 random inserts and erases agree with std::map");
+	check(map.slots() == largest, "slots grow only to the largest number of live values");
+	return check.passed();
+}
+
+bool testEventWriter()
+{
+	Checks check("event writer");
+	const std::string path = "selftest.events";
+
+	std::vector<TrackEvent> events(3);
+	events[0].m_type = TrackEventType::Start;
+	events[1].m_type = TrackEventType::Update;
+	events[2].m_type = TrackEventType::Expired;
+	for (int i = 0; i < 3; ++i)
+	{
+		events[i].m_camera = 2;
+		events[i].m_id = 7 + i;
+		events[i].m_box = cv::Rect(10 * i, -5, 40000, 80);
+		events[i].m_frame = 100;
+		events[i].m_timestamp = 1234567890123;
+	}
+
+	{
+		EventWriter writer(path, EventFormat::Lines);
+		check(writer.isOpen(), "the lines file opens");
+		for (int batch = 0; batch < 100; ++batch)
+			writer.write(events);
+		writer.close();
+		writer.write(events);
+
+		std::ifstream file(path);
+		std::vector<std::string> lines;
+		for (std::string line; std::getline(file, line);)
+			lines.push_back(line);
+		check(writer.written() == 300 && writer.dropped() == 0 && lines.size() == 300,
+			"every event is written once and nothing after close");
+		check(!lines.empty() && lines[0] ==
+			"{\"time\":1234567890123,\"frame\":100,\"camera\":2,\"id\":7,\"event\":\"start\",\"box\":[0,-5,40000,80]}",
+			"a line has the documented JSON layout");
+		check(lines.size() == 300 && lines[2].find("\"event\":\"expired\"") != std::string::npos,
+			"event types are written by name");
+		check(writer.bytes() == size_t(std::ifstream(path, std::ios::ate | std::ios::binary).tellg()),
+			"bytes() matches the file size");
+	}
+	{
+		EventWriter writer(path, EventFormat::Binary);
+		writer.write(events);
+		writer.close();
+
+		std::ifstream file(path, std::ios::binary);
+		std::vector<BinaryTrackEvent> records(4);
+		file.read(reinterpret_cast<char*>(records.data()), std::streamsize(records.size() * sizeof(BinaryTrackEvent)));
+		const size_t count = size_t(file.gcount()) / sizeof(BinaryTrackEvent);
+		const BinaryTrackEvent& first = records[0];
+		check(count == 3 && first.m_timestamp == 1234567890123 && first.m_frame == 100 && first.m_id == 7 &&
+			first.m_x == 0 && first.m_y == -5 && first.m_height == 80 && first.m_camera == 2 &&
+			first.m_type == uint8_t(TrackEventType::Start) && records[2].m_type == uint8_t(TrackEventType::Expired),
+			"binary records keep the event fields");
+		check(count == 3 && first.m_width == INT16_MAX, "coordinates outside int16 are clamped");
+	}
+	{
+		/*Очередь на 2 пачки, писатель не успевает за пачками подряд: выброшенные
+		учитываются, а записанные и выброшенные вместе дают все события*/
+		EventWriter writer(path, EventFormat::Lines, 2);
+		for (int batch = 0; batch < 10000; ++batch)
+			writer.write(events);
+		writer.close();
+		check(writer.written() + writer.dropped() == 30000 && writer.written() % 3 == 0,
+			"with a full queue whole batches are dropped and counted");
+	}
+	std::remove(path.c_str());
+	return check.passed();
+}
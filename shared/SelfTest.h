@@ -0,0 +1,9 @@
+#pragma once
+
+/*Проверки поведения общих примитивов (RingBuffer, ThreadPool, SlotMap, EventWriter).
+Каждая печатает, что проверено, и возвращает false, если хоть одна проверка не прошла.
+Запускаются через tracker_common --test и в ctest*/
+bool testRingBuffer();
+bool testThreadPool();
+bool testSlotMap();
+bool testEventWriter();
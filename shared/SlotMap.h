@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*Ссылка на элемент SlotMap. Номер ячейки не меняется, пока элемент жив, а поколение
+отличает его от элементов, которые раньше занимали ту же ячейку, поэтому ссылка на
+удаленный элемент просто перестает находить его*/
+struct SlotHandle
+{
+	static constexpr uint32_t INVALID = UINT32_MAX;
+
+	uint32_t m_slot = INVALID;
+	uint32_t m_generation = 0;
+
+	bool valid() const { return m_slot != INVALID; };
+	bool operator==(const SlotHandle& other) const
+	{
+		return m_slot == other.m_slot && m_generation == other.m_generation;
+	};
+	bool operator!=(const SlotHandle& other) const { return !(*this == other); };
+};
+
+/*Хранилище с устойчивыми ссылками. Сами элементы лежат подряд в одном массиве без дыр,
+поэтому обход всех живых элементов - последовательный проход по памяти. Удаление
+переносит последний элемент на место удаленного, ячейка удаленного уходит в список
+свободных и достается следующему вставленному элементу. Память определяется наибольшим
+количеством одновременно живых элементов, а не количеством вставленных за все время.
+Указатели и индексы элементов меняются при вставке и удалении, постоянны только SlotHandle*/
+template <class T>
+class SlotMap
+{
+public:
+	SlotHandle insert(T value)
+	{
+		uint32_t slot;
+		if (!m_free.empty())
+		{
+			slot = m_free.back();
+			m_free.pop_back();
+		}
+		else
+		{
+			slot = uint32_t(m_slots.size());
+			m_slots.push_back({ 0, 0 });
+		}
+
+		m_slots[slot].m_position = uint32_t(m_values.size());
+		m_values.push_back(std::move(value));
+		m_slotOf.push_back(slot);
+		return { slot, m_slots[slot].m_generation };
+	};
+
+	/*false, если элемента уже нет*/
+	bool erase(const SlotHandle handle)
+	{
+		if (!contains(handle))
+			return false;
+		eraseAt(m_slots[handle.m_slot].m_position);
+		return true;
+	};
+
+	/*Удаляет элемент с индексом position. На его место переносится последний элемент,
+	поэтому при обходе с удалением индекс после удаления увеличивать не нужно*/
+	void eraseAt(const size_t position)
+	{
+		const uint32_t slot = m_slotOf[position];
+		const size_t last = m_values.size() - 1;
+		if (position != last)
+		{
+			m_values[position] = std::move(m_values[last]);
+			m_slotOf[position] = m_slotOf[last];
+			m_slots[m_slotOf[position]].m_position = uint32_t(position);
+		}
+		m_values.pop_back();
+		m_slotOf.pop_back();
+
+		++m_slots[slot].m_generation;
+		m_free.push_back(slot);
+	};
+
+	bool contains(const SlotHandle handle) const
+	{
+		return handle.m_slot < m_slots.size() && m_slots[handle.m_slot].m_generation == handle.m_generation &&
+			m_slots[handle.m_slot].m_position < m_values.size() && m_slotOf[m_slots[handle.m_slot].m_position] == handle.m_slot;
+	};
+
+	/*nullptr, если элемента уже нет. Указатель действителен до следующей вставки или удаления*/
+	T* get(const SlotHandle handle) { return contains(handle) ? &m_values[m_slots[handle.m_slot].m_position] : nullptr; };
+	const T* get(const SlotHandle handle) const
+	{
+		return contains(handle) ? &m_values[m_slots[handle.m_slot].m_position] : nullptr;
+	};
+
+	/*Ссылка на живой элемент в ячейке slot, если там никого нет - недействительная ссылка*/
+	SlotHandle handleOfSlot(const uint32_t slot) const
+	{
+		SlotHandle handle{ slot, slot < m_slots.size() ? m_slots[slot].m_generation : 0 };
+		return contains(handle) ? handle : SlotHandle();
+	};
+
+	SlotHandle handleAt(const size_t position) const
+	{
+		return { m_slotOf[position], m_slots[m_slotOf[position]].m_generation };
+	};
+
+	T& operator[](const size_t position) { return m_values[position]; };
+	const T& operator[](const size_t position) const { return m_values[position]; };
+
+	size_t size() const { return m_values.size(); };
+	bool empty() const { return m_values.empty(); };
+
+	/*Сколько ячеек выделено, т.е. наибольшее количество одновременно живых элементов*/
+	size_t slots() const { return m_slots.size(); };
+
+	typename std::vector<T>::iterator begin() { return m_values.begin(); };
+	typename std::vector<T>::iterator end() { return m_values.end(); };
+	typename std::vector<T>::const_iterator begin() const { return m_values.begin(); };
+	typename std::vector<T>::const_iterator end() const { return m_values.end(); };
+
+private:
+	struct Slot
+	{
+		uint32_t m_position;
+		uint32_t m_generation;
+	};
+
+	std::vector<T> m_values;
+	//Ячейка каждого элемента m_values
+	std::vector<uint32_t> m_slotOf;
+	std::vector<Slot> m_slots;
+	std::vector<uint32_t> m_free;
+};
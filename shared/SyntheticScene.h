@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+/*Как движутся объекты синтетической сцены*/
+enum class SceneMotion
+{
+	/*По окружностям радиусом 30 в клетках сетки 10x5, поэтому объекты не
+	пересекаются и не стоят на месте. Не больше 50 объектов*/
+	Orbit,
+
+	/*С постоянной скоростью, отражаясь от краев кадра. Объекты пересекаются
+	и заслоняют друг друга, на этом проверяется смена id*/
+	Bounce
+};
+
+struct SceneOptions
+{
+	cv::Size m_size = cv::Size(1280, 720);
+	int m_objects = 10;
+	SceneMotion m_motion = SceneMotion::Bounce;
+
+	/*От seed зависят фон, цвета, размеры и скорости объектов*/
+	uint64_t m_seed = 1;
+};
+
+/*Видео с цветными прямоугольниками на шумном фоне и истинными боксами каждого объекта.
+Положение объекта - явная функция номера кадра, поэтому кадры можно получать в любом
+порядке, а одинаковые настройки всегда дают одинаковое видео. Истинные боксы
+хранятся в том же виде, что и треки, см. MyTracker::visibleTracks*/
+class SyntheticScene
+{
+public:
+	using Boxes = std::vector<std::pair<int, cv::Rect>>;
+
+	explicit SyntheticScene(const SceneOptions& options) : m_options(options)
+	{
+		cv::RNG rng(options.m_seed);
+		m_background.create(options.m_size, CV_8UC3);
+		rng.fill(m_background, cv::RNG::UNIFORM, cv::Scalar::all(80), cv::Scalar::all(120));
+
+		for (int i = 0; i < options.m_objects; ++i)
+		{
+			Object object;
+			object.m_color = cv::Scalar(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+			if (options.m_motion == SceneMotion::Orbit)
+				object.m_size = cv::Size(40, 80);
+			else
+			{
+				const int width = rng.uniform(30, 61);
+				object.m_size = cv::Size(width, width * 2);
+				object.m_start = cv::Point2d(rng.uniform(0., double(options.m_size.width - width)),
+					rng.uniform(0., double(options.m_size.height - width * 2)));
+				object.m_velocity = cv::Point2d(rng.uniform(2., 6.) * (rng.uniform(0, 2) ? 1 : -1),
+					rng.uniform(1., 4.) * (rng.uniform(0, 2) ? 1 : -1));
+			}
+			m_objects.push_back(object);
+		}
+	};
+
+	const SceneOptions& options() const { return m_options; };
+
+	/*Кадр index и, если передан truth, истинные боксы объектов на нем.
+	Объекты с большим id рисуются поверх остальных*/
+	void render(const int index, cv::Mat& frame, Boxes* truth = nullptr) const
+	{
+		m_background.copyTo(frame);
+		if (truth != nullptr)
+			truth->clear();
+		for (size_t i = 0; i < m_objects.size(); ++i)
+		{
+			const cv::Rect box = objectBox(i, index);
+			cv::rectangle(frame, box, m_objects[i].m_color, cv::FILLED);
+			if (truth != nullptr)
+				truth->emplace_back(int(i), box);
+		}
+	};
+
+	/*Истинные боксы объектов на кадре index без рисования самого кадра*/
+	void boxes(const int index, Boxes& truth) const
+	{
+		truth.clear();
+		for (size_t i = 0; i < m_objects.size(); ++i)
+			truth.emplace_back(int(i), objectBox(i, index));
+	};
+
+	/*Пишет frames кадров в видео path (MJPG, 30 кадров в секунду) и истинные боксы
+	в truthPath(path) строками frame,id,x,y,width,height*/
+	bool write(const std::string& path, const int frames) const
+	{
+		cv::VideoWriter video(path, cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), 30, m_options.m_size);
+		std::ofstream file(truthPath(path));
+		if (!video.isOpened() || !file.is_open())
+			return false;
+
+		cv::Mat frame;
+		Boxes truth;
+		for (int index = 0; index < frames; ++index)
+		{
+			render(index, frame, &truth);
+			video.write(frame);
+			for (auto& object : truth)
+			{
+				const cv::Rect& box = object.second;
+				file << index << ',' << object.first << ',' << box.x << ',' << box.y << ',' << box.width << ','
+					<< box.height << '\n';
+			}
+		}
+		return true;
+	};
+
+	/*Файл истинных боксов для видео: то же имя с расширением .csv*/
+	static std::string truthPath(const std::string& videoPath)
+	{
+		const size_t dot = videoPath.find_last_of('.');
+		const size_t slash = videoPath.find_last_of("/\\");
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+			return videoPath + ".csv";
+		return videoPath.substr(0, dot) + ".csv";
+	};
+
+	/*Читает истинные боксы, записанные write, по кадрам. false, если файла нет*/
+	static bool readTruth(const std::string& path, std::vector<Boxes>& truth)
+	{
+		std::ifstream file(path);
+		if (!file.is_open())
+			return false;
+
+		truth.clear();
+		std::string line;
+		while (std::getline(file, line))
+		{
+			std::stringstream fields(line);
+			int values[6];
+			char comma;
+			fields >> values[0];
+			for (int i = 1; i < 6; ++i)
+				fields >> comma >> values[i];
+			if (!fields || values[0] < 0)
+				continue;
+			if (truth.size() <= size_t(values[0]))
+				truth.resize(values[0] + 1);
+			truth[values[0]].emplace_back(values[1], cv::Rect(values[2], values[3], values[4], values[5]));
+		}
+		return true;
+	};
+
+private:
+	struct Object
+	{
+		cv::Size m_size;
+		cv::Scalar m_color;
+		cv::Point2d m_start;
+		cv::Point2d m_velocity;
+	};
+
+	/*Координата, отраженная от краев отрезка [0, range]*/
+	static int reflect(const double position, const int range)
+	{
+		if (range <= 0)
+			return 0;
+		const double period = 2.0 * range;
+		double folded = std::fmod(position, period);
+		if (folded < 0)
+			folded += period;
+		return int(folded > range ? period - folded : folded);
+	};
+
+	cv::Rect objectBox(const size_t i, const int index) const
+	{
+		const Object& object = m_objects[i];
+		if (m_options.m_motion == SceneMotion::Bounce)
+		{
+			return cv::Rect(reflect(object.m_start.x + object.m_velocity.x * index, m_options.m_size.width - object.m_size.width),
+				reflect(object.m_start.y + object.m_velocity.y * index, m_options.m_size.height - object.m_size.height),
+				object.m_size.width, object.m_size.height);
+		}
+
+		constexpr int GRID_COLS = 10, GRID_ROWS = 5;
+		const int cellWidth = m_options.m_size.width / GRID_COLS, cellHeight = m_options.m_size.height / GRID_ROWS;
+		const double angle = 0.15 * index + double(i);
+		const cv::Point center(int(i % GRID_COLS) * cellWidth + cellWidth / 2 + int(30 * std::cos(angle)),
+			int(i / GRID_COLS % GRID_ROWS) * cellHeight + cellHeight / 2 + int(30 * std::sin(angle)));
+		return cv::Rect(center.x - object.m_size.width / 2, center.y - object.m_size.height / 2, object.m_size.width,
+			object.m_size.height);
+	};
+
+	SceneOptions m_options;
+	cv::Mat m_background;
+	std::vector<Object> m_objects;
+};
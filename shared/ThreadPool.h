@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*Пул потоков для параллельных циклов. Один пул можно делить между несколькими
+вызывающими потоками, например между камерами: их циклы стоят в общей очереди,
+а каждый вызывающий поток сам выполняет итерации своего цикла вместе с пулом,
+поэтому цикл не ждет, пока освободятся потоки, занятые чужими циклами*/
+class ThreadPool
+{
+public:
+	/*threads = 0 - по числу ядер*/
+	explicit ThreadPool(size_t threads = 0)
+	{
+		if (threads == 0)
+			threads = std::max(std::thread::hardware_concurrency(), 1u);
+		for (size_t i = 0; i < threads; ++i)
+			m_workers.emplace_back(&ThreadPool::run, this);
+	};
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for (auto& worker : m_workers)
+			worker.join();
+	};
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	size_t size() const { return m_workers.size(); };
+
+	/*Вызывает body(i) для всех i из [0, count) и возвращается, когда все вызовы закончились.
+	Порядок и распределение итераций по потокам не определены*/
+	void parallelFor(const size_t count, const std::function<void(size_t)>& body)
+	{
+		if (count == 0)
+			return;
+		if (count == 1)
+		{
+			body(0);
+			return;
+		}
+
+		/*Задания вызывающего потока переиспользуются, поэтому цикл не выделяет память.
+		Заданий несколько на случай вложенных циклов*/
+		thread_local std::vector<std::unique_ptr<Job>> spare;
+		std::unique_ptr<Job> job = spare.empty() ? std::make_unique<Job>() : std::move(spare.back());
+		if (!spare.empty())
+			spare.pop_back();
+		job->m_body = &body;
+		job->m_count = count;
+		job->m_next = 0;
+		job->m_done = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_jobs.push_back(job.get());
+		}
+		m_wake.notify_all();
+
+		execute(*job);
+
+		/*Задание можно отдать следующему циклу, только когда его убрали из очереди и
+		из него вышли все потоки пула*/
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_finished.wait(lock, [&] { return job->m_done.load() == count; });
+			auto found = std::find(m_jobs.begin(), m_jobs.end(), job.get());
+			if (found != m_jobs.end())
+				m_jobs.erase(found);
+			m_finished.wait(lock, [&] { return job->m_users == 0; });
+		}
+		spare.push_back(std::move(job));
+	};
+
+private:
+	struct Job
+	{
+		const std::function<void(size_t)>* m_body = nullptr;
+		size_t m_count = 0;
+		std::atomic<size_t> m_next{ 0 };
+		std::atomic<size_t> m_done{ 0 };
+		//Сколько потоков пула выполняют задание, под m_mutex
+		int m_users = 0;
+	};
+
+	/*Выполняет итерации, пока они не кончатся. Тело вызывается только для выданных
+	итераций, поэтому после конца цикла задание можно держать, но не вызывать*/
+	void execute(Job& job)
+	{
+		for (size_t i = job.m_next++; i < job.m_count; i = job.m_next++)
+		{
+			(*job.m_body)(i);
+			if (job.m_done.fetch_add(1) + 1 == job.m_count)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_finished.notify_all();
+			}
+		}
+	};
+
+	void run()
+	{
+		for (;;)
+		{
+			Job* job;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [&] { return m_stop || !m_jobs.empty(); });
+				if (m_stop)
+					return;
+				job = m_jobs.front();
+				++job->m_users;
+			}
+
+			execute(*job);
+
+			/*Итерации кончились, убираем задание из очереди, если его еще не убрал
+			вызывающий поток или другой поток пула*/
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_jobs.empty() && m_jobs.front() == job)
+				m_jobs.erase(m_jobs.begin());
+			if (--job->m_users == 0)
+				m_finished.notify_all();
+		}
+	};
+
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_finished;
+	//Очередь заданий. Вектор, а не deque, чтобы в установившемся режиме не выделять память
+	std::vector<Job*> m_jobs;
+	bool m_stop = false;
+};
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "RingBuffer.h"
+
+/*Что случилось с треком*/
+enum class TrackEventType : uint8_t
+{
+	/*Новый трек*/
+	Start,
+	/*Новые координаты трека в кадре*/
+	Update,
+	/*Трек пропал из кадра, но его еще можно найти снова*/
+	Lost,
+	/*Пропавший трек найден снова, в том числе другой камерой*/
+	Reidentified,
+	/*Трек пропал окончательно*/
+	Expired
+};
+
+inline const char* eventName(const TrackEventType type)
+{
+	switch (type)
+	{
+	case TrackEventType::Start: return "start";
+	case TrackEventType::Update: return "update";
+	case TrackEventType::Lost: return "lost";
+	case TrackEventType::Reidentified: return "reidentified";
+	case TrackEventType::Expired: return "expired";
+	}
+	return "unknown";
+}
+
+/*Событие трека. Трекер заполняет тип, id, камеру и бокс, номер кадра и время
+проставляет конвейер, см. stampEvents*/
+struct TrackEvent
+{
+	TrackEventType m_type = TrackEventType::Update;
+	int m_camera = 0;
+	int m_id = 0;
+	cv::Rect m_box;
+	uint64_t m_frame = 0;
+
+	/*Микросекунды с начала эпохи по системным часам*/
+	int64_t m_timestamp = 0;
+};
+
+inline void stampEvents(std::vector<TrackEvent>& events, const size_t frame)
+{
+	const int64_t timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	for (auto& event : events)
+	{
+		event.m_frame = frame;
+		event.m_timestamp = timestamp;
+	}
+}
+
+/*Формат файла событий*/
+enum class EventFormat
+{
+	/*Строка JSON на событие:
+	{"time":...,"frame":...,"camera":...,"id":...,"event":"update","box":[x,y,width,height]}*/
+	Lines,
+
+	/*Записи BinaryTrackEvent по 32 байта подряд, в порядке байтов процессора*/
+	Binary
+};
+
+struct BinaryTrackEvent
+{
+	int64_t m_timestamp;
+	uint32_t m_frame;
+	int32_t m_id;
+	int16_t m_x;
+	int16_t m_y;
+	int16_t m_width;
+	int16_t m_height;
+	uint16_t m_camera;
+	uint8_t m_type;
+	uint8_t m_reserved;
+	uint32_t m_reserved2;
+};
+static_assert(sizeof(BinaryTrackEvent) == 32, "BinaryTrackEvent must stay 32 bytes");
+
+/*Асинхронная запись событий в файл. Поток трекинга только копирует события в пачку
+и кладет ее в lock-free очередь, форматирование и запись выполняет отдельный поток.
+Если писатель не успевает и очередь заполнена, пачка выбрасывается и учитывается в
+dropped: трекинг никогда не ждет диск. Пачки возвращаются обратно через вторую
+очередь, поэтому в установившемся режиме память не выделяется. Писать могут
+несколько камер одновременно*/
+class EventWriter
+{
+public:
+	EventWriter(const std::string& path, const EventFormat format, const size_t queueSize = 1024) :
+		m_format(format),
+		m_queue(queueSize, QueuePolicy::Block),
+		m_free(queueSize, QueuePolicy::Block),
+		m_file(path, format == EventFormat::Binary ? std::ios::binary : std::ios::out)
+	{
+		m_thread = std::thread(&EventWriter::run, this);
+	};
+
+	~EventWriter() { close(); };
+
+	EventWriter(const EventWriter&) = delete;
+	EventWriter& operator=(const EventWriter&) = delete;
+
+	bool isOpen() const { return m_file.is_open(); };
+
+	/*Не блокирует*/
+	void write(const std::vector<TrackEvent>& events)
+	{
+		if (events.empty() || m_queue.closed())
+			return;
+
+		std::vector<TrackEvent> batch;
+		m_free.tryPop(batch);
+		batch.assign(events.begin(), events.end());
+		if (!m_queue.tryPush(batch))
+			m_dropped.fetch_add(events.size(), std::memory_order_relaxed);
+	};
+
+	/*Дописывает все, что уже в очереди, и останавливает поток записи. После этого
+	write ничего не пишет, а счетчики окончательные*/
+	void close()
+	{
+		m_queue.close();
+		if (m_thread.joinable())
+			m_thread.join();
+	};
+
+	size_t written() const { return m_written.load(); };
+	size_t dropped() const { return m_dropped.load(); };
+	size_t bytes() const { return m_bytes.load(); };
+
+private:
+	/*Файл пишется кусками не меньше FLUSH_BYTES, но не реже раза в секунду. Новые пачки
+	ждем не дольше FLUSH_CHECK, поэтому и без событий буфер сбрасывается вовремя*/
+	static constexpr size_t FLUSH_BYTES = 64 * 1024;
+	static constexpr std::chrono::milliseconds FLUSH_CHECK{ 100 };
+
+	void run()
+	{
+		std::vector<TrackEvent> batch;
+		auto consume = [&]
+		{
+			for (auto& event : batch)
+				format(event);
+			m_written.fetch_add(batch.size());
+			batch.clear();
+			m_free.tryPush(batch);
+		};
+
+		auto lastFlush = std::chrono::steady_clock::now();
+		for (;;)
+		{
+			if (m_queue.popFor(batch, FLUSH_CHECK))
+				consume();
+			else if (m_queue.closed())
+			{
+				//Дописываем то, что успели положить до закрытия
+				while (m_queue.tryPop(batch))
+					consume();
+				break;
+			}
+
+			auto now = std::chrono::steady_clock::now();
+			if (m_buffer.size() >= FLUSH_BYTES || (!m_buffer.empty() && now - lastFlush > std::chrono::seconds(1)))
+			{
+				flush();
+				lastFlush = now;
+			}
+		}
+		flush();
+	};
+
+	void format(const TrackEvent& event)
+	{
+		if (m_format == EventFormat::Binary)
+		{
+			auto narrow = [](const int value) { return int16_t(std::min(std::max(value, INT16_MIN), INT16_MAX)); };
+			BinaryTrackEvent record{};
+			record.m_timestamp = event.m_timestamp;
+			record.m_frame = uint32_t(event.m_frame);
+			record.m_id = event.m_id;
+			record.m_x = narrow(event.m_box.x);
+			record.m_y = narrow(event.m_box.y);
+			record.m_width = narrow(event.m_box.width);
+			record.m_height = narrow(event.m_box.height);
+			record.m_camera = uint16_t(event.m_camera);
+			record.m_type = uint8_t(event.m_type);
+			m_buffer.append(reinterpret_cast<const char*>(&record), sizeof(record));
+			return;
+		}
+
+		/*Числа переводятся в текст через to_chars: без локали и разбора формата это в
+		несколько раз быстрее snprintf*/
+		auto number = [this](const auto value)
+		{
+			char digits[24];
+			m_buffer.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr);
+		};
+
+		m_buffer += "{\"time\":";
+		number(event.m_timestamp);
+		m_buffer += ",\"frame\":";
+		number(event.m_frame);
+		m_buffer += ",\"camera\":";
+		number(event.m_camera);
+		m_buffer += ",\"id\":";
+		number(event.m_id);
+		m_buffer += ",\"event\":\"";
+		m_buffer += eventName(event.m_type);
+		m_buffer += "\",\"box\":[";
+		number(event.m_box.x);
+		m_buffer += ',';
+		number(event.m_box.y);
+		m_buffer += ',';
+		number(event.m_box.width);
+		m_buffer += ',';
+		number(event.m_box.height);
+		m_buffer += "]}\n";
+	};
+
+	void flush()
+	{
+		if (m_buffer.empty())
+			return;
+		m_file.write(m_buffer.data(), std::streamsize(m_buffer.size()));
+		m_file.flush();
+		m_bytes.fetch_add(m_buffer.size());
+		m_buffer.clear();
+	};
+
+	EventFormat m_format;
+	RingBuffer<std::vector<TrackEvent>> m_queue;
+	RingBuffer<std::vector<TrackEvent>> m_free;
+	std::ofstream m_file;
+	std::string m_buffer;
+	std::thread m_thread;
+
+	std::atomic<size_t> m_written{ 0 };
+	std::atomic<size_t> m_dropped{ 0 };
+	std::atomic<size_t> m_bytes{ 0 };
+};
+
+/*Треки одной камеры, собранные из потока событий: трек виден от start, update
+или reidentified до lost или expired. Так отрисовка становится одним из потребителей
+того же потока, что и файл событий*/
+class TrackView
+{
+public:
+	void apply(const std::vector<TrackEvent>& events)
+	{
+		for (auto& event : events)
+		{
+			auto found = std::find_if(m_tracks.begin(), m_tracks.end(),
+				[&](const std::pair<int, cv::Rect>& track) { return track.first == event.m_id; });
+
+			if (event.m_type == TrackEventType::Lost || event.m_type == TrackEventType::Expired)
+			{
+				if (found != m_tracks.end())
+				{
+					*found = m_tracks.back();
+					m_tracks.pop_back();
+				}
+			}
+			else if (found != m_tracks.end())
+				found->second = event.m_box;
+			else
+				m_tracks.emplace_back(event.m_id, event.m_box);
+		}
+	};
+
+	/*id и координаты видимых треков*/
+	const std::vector<std::pair<int, cv::Rect>>& tracks() const { return m_tracks; };
+
+private:
+	std::vector<std::pair<int, cv::Rect>> m_tracks;
+};
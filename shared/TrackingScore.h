@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+/*Точность трекинга по метрикам CLEAR MOT (Bernardin, Stiefelhagen, 2008)*/
+struct TrackingScore
+{
+	/*Истинных боксов на всех кадрах*/
+	size_t m_truth = 0;
+	size_t m_matches = 0;
+	size_t m_misses = 0;
+	size_t m_falsePositives = 0;
+
+	/*Истинный объект сопоставился с другим треком, чем в прошлый раз*/
+	size_t m_idSwitches = 0;
+
+	/*Сумма IoU сопоставленных пар*/
+	double m_iou = 0;
+
+	/*1 - (пропуски + ложные треки + смены id) / истинные боксы. Может быть отрицательной*/
+	double mota() const
+	{
+		return m_truth > 0 ? 1.0 - double(m_misses + m_falsePositives + m_idSwitches) / m_truth : 1.0;
+	};
+
+	/*Средний IoU сопоставленных пар*/
+	double motp() const { return m_matches > 0 ? m_iou / m_matches : 0; };
+};
+
+/*Сопоставляет треки каждого кадра с истинными боксами. Пара, сопоставленная на прошлом
+кадре, сохраняется, пока IoU не ниже порога; остальные пары выбираются жадно по
+убыванию IoU. Боксы в том же виде, что и у MyTracker::visibleTracks*/
+class TrackingEvaluator
+{
+public:
+	using Boxes = std::vector<std::pair<int, cv::Rect>>;
+
+	explicit TrackingEvaluator(const double minIou = 0.5) : m_minIou(minIou) {};
+
+	void add(const Boxes& truth, const Boxes& tracks)
+	{
+		m_truthMatched.assign(truth.size(), 0);
+		m_trackMatched.assign(tracks.size(), 0);
+		m_score.m_truth += truth.size();
+
+		/*Продолжаем сопоставления прошлого кадра*/
+		for (size_t i = 0; i < truth.size(); ++i)
+		{
+			auto last = m_last.find(truth[i].first);
+			if (last == m_last.end())
+				continue;
+			for (size_t j = 0; j < tracks.size(); ++j)
+			{
+				if (tracks[j].first != last->second || m_trackMatched[j])
+					continue;
+				const double overlap = iou(truth[i].second, tracks[j].second);
+				if (overlap >= m_minIou)
+					match(i, j, overlap);
+				break;
+			}
+		}
+
+		m_pairs.clear();
+		for (size_t i = 0; i < truth.size(); ++i)
+		{
+			for (size_t j = 0; j < tracks.size() && !m_truthMatched[i]; ++j)
+			{
+				if (m_trackMatched[j])
+					continue;
+				const double overlap = iou(truth[i].second, tracks[j].second);
+				if (overlap >= m_minIou)
+					m_pairs.push_back({ overlap, i, j });
+			}
+		}
+		std::sort(m_pairs.begin(), m_pairs.end(), [](const Pair& a, const Pair& b) { return a.m_iou > b.m_iou; });
+		for (auto& pair : m_pairs)
+		{
+			if (m_truthMatched[pair.m_truth] || m_trackMatched[pair.m_track])
+				continue;
+			auto last = m_last.find(truth[pair.m_truth].first);
+			if (last != m_last.end() && last->second != tracks[pair.m_track].first)
+				++m_score.m_idSwitches;
+			m_last[truth[pair.m_truth].first] = tracks[pair.m_track].first;
+			match(pair.m_truth, pair.m_track, pair.m_iou);
+		}
+
+		m_score.m_misses += size_t(std::count(m_truthMatched.begin(), m_truthMatched.end(), 0));
+		m_score.m_falsePositives += size_t(std::count(m_trackMatched.begin(), m_trackMatched.end(), 0));
+	};
+
+	const TrackingScore& score() const { return m_score; };
+
+private:
+	struct Pair
+	{
+		double m_iou;
+		size_t m_truth;
+		size_t m_track;
+	};
+
+	static double iou(const cv::Rect& a, const cv::Rect& b)
+	{
+		const double intersection = (a & b).area();
+		const double total = a.area() + b.area() - intersection;
+		return total > 0 ? intersection / total : 0;
+	};
+
+	void match(const size_t truth, const size_t track, const double overlap)
+	{
+		m_truthMatched[truth] = 1;
+		m_trackMatched[track] = 1;
+		++m_score.m_matches;
+		m_score.m_iou += overlap;
+	};
+
+	double m_minIou;
+	TrackingScore m_score;
+
+	/*id трека, с которым истинный объект сопоставлялся последний раз*/
+	std::unordered_map<int, int> m_last;
+
+	std::vector<char> m_truthMatched;
+	std::vector<char> m_trackMatched;
+	std::vector<Pair> m_pairs;
+};
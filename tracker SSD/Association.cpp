@@ -0,0 +1,489 @@
+#include "Association.h"
+#include "Nms.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+
+namespace
+{
+	/*Стоимость пары без пересечения, она же стоимость того, что трек остался без выхода*/
+	constexpr float NO_MATCH_COST = 100.f;
+
+	/*Сколько клеток сетки допускается на один выход*/
+	constexpr int CELLS_PER_DETECTION = 4;
+
+	/*Быстрая проверка перед IoU: у большинства кандидатов из соседних клеток пересечения нет*/
+	inline bool intersects(const cv::Rect& box1, const cv::Rect& box2)
+	{
+		return box1.x < box2.x + box2.width && box2.x < box1.x + box1.width &&
+			box1.y < box2.y + box2.height && box2.y < box1.y + box1.height;
+	}
+
+	/*Прежнее сопоставление из MyTracker::updateTracks: каждый трек берет первый выход
+	с IoU больше 20, даже если его уже взял другой трек. Затем searchNew*/
+	void legacyAssign(const std::vector<cv::Rect>& tracks, const std::vector<cv::Rect>& detections,
+		std::vector<int>& matches, std::vector<int>& newDetections)
+	{
+		matches.assign(tracks.size(), -1);
+		for (size_t t = 0; t < tracks.size(); ++t)
+		{
+			for (size_t d = 0; d < detections.size(); ++d)
+			{
+				if (percentIou(detections[d], tracks[t]) > 20)
+				{
+					matches[t] = int(d);
+					break;
+				}
+			}
+		}
+
+		newDetections.clear();
+		for (size_t d = 0; d < detections.size(); ++d)
+		{
+			bool flag = false;
+			for (auto& track : tracks)
+			{
+				if (percentIou(detections[d], track) > 0)
+				{
+					flag = true;
+					break;
+				}
+			}
+			if (!flag)
+				newDetections.push_back(int(d));
+		}
+	}
+
+	/*Наибольшая сумма IoU перебором всех сопоставлений треков с t-го и свободных выходов.
+	iou - матрица tracks x detections, пары с IoU не больше порога в нее не попадают (0)*/
+	double bruteForceIou(const std::vector<std::vector<double>>& iou, const size_t t, std::vector<char>& used)
+	{
+		if (t == iou.size())
+			return 0;
+		double best = bruteForceIou(iou, t + 1, used);
+		for (size_t d = 0; d < used.size(); ++d)
+		{
+			if (used[d] || iou[t][d] == 0)
+				continue;
+			used[d] = 1;
+			best = std::max(best, iou[t][d] + bruteForceIou(iou, t + 1, used));
+			used[d] = 0;
+		}
+		return best;
+	}
+
+	/*Сравнивает assign с перебором на маленьких случайных сценах: треков и выходов
+	от 0 до 7 независимо, поэтому матрицы бывают и вытянутыми в обе стороны, и пустыми.
+	Боксы лежат в двух-трех скоплениях, так что групп несколько, а часть пар пересекается
+	с IoU не больше порога и ребра не получает. Возвращает количество несовпадений*/
+	int checkAgainstBruteForce(const int cases)
+	{
+		std::mt19937 random(11);
+		std::uniform_int_distribution<int> count(0, 7), cluster(0, 2), offset(0, 60), size(30, 70);
+		TrackAssociation association;
+		int mismatches = 0;
+		for (int c = 0; c < cases; ++c)
+		{
+			auto randomBoxes = [&](std::vector<cv::Rect>& boxes) {
+				boxes.resize(count(random));
+				for (auto& box : boxes)
+					box = cv::Rect(cluster(random) * 1000 + offset(random), offset(random), size(random), size(random));
+			};
+			std::vector<cv::Rect> tracks, detections;
+			randomBoxes(tracks);
+			randomBoxes(detections);
+
+			std::vector<std::vector<double>> iou(tracks.size(), std::vector<double>(detections.size(), 0));
+			for (size_t t = 0; t < tracks.size(); ++t)
+				for (size_t d = 0; d < detections.size(); ++d)
+					if (percentIou(tracks[t], detections[d]) > 20)
+						iou[t][d] = percentIou(tracks[t], detections[d]);
+			std::vector<char> used(detections.size(), 0);
+			const double best = bruteForceIou(iou, 0, used);
+
+			association.assign(tracks, detections);
+			const std::vector<int>& trackMatches = association.trackMatches();
+			const std::vector<int>& detectionMatches = association.detectionMatches();
+			bool valid = trackMatches.size() == tracks.size() && detectionMatches.size() == detections.size();
+			double sum = 0;
+			for (size_t t = 0; valid && t < tracks.size(); ++t)
+			{
+				const int d = trackMatches[t];
+				if (d < 0)
+					continue;
+				valid = d < int(detections.size()) && detectionMatches[d] == int(t) && iou[t][d] > 0;
+				if (valid)
+					sum += iou[t][d];
+			}
+			for (size_t d = 0; valid && d < detections.size(); ++d)
+				valid = detectionMatches[d] < 0 || trackMatches[detectionMatches[d]] == int(d);
+
+			//Стоимости хранятся во float, поэтому суммы сравниваются с допуском
+			if (!valid || std::abs(sum - best) > 1e-3)
+			{
+				if (mismatches == 0)
+					std::cout << "case " << c << ": " << tracks.size() << " tracks, " << detections.size()
+						<< " detections, IoU sum " << sum << " instead of " << best
+						<< (valid ? "" : ", inconsistent matches") << std::endl;
+				++mismatches;
+			}
+		}
+		return mismatches;
+	}
+}
+
+void TrackAssociation::assign(const std::vector<cv::Rect>& tracks, const std::vector<cv::Rect>& detections)
+{
+	const int trackCount = int(tracks.size());
+	const int detectionCount = int(detections.size());
+	m_detections = &detections;
+	m_trackMatches.assign(trackCount, -1);
+	m_detectionMatches.assign(detectionCount, -1);
+	m_overlaps.assign(detectionCount, 0);
+
+	buildGrid(detections);
+	m_stamps.assign(detectionCount, -1);
+	m_edges.clear();
+	m_parents.resize(trackCount + detectionCount);
+	std::iota(m_parents.begin(), m_parents.end(), 0);
+
+	/*Пары с IoU больше порога, каждая объединяет группы трека и выхода*/
+	for (int t = 0; t < trackCount; ++t)
+	{
+		visitCandidates(tracks[t], t, [&](const int d) {
+			if (!intersects(tracks[t], detections[d]))
+				return;
+			double iou = percentIou(tracks[t], detections[d]);
+			if (iou <= m_minIou)
+				return;
+			m_edges.push_back({ t, d, float(NO_MATCH_COST - iou), 0 });
+			int group1 = findGroup(t), group2 = findGroup(trackCount + d);
+			if (group1 != group2)
+				m_parents[group1] = group2;
+		});
+	}
+	if (m_edges.empty())
+		return;
+
+	for (auto& edge : m_edges)
+		edge.m_group = findGroup(edge.m_track);
+	std::sort(m_edges.begin(), m_edges.end(), [](const Edge& edge1, const Edge& edge2) {
+		return edge1.m_group < edge2.m_group || (edge1.m_group == edge2.m_group &&
+			(edge1.m_track < edge2.m_track || (edge1.m_track == edge2.m_track && edge1.m_detection < edge2.m_detection)));
+	});
+
+	m_localIndex.assign(trackCount + detectionCount, -1);
+	size_t begin = 0;
+	for (size_t i = 1; i <= m_edges.size(); ++i)
+	{
+		if (i == m_edges.size() || m_edges[i].m_group != m_edges[begin].m_group)
+		{
+			solveGroup(begin, i);
+			begin = i;
+		}
+	}
+}
+
+void TrackAssociation::findOverlaps(const std::vector<cv::Rect>& tracks)
+{
+	const std::vector<cv::Rect>& detections = *m_detections;
+	m_overlaps.assign(detections.size(), 0);
+	m_stamps.assign(detections.size(), -1);
+	for (int t = 0; t < int(tracks.size()); ++t)
+	{
+		visitCandidates(tracks[t], t, [&](const int d) {
+			if (!m_overlaps[d] && intersects(tracks[t], detections[d]) && percentIou(tracks[t], detections[d]) > 0)
+				m_overlaps[d] = 1;
+		});
+	}
+}
+
+void TrackAssociation::buildGrid(const std::vector<cv::Rect>& detections)
+{
+	m_gridCols = m_gridRows = 0;
+	if (detections.empty())
+		return;
+
+	/*Клетка размером со средний бокс, тогда бокс попадает в 1-4 клетки*/
+	int left = detections[0].x, top = detections[0].y, right = left, bottom = top;
+	double size = 0;
+	for (auto& box : detections)
+	{
+		left = std::min(left, box.x);
+		top = std::min(top, box.y);
+		right = std::max(right, box.x + box.width);
+		bottom = std::max(bottom, box.y + box.height);
+		size += (box.width + box.height) / 2.;
+	}
+	m_gridOrigin = cv::Point(left, top);
+	m_cellSize = std::max(1, int(size / detections.size()));
+
+	const size_t maxCells = CELLS_PER_DETECTION * detections.size() + 16;
+	do
+	{
+		m_gridCols = (right - left) / m_cellSize + 1;
+		m_gridRows = (bottom - top) / m_cellSize + 1;
+		if (size_t(m_gridCols) * m_gridRows <= maxCells)
+			break;
+		m_cellSize *= 2;
+	} while (true);
+
+	/*Раскладка подсчетом: сначала количество выходов в клетках, затем начала клеток*/
+	const int cells = m_gridCols * m_gridRows;
+	m_cellStart.assign(cells + 1, 0);
+	for (auto& box : detections)
+	{
+		int col1, row1, col2, row2;
+		cellRange(box, col1, row1, col2, row2);
+		for (int row = row1; row <= row2; ++row)
+			for (int col = col1; col <= col2; ++col)
+				++m_cellStart[row * m_gridCols + col];
+	}
+
+	int total = 0;
+	for (int c = 0; c < cells; ++c)
+	{
+		int count = m_cellStart[c];
+		m_cellStart[c] = total;
+		total += count;
+	}
+	m_cellStart[cells] = total;
+	m_cellItems.resize(total);
+
+	//После заполнения m_cellStart[c] указывает на конец клетки c, т.е. на начало c + 1
+	for (int d = 0; d < int(detections.size()); ++d)
+	{
+		int col1, row1, col2, row2;
+		cellRange(detections[d], col1, row1, col2, row2);
+		for (int row = row1; row <= row2; ++row)
+			for (int col = col1; col <= col2; ++col)
+				m_cellItems[m_cellStart[row * m_gridCols + col]++] = d;
+	}
+	for (int c = cells; c > 0; --c)
+		m_cellStart[c] = m_cellStart[c - 1];
+	m_cellStart[0] = 0;
+}
+
+void TrackAssociation::cellRange(const cv::Rect& box, int& col1, int& row1, int& col2, int& row2) const
+{
+	//Боксы за пределами сетки прижимаются к ее краю, лишние кандидаты отсеет IoU
+	col1 = std::min(std::max((box.x - m_gridOrigin.x) / m_cellSize, 0), m_gridCols - 1);
+	row1 = std::min(std::max((box.y - m_gridOrigin.y) / m_cellSize, 0), m_gridRows - 1);
+	col2 = std::min(std::max((box.x + box.width - m_gridOrigin.x) / m_cellSize, 0), m_gridCols - 1);
+	row2 = std::min(std::max((box.y + box.height - m_gridOrigin.y) / m_cellSize, 0), m_gridRows - 1);
+}
+
+template <typename Visit>
+void TrackAssociation::visitCandidates(const cv::Rect& box, const int stamp, Visit visit)
+{
+	if (m_gridCols == 0)
+		return;
+
+	int col1, row1, col2, row2;
+	cellRange(box, col1, row1, col2, row2);
+	for (int row = row1; row <= row2; ++row)
+	{
+		for (int col = col1; col <= col2; ++col)
+		{
+			const int cell = row * m_gridCols + col;
+			for (int k = m_cellStart[cell]; k < m_cellStart[cell + 1]; ++k)
+			{
+				//Бокс в нескольких клетках проверяется один раз
+				const int d = m_cellItems[k];
+				if (m_stamps[d] == stamp)
+					continue;
+				m_stamps[d] = stamp;
+				visit(d);
+			}
+		}
+	}
+}
+
+int TrackAssociation::findGroup(int node)
+{
+	while (m_parents[node] != node)
+	{
+		m_parents[node] = m_parents[m_parents[node]];
+		node = m_parents[node];
+	}
+	return node;
+}
+
+void TrackAssociation::solveGroup(const size_t begin, const size_t end)
+{
+	//Один трек и один выход - самая частая группа, решать нечего
+	if (end - begin == 1)
+	{
+		m_trackMatches[m_edges[begin].m_track] = m_edges[begin].m_detection;
+		m_detectionMatches[m_edges[begin].m_detection] = m_edges[begin].m_track;
+		return;
+	}
+
+	const int trackCount = int(m_trackMatches.size());
+	m_rowNodes.clear();
+	m_colNodes.clear();
+	for (size_t i = begin; i < end; ++i)
+	{
+		const Edge& edge = m_edges[i];
+		if (m_localIndex[edge.m_track] < 0)
+		{
+			m_localIndex[edge.m_track] = int(m_rowNodes.size());
+			m_rowNodes.push_back(edge.m_track);
+		}
+		if (m_localIndex[trackCount + edge.m_detection] < 0)
+		{
+			m_localIndex[trackCount + edge.m_detection] = int(m_colNodes.size());
+			m_colNodes.push_back(edge.m_detection);
+		}
+	}
+
+	/*Венгерский алгоритм ниже требует, чтобы строк было не больше, чем столбцов*/
+	const bool transposed = m_rowNodes.size() > m_colNodes.size();
+	const int rows = int(std::min(m_rowNodes.size(), m_colNodes.size()));
+	const int cols = int(std::max(m_rowNodes.size(), m_colNodes.size()));
+	m_costs.assign(size_t(rows) * cols, NO_MATCH_COST);
+	for (size_t i = begin; i < end; ++i)
+	{
+		const Edge& edge = m_edges[i];
+		int row = m_localIndex[edge.m_track], col = m_localIndex[trackCount + edge.m_detection];
+		if (transposed)
+			std::swap(row, col);
+		m_costs[size_t(row) * cols + col] = edge.m_cost;
+	}
+
+	hungarian(rows, cols);
+
+	for (int col = 1; col <= cols; ++col)
+	{
+		const int row = m_p[col] - 1;
+		if (row < 0 || m_costs[size_t(row) * cols + col - 1] >= NO_MATCH_COST)
+			continue;
+		const int track = transposed ? m_rowNodes[col - 1] : m_rowNodes[row];
+		const int detection = transposed ? m_colNodes[row] : m_colNodes[col - 1];
+		m_trackMatches[track] = detection;
+		m_detectionMatches[detection] = track;
+	}
+}
+
+void TrackAssociation::hungarian(const int rows, const int cols)
+{
+	/*Строки добавляются по одной, для каждой ищется кратчайший увеличивающий путь
+	по приведенным стоимостям. Индексы с 1, столбец 0 - фиктивный.
+	m_p[j] - строка, назначенная столбцу j*/
+	const double infinity = std::numeric_limits<double>::max();
+	m_u.assign(rows + 1, 0);
+	m_v.assign(cols + 1, 0);
+	m_p.assign(cols + 1, 0);
+	m_way.assign(cols + 1, 0);
+
+	for (int i = 1; i <= rows; ++i)
+	{
+		m_p[0] = i;
+		int j0 = 0;
+		m_minv.assign(cols + 1, infinity);
+		m_used.assign(cols + 1, 0);
+		do
+		{
+			m_used[j0] = 1;
+			const int i0 = m_p[j0];
+			const float* costs = &m_costs[size_t(i0 - 1) * cols];
+			double delta = infinity;
+			int j1 = 0;
+			for (int j = 1; j <= cols; ++j)
+			{
+				if (m_used[j])
+					continue;
+				double current = costs[j - 1] - m_u[i0] - m_v[j];
+				if (current < m_minv[j])
+				{
+					m_minv[j] = current;
+					m_way[j] = j0;
+				}
+				if (m_minv[j] < delta)
+				{
+					delta = m_minv[j];
+					j1 = j;
+				}
+			}
+			for (int j = 0; j <= cols; ++j)
+			{
+				if (m_used[j])
+				{
+					m_u[m_p[j]] += delta;
+					m_v[j] -= delta;
+				}
+				else
+					m_minv[j] -= delta;
+			}
+			j0 = j1;
+		} while (m_p[j0] != 0);
+
+		do
+		{
+			const int j1 = m_way[j0];
+			m_p[j0] = m_p[j1];
+			j0 = j1;
+		} while (j0);
+	}
+}
+
+bool benchAssociation()
+{
+	const int cases = 2000;
+	const int mismatches = checkAgainstBruteForce(cases);
+	std::cout << "brute force: " << cases << " cases, " << mismatches << " mismatches" << std::endl;
+
+	/*Синтетическая толпа: люди 40-60x100-140 пикселей, в среднем 8000 пикселей кадра
+	на человека. За кадр каждый сдвигается до 12 пикселей, выходы сети перемешаны*/
+	std::mt19937 random(5);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+
+	std::cout << "objects\tlegacy, us\tlegacy correct\toptimal, us\toptimal correct" << std::endl;
+	for (int objects : { 10, 100, 1000 })
+	{
+		const int height = int(std::sqrt(objects * 8000. * 9 / 16)) + 140, width = height * 16 / 9;
+		std::vector<cv::Rect> tracks, detections(objects);
+		std::vector<int> truth(objects);
+		std::iota(truth.begin(), truth.end(), 0);
+		std::shuffle(truth.begin(), truth.end(), random);
+		for (int i = 0; i < objects; ++i)
+		{
+			cv::Rect box(int(uniform(random) * (width - 60)), int(uniform(random) * (height - 140)),
+				40 + int(uniform(random) * 20), 100 + int(uniform(random) * 40));
+			tracks.push_back(box);
+			detections[truth[i]] = box + cv::Point(int(uniform(random) * 24) - 12, int(uniform(random) * 24) - 12);
+		}
+
+		auto correct = [&](const std::vector<int>& matches) {
+			int count = 0;
+			for (int i = 0; i < objects; ++i)
+				count += matches[i] == truth[i];
+			return 100. * count / objects;
+		};
+
+		const int repeats = std::max(5, 20000 / objects);
+		std::vector<int> legacyMatches, newDetections;
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeats; ++r)
+			legacyAssign(tracks, detections, legacyMatches, newDetections);
+		double legacyTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+		TrackAssociation association;
+		start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeats; ++r)
+		{
+			association.assign(tracks, detections);
+			association.findOverlaps(tracks);
+		}
+		double optimalTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << objects << '\t' << legacyTime / repeats << '\t' << correct(legacyMatches) << "%\t"
+			<< optimalTime / repeats << '\t' << correct(association.trackMatches()) << '%' << std::endl;
+	}
+	return mismatches == 0;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+/*Сопоставление выходов сети с треками. Вместо того чтобы каждый трек брал первый
+выход с IoU больше порога, ищется сопоставление с наибольшей суммой IoU: венгерский
+алгоритм (кратчайшие увеличивающие пути с потенциалами, как в JV) на матрице
+стоимостей 100 - IoU.
+Сначала выходы раскладываются по сетке, и IoU считается только для пар из соседних
+клеток. Затем пары с IoU больше порога разбиваются на связные группы, и венгерский
+алгоритм решается для каждой группы отдельно: в толпе группы маленькие, поэтому
+время растет почти линейно от количества объектов.
+Буферы растут до наибольшего количества треков и выходов и дальше не выделяются*/
+class TrackAssociation
+{
+public:
+	/*minIou - порог IoU в процентах, как в MyTracker::IOU*/
+	TrackAssociation(const double minIou = 20) : m_minIou(minIou) {};
+
+	/*Сопоставляет треки с боксами tracks и выходы detections*/
+	void assign(const std::vector<cv::Rect>& tracks, const std::vector<cv::Rect>& detections);
+
+	/*Для каждого трека - индекс выхода или -1, для каждого выхода - индекс трека или -1*/
+	const std::vector<int>& trackMatches() const { return m_trackMatches; };
+	const std::vector<int>& detectionMatches() const { return m_detectionMatches; };
+
+	/*Отмечает выходы последнего assign, которые пересекаются хоть с одним из боксов
+	tracks. Боксы могут отличаться от переданных в assign, сетка выходов та же*/
+	void findOverlaps(const std::vector<cv::Rect>& tracks);
+	bool overlapsTrack(const size_t detection) const { return m_overlaps[detection] != 0; };
+
+private:
+	struct Edge
+	{
+		int m_track;
+		int m_detection;
+		float m_cost;
+		int m_group;
+	};
+
+	void buildGrid(const std::vector<cv::Rect>& detections);
+	void cellRange(const cv::Rect& box, int& col1, int& row1, int& col2, int& row2) const;
+	template <typename Visit>
+	void visitCandidates(const cv::Rect& box, const int stamp, Visit visit);
+	int findGroup(int node);
+	void solveGroup(const size_t begin, const size_t end);
+	void hungarian(const int rows, const int cols);
+
+	double m_minIou;
+	const std::vector<cv::Rect>* m_detections = nullptr;
+
+	//Сетка выходов: выходы клетки c - m_cellItems[m_cellStart[c]..m_cellStart[c + 1])
+	cv::Point m_gridOrigin;
+	int m_cellSize = 1;
+	int m_gridCols = 0;
+	int m_gridRows = 0;
+	std::vector<int> m_cellStart;
+	std::vector<int> m_cellItems;
+	//Номер последнего трека, для которого выход уже проверен
+	std::vector<int> m_stamps;
+
+	std::vector<Edge> m_edges;
+	//Система непересекающихся множеств: сначала треки, за ними выходы
+	std::vector<int> m_parents;
+
+	//Матрица стоимостей группы и номера строк и столбцов группы
+	std::vector<int> m_localIndex;
+	std::vector<int> m_rowNodes;
+	std::vector<int> m_colNodes;
+	std::vector<float> m_costs;
+
+	//Потенциалы и пути венгерского алгоритма
+	std::vector<double> m_u;
+	std::vector<double> m_v;
+	std::vector<double> m_minv;
+	std::vector<int> m_p;
+	std::vector<int> m_way;
+	std::vector<char> m_used;
+
+	std::vector<int> m_trackMatches;
+	std::vector<int> m_detectionMatches;
+	std::vector<char> m_overlaps;
+};
+
+/*Сначала сверяет сумму IoU сопоставления с перебором на маленьких случайных сценах,
+затем сравнивает с прежним жадным сопоставлением на синтетической толпе из 10, 100
+и 1000 объектов: время и доля треков, получивших выход своего объекта.
+Возвращает false, если сопоставление хоть раз хуже перебора или несогласовано*/
+bool benchAssociation();
@@ -0,0 +1,134 @@
+#include "Batching.h"
+
+#include <algorithm>
+#include <cstring>
+
+InferenceBatcher::InferenceBatcher(std::unique_ptr<InferenceBackend> backend, const int maxBatch,
+	const std::chrono::microseconds maxWait) :
+	m_backend(std::move(backend)), m_maxBatch(std::max(maxBatch, 1)), m_maxWait(maxWait)
+{
+}
+
+InferenceBatcher::~InferenceBatcher()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_arrived.notify_one();
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+bool InferenceBatcher::load()
+{
+	if (!m_backend || !m_backend->load())
+		return false;
+
+	m_maxBatch = std::min(m_maxBatch, std::max(m_backend->maxBatch(), 1));
+	m_thread = std::thread(&InferenceBatcher::run, this);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_running = true;
+	return true;
+}
+
+bool InferenceBatcher::infer(const cv::Mat& img, float* outputs)
+{
+	Request request{ &img, img.size[0], outputs, std::chrono::steady_clock::now() };
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (m_stop || !m_running || request.m_count > m_maxBatch)
+		return false;
+	m_requests.push_back(&request);
+	m_queued += size_t(request.m_count);
+	m_arrived.notify_one();
+
+	m_finished.wait(lock, [&request] { return request.m_done; });
+	return request.m_status;
+}
+
+std::unique_ptr<InferenceBackend> InferenceBatcher::client(const int maxFrames)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_requests.reserve(m_requests.capacity() + 1);
+	}
+	return std::make_unique<BatchedNet>(*this, std::min(std::max(maxFrames, 1), m_maxBatch));
+}
+
+void InferenceBatcher::run()
+{
+	std::vector<Request*> batch;
+	batch.reserve(m_maxBatch);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;)
+	{
+		m_arrived.wait(lock, [this] { return m_stop || !m_requests.empty(); });
+		if (m_requests.empty())
+			return;
+
+		/*Ждем остальные кадры батча, но не дольше maxWait от прихода первого,
+		чтобы камера, кадр которой пришел раньше других, не простаивала*/
+		auto deadline = m_requests.front()->m_arrived + m_maxWait;
+		m_arrived.wait_until(lock, deadline,
+			[this] { return m_stop || m_queued >= size_t(m_maxBatch); });
+
+		/*Запросы берутся по порядку прихода, пока их кадры помещаются в батч*/
+		size_t count = 0, frames = 0;
+		while (count < m_requests.size() && frames + m_requests[count]->m_count <= size_t(m_maxBatch))
+			frames += m_requests[count++]->m_count;
+		batch.assign(m_requests.begin(), m_requests.begin() + count);
+		m_requests.erase(m_requests.begin(), m_requests.begin() + count);
+		m_queued -= frames;
+
+		lock.unlock();
+		inferBatch(batch);
+		lock.lock();
+
+		for (auto request : batch)
+			request->m_done = true;
+		m_finished.notify_all();
+	}
+}
+
+void InferenceBatcher::inferBatch(std::vector<Request*>& batch)
+{
+	int frames = 0;
+	for (auto request : batch)
+		frames += request->m_count;
+	m_batches += 1;
+	m_frames += size_t(frames);
+
+	/*Склеиваем кадры во входе backend*/
+	cv::Mat& input = m_backend->input(frames);
+	int first = 0;
+	for (auto request : batch)
+	{
+		std::memcpy(input.ptr<float>(first), request->m_img->ptr<float>(0), request->m_count * INPUT_SIZE * sizeof(float));
+		first += request->m_count;
+	}
+
+	bool status = m_backend->infer(input);
+
+	/*Выходы кадров идут подряд, раздаем каждой камере ее часть*/
+	const size_t outputSize = m_backend->outputSize();
+	first = 0;
+	for (auto request : batch)
+	{
+		if (status)
+		{
+			std::memcpy(request->m_outputs, m_backend->outputs() + first * outputSize,
+				request->m_count * outputSize * sizeof(float));
+		}
+		request->m_status = status;
+		first += request->m_count;
+	}
+}
+
+BatchedNet::BatchedNet(InferenceBatcher& batcher, const int maxFrames) :
+	m_batcher(batcher), m_maxFrames(maxFrames), m_input(size_t(maxFrames) * INPUT_SIZE),
+	m_outputs(size_t(maxFrames) * batcher.outputSize())
+{
+	setInputBuffer(m_input.data(), maxFrames);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "Inference.h"
+
+/*Собирает кадры нескольких камер в один инференс. Каждая камера вызывает infer
+из своего потока и ждет результата, а отдельный поток батчера ждет, пока наберется
+maxBatch кадров или пройдет maxWait с момента прихода первого из них, считает их
+одним вызовом backend и раздает каждой камере выходы ее кадров. Камера может прислать
+сразу несколько кадров, например тайлы одного кадра (Tiling.h), они попадают в один батч.
+Сам backend вызывается только из потока батчера, поэтому ему не нужно быть потокобезопасным.
+Кадры копируются прямо во вход backend, а выходы - в буфер камеры, т.к. буфер выхода
+backend перезаписывается следующим батчем. Память при этом не выделяется*/
+class InferenceBatcher
+{
+public:
+	InferenceBatcher(std::unique_ptr<InferenceBackend> backend, const int maxBatch,
+		const std::chrono::microseconds maxWait);
+
+	/*Досчитывает уже пришедшие кадры и останавливает поток*/
+	~InferenceBatcher();
+
+	/*Загружает модель и запускает поток. maxBatch уменьшается до того, что допускает модель*/
+	bool load();
+
+	/*img - blob из N кадров, N не больше maxBatch(), в outputs записывается N * outputSize()
+	выходов. Можно вызывать из любого количества потоков*/
+	bool infer(const cv::Mat& img, float* outputs);
+
+	/*Backend для трекера одной камеры, который отправляет кадры в этот батчер, до maxFrames
+	кадров за раз (не больше maxBatch()). Создается после load*/
+	std::unique_ptr<InferenceBackend> client(const int maxFrames = 1);
+
+	const char* backendName() const { return m_backend->name(); };
+	size_t outputSize() const { return m_backend->outputSize(); };
+	int outputRowSize() const { return m_backend->outputRowSize(); };
+	int maxBatch() const { return m_maxBatch; };
+
+	/*Сколько выполнено инференсов и сколько кадров они посчитали*/
+	size_t batches() const { return m_batches; };
+	size_t frames() const { return m_frames; };
+
+private:
+	struct Request
+	{
+		const cv::Mat* m_img;
+		int m_count;
+		float* m_outputs;
+		std::chrono::steady_clock::time_point m_arrived;
+		bool m_status = false;
+		bool m_done = false;
+	};
+
+	void run();
+	void inferBatch(std::vector<Request*>& batch);
+
+	std::unique_ptr<InferenceBackend> m_backend;
+	int m_maxBatch;
+	std::chrono::microseconds m_maxWait;
+
+	std::mutex m_mutex;
+	std::condition_variable m_arrived;
+	std::condition_variable m_finished;
+
+	//Ожидающие запросы, место под них резервирует client(), и сколько в них кадров
+	std::vector<Request*> m_requests;
+	size_t m_queued = 0;
+	bool m_running = false;
+	bool m_stop = false;
+	std::thread m_thread;
+
+	std::atomic<size_t> m_batches{ 0 };
+	std::atomic<size_t> m_frames{ 0 };
+};
+
+/*Backend одной камеры, который на самом деле считает сеть через общий InferenceBatcher.
+Буферы входа и выхода выделяются сразу на maxFrames кадров*/
+class BatchedNet : public InferenceBackend
+{
+public:
+	BatchedNet(InferenceBatcher& batcher, const int maxFrames = 1);
+
+	/*Модель загружает сам батчер*/
+	bool load() override { return true; };
+	bool infer(const cv::Mat& img) override { return m_batcher.infer(img, m_outputs.data()); };
+	const float* outputs() const override { return m_outputs.data(); };
+	size_t outputSize() const override { return m_batcher.outputSize(); };
+	int outputRowSize() const override { return m_batcher.outputRowSize(); };
+	const char* name() const override { return m_batcher.backendName(); };
+	int maxBatch() const override { return m_maxFrames; };
+
+private:
+	InferenceBatcher& m_batcher;
+	int m_maxFrames;
+	std::vector<float> m_input;
+	std::vector<float> m_outputs;
+};
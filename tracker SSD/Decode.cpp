@@ -0,0 +1,275 @@
+#include "Decode.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+
+#include <opencv2/core/hal/intrin.hpp>
+
+namespace
+{
+	/*Сколько векторов порогов держать под рукой. Для SSD с 6 числами на бокс
+	период - 3 вектора при любой ширине вектора*/
+	constexpr int MAX_PATTERN_VECTORS = 16;
+
+	/*Номер младшего единичного бита*/
+	inline int lowestBit(const unsigned mask)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return int(index);
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+}
+
+void Detections::reserve(const size_t capacity)
+{
+	if (m_scores.size() >= capacity)
+		return;
+	m_left.resize(capacity);
+	m_top.resize(capacity);
+	m_right.resize(capacity);
+	m_bottom.resize(capacity);
+	m_scores.resize(capacity);
+	m_classes.resize(capacity);
+}
+
+void Detections::append(const Detections& other, const size_t i)
+{
+	if (m_count == m_scores.size())
+		reserve(std::max<size_t>(m_count * 2, 64));
+	m_left[m_count] = other.m_left[i];
+	m_top[m_count] = other.m_top[i];
+	m_right[m_count] = other.m_right[i];
+	m_bottom[m_count] = other.m_bottom[i];
+	m_scores[m_count] = other.m_scores[i];
+	m_classes[m_count] = other.m_classes[i];
+	++m_count;
+}
+
+OutputDecoder::OutputDecoder()
+{
+	setThresholds({ 0.2f });
+}
+
+void OutputDecoder::setThresholds(const std::vector<float>& thresholds)
+{
+	m_thresholds = thresholds;
+	preparePattern();
+}
+
+void OutputDecoder::setLayout(const OutputLayout& layout)
+{
+	if (layout.m_priors == m_layout.m_priors && layout.m_stride == m_layout.m_stride)
+		return;
+	m_layout = layout;
+	preparePattern();
+}
+
+float OutputDecoder::threshold(const int column) const
+{
+	const int cls = column - OutputLayout::BOX_SIZE;
+	if (cls < 1 || m_thresholds.empty())
+		return std::numeric_limits<float>::infinity();
+	return m_thresholds[std::min(size_t(cls - 1), m_thresholds.size() - 1)];
+}
+
+void OutputDecoder::preparePattern()
+{
+	if (m_layout.m_stride <= 0)
+		return;
+
+	int lanes = 1;
+#if CV_SIMD
+	lanes = cv::v_float32::nlanes;
+#endif
+	const int period = m_layout.m_stride * lanes / std::gcd(m_layout.m_stride, lanes);
+
+	m_pattern.resize(period);
+	m_priorOffsets.resize(period);
+	m_columns.resize(period);
+	for (int i = 0; i < period; ++i)
+	{
+		m_pattern[i] = threshold(i % m_layout.m_stride);
+		m_priorOffsets[i] = i / m_layout.m_stride;
+		m_columns[i] = i % m_layout.m_stride;
+	}
+}
+
+void OutputDecoder::emit(const float* outputs, const int prior, const int column, const BoxMapping& mapping,
+	Detections& detections) const
+{
+	const float* box = outputs + size_t(prior) * m_layout.m_stride;
+
+	//Как у cv::Point из float: дробная часть отбрасывается
+	const int x1 = int(box[0] * mapping.m_scale.x + mapping.m_offset.x);
+	const int y1 = int(box[1] * mapping.m_scale.y + mapping.m_offset.y);
+	const int x2 = int(box[2] * mapping.m_scale.x + mapping.m_offset.x);
+	const int y2 = int(box[3] * mapping.m_scale.y + mapping.m_offset.y);
+
+	const size_t i = detections.m_count++;
+	detections.m_left[i] = std::min(x1, x2);
+	detections.m_top[i] = std::min(y1, y2);
+	detections.m_right[i] = std::max(x1, x2);
+	detections.m_bottom[i] = std::max(y1, y2);
+	detections.m_scores[i] = box[column];
+	detections.m_classes[i] = column - OutputLayout::BOX_SIZE;
+}
+
+void OutputDecoder::decode(const float* outputs, const BoxMapping& mapping, Detections& detections) const
+{
+	detections.clear();
+	detections.reserve(size_t(m_layout.m_priors) * std::max(m_layout.classes() - 1, 1));
+
+	const int total = m_layout.m_priors * m_layout.m_stride;
+	const int period = int(m_pattern.size());
+	int i = 0;
+
+#if CV_SIMD
+	/*За шаг проверяем целый период порогов: несколько векторов сравниваются, результаты
+	объединяются, и только если что-то прошло, разбираем маски по отдельности*/
+	const int lanes = cv::v_float32::nlanes;
+	const int vectors = period / lanes;
+	if (vectors <= MAX_PATTERN_VECTORS)
+	{
+		cv::v_float32 limits[MAX_PATTERN_VECTORS];
+		for (int k = 0; k < vectors; ++k)
+			limits[k] = cv::vx_load(&m_pattern[k * lanes]);
+
+		for (; i <= total - period; i += period)
+		{
+			cv::v_float32 passed = cv::vx_load(outputs + i) > limits[0];
+			for (int k = 1; k < vectors; ++k)
+				passed = passed | (cv::vx_load(outputs + i + k * lanes) > limits[k]);
+			if (!cv::v_check_any(passed))
+				continue;
+
+			//Период кратен m_stride, поэтому номер бокса и столбца берем из таблиц
+			const int prior = i / m_layout.m_stride;
+			for (int k = 0; k < vectors; ++k)
+			{
+				unsigned mask = unsigned(cv::v_signmask(cv::vx_load(outputs + i + k * lanes) > limits[k]));
+				while (mask)
+				{
+					const int offset = k * lanes + lowestBit(mask);
+					emit(outputs, prior + m_priorOffsets[offset], m_columns[offset], mapping, detections);
+					mask &= mask - 1;
+				}
+			}
+		}
+	}
+#endif
+
+	for (; i < total; ++i)
+	{
+		if (outputs[i] > m_pattern[i % period])
+			emit(outputs, i / m_layout.m_stride, i % m_layout.m_stride, mapping, detections);
+	}
+}
+
+void OutputDecoder::decodeScalar(const float* outputs, const BoxMapping& mapping, Detections& detections) const
+{
+	detections.clear();
+	detections.reserve(size_t(m_layout.m_priors) * std::max(m_layout.classes() - 1, 1));
+
+	//Первые m_stride порогов шаблона - пороги столбцов
+	for (int prior = 0; prior < m_layout.m_priors; ++prior)
+	{
+		for (int column = OutputLayout::BOX_SIZE; column < m_layout.m_stride; ++column)
+		{
+			if (outputs[prior * m_layout.m_stride + column] > m_pattern[column])
+				emit(outputs, prior, column, mapping, detections);
+		}
+	}
+}
+
+namespace
+{
+	/*Прежний processOutputs: один класс в столбце 5, по боксу за раз и push_back*/
+	void legacyDecode(const std::vector<float>& outputs, const double thresh, const cv::Size& frameSize,
+		std::vector<cv::Rect>& rects, std::vector<float>& scores)
+	{
+		for (int i = 0; i < 8732; ++i) {
+			float score = outputs[i * 6 + 5];
+			if (score > thresh) {
+				cv::Point p1(outputs[i * 6] * frameSize.width, outputs[i * 6 + 1] * frameSize.height);
+				cv::Point p2(outputs[i * 6 + 2] * frameSize.width, outputs[i * 6 + 3] * frameSize.height);
+				rects.push_back(cv::Rect(p1, p2));
+				scores.push_back(score);
+			}
+		}
+	}
+}
+
+bool benchDecode()
+{
+	/*Синтетический выход SSD 300: 8732 бокса, фон и один класс. Вероятности
+	в основном маленькие, как у настоящей сети на кадре с несколькими людьми*/
+	const OutputLayout layout{ 8732, 6 };
+	const cv::Size frameSize(1280, 720);
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+
+	std::vector<float> outputs(size_t(layout.m_priors) * layout.m_stride);
+	for (int i = 0; i < layout.m_priors; ++i)
+	{
+		float* row = &outputs[size_t(i) * layout.m_stride];
+		float x = uniform(random) * 0.9f, y = uniform(random) * 0.9f;
+		row[0] = x;
+		row[1] = y;
+		row[2] = x + 0.1f * uniform(random);
+		row[3] = y + 0.1f * uniform(random);
+		float score = std::pow(uniform(random), 8.f);
+		row[4] = 1 - score;
+		row[5] = score;
+	}
+
+	const int repeats = 2000;
+	bool allSame = true;
+	std::cout << "threshold\tdetections\tlegacy, us\tscalar, us\tsimd, us\tsame result" << std::endl;
+	for (float thresh : { 0.01f, 0.05f, 0.2f, 0.5f, 0.9f })
+	{
+		OutputDecoder decoder;
+		decoder.setLayout(layout);
+		decoder.setThresholds({ thresh });
+
+		std::vector<cv::Rect> rects;
+		std::vector<float> scores;
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeats; ++r)
+		{
+			rects.clear();
+			scores.clear();
+			legacyDecode(outputs, thresh, frameSize, rects, scores);
+		}
+		double legacy = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+		Detections scalar;
+		start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeats; ++r)
+			decoder.decodeScalar(outputs.data(), frameSize, scalar);
+		double scalarTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+		Detections simd;
+		start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeats; ++r)
+			decoder.decode(outputs.data(), frameSize, simd);
+		double simdTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+		bool same = simd.size() == rects.size() && scalar.size() == rects.size();
+		for (size_t i = 0; same && i < rects.size(); ++i)
+			same = simd.rect(i) == rects[i] && simd.m_scores[i] == scores[i] && scalar.rect(i) == rects[i];
+		allSame = allSame && same;
+
+		std::cout << thresh << '\t' << rects.size() << '\t' << legacy / repeats << '\t' << scalarTime / repeats
+			<< '\t' << simdTime / repeats << '\t' << (same ? "yes" : "no") << std::endl;
+	}
+	return allSame;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+/*Разметка выхода сети SSD: для каждого из m_priors боксов по m_stride чисел подряд -
+нормированные координаты x1, y1, x2, y2 и вероятности классов. Класс 0 - фон*/
+struct OutputLayout
+{
+	static constexpr int BOX_SIZE = 4;
+
+	int m_priors = 0;
+	int m_stride = 0;
+
+	int classes() const { return m_stride - BOX_SIZE; };
+};
+
+/*Перевод нормированных координат выхода сети в пиксели кадра: x * m_scale.x + m_offset.x.
+Если кадр растянут на весь вход сети, это просто умножение на размер кадра, поэтому
+размер кадра приводится к BoxMapping неявно. Для других режимов см. Preprocessor::mapping*/
+struct BoxMapping
+{
+	BoxMapping(const cv::Size& frameSize) : m_scale(float(frameSize.width), float(frameSize.height)) {};
+	BoxMapping(const cv::Point2f& scale, const cv::Point2f& offset) : m_scale(scale), m_offset(offset) {};
+
+	cv::Point2f m_scale;
+	cv::Point2f m_offset;
+};
+
+/*Боксы, прошедшие порог, в виде структуры массивов. Координаты в пикселях кадра,
+округлены так же, как раньше при построении cv::Rect из двух cv::Point.
+Массивы выделяются один раз под наибольшее возможное количество боксов, дальше
+заполняются первые m_count элементов*/
+struct Detections
+{
+	std::vector<int> m_left;
+	std::vector<int> m_top;
+	std::vector<int> m_right;
+	std::vector<int> m_bottom;
+	std::vector<float> m_scores;
+	std::vector<int> m_classes;
+	size_t m_count = 0;
+
+	void reserve(const size_t capacity);
+	void clear() { m_count = 0; };
+	size_t size() const { return m_count; };
+
+	/*Добавляет в конец бокс i из other. Массивы растут вдвое, когда место кончается*/
+	void append(const Detections& other, const size_t i);
+
+	cv::Rect rect(const size_t i) const
+	{
+		return cv::Rect(m_left[i], m_top[i], m_right[i] - m_left[i], m_bottom[i] - m_top[i]);
+	};
+};
+
+/*Отбор боксов из сырого выхода сети. Выход просматривается подряд, как плоский массив:
+каждое число сравнивается векторно с порогом своего столбца, у координат и фона порог
+бесконечный. Маска сравнения сразу дает номера прошедших чисел, а декодируются только они.
+Большая часть боксов порог не проходит, поэтому почти все время уходит на сравнение*/
+class OutputDecoder
+{
+public:
+	OutputDecoder();
+
+	/*thresholds[c] - порог вероятности класса c, c от 1. Классы, для которых порог не задан,
+	используют последний заданный. Бокс проходит, если вероятность строго больше порога*/
+	void setThresholds(const std::vector<float>& thresholds);
+
+	/*Ничего не делает, если разметка не поменялась*/
+	void setLayout(const OutputLayout& layout);
+	const OutputLayout& layout() const { return m_layout; };
+
+	void decode(const float* outputs, const BoxMapping& mapping, Detections& detections) const;
+
+	/*То же без векторизации, для замеров и проверки*/
+	void decodeScalar(const float* outputs, const BoxMapping& mapping, Detections& detections) const;
+
+private:
+	void preparePattern();
+	float threshold(const int column) const;
+	void emit(const float* outputs, const int prior, const int column, const BoxMapping& mapping,
+		Detections& detections) const;
+
+	OutputLayout m_layout;
+	std::vector<float> m_thresholds;
+
+	//Пороги для каждого числа выхода, повторяются с периодом, кратным и m_stride,
+	//и ширине вектора. Для каждого числа периода - номер бокса от начала периода и столбец
+	std::vector<float> m_pattern;
+	std::vector<int> m_priorOffsets;
+	std::vector<int> m_columns;
+};
+
+/*Сравнение с прежним циклом processOutputs на синтетическом выходе сети
+при разных порогах. false, если результаты хоть раз не совпали*/
+bool benchDecode();
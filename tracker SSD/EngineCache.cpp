@@ -0,0 +1,179 @@
+#include "Header.h"
+
+#ifdef TRACKER_WITH_TENSORRT
+
+#include <cstring>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& path)
+{
+	close();
+
+	m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE)
+	{
+		m_file = nullptr;
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mapping)
+		m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!m_data)
+	{
+		close();
+		return false;
+	}
+
+	m_size = size_t(size.QuadPart);
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	if (m_file)
+		CloseHandle(m_file);
+	m_data = nullptr;
+	m_mapping = nullptr;
+	m_file = nullptr;
+	m_size = 0;
+}
+
+#else
+
+bool MappedFile::open(const std::string& path)
+{
+	close();
+
+	int file = ::open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(file, &info) != 0 || info.st_size == 0)
+	{
+		::close(file);
+		return false;
+	}
+
+	//После mmap дескриптор больше не нужен, отображение остается
+	void* data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+	::close(file);
+	if (data == MAP_FAILED)
+		return false;
+
+	m_data = static_cast<const char*>(data);
+	m_size = size_t(info.st_size);
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (m_data)
+		munmap(const_cast<char*>(m_data), m_size);
+	m_data = nullptr;
+	m_size = 0;
+}
+
+#endif
+
+uint64_t hashBytes(const char* data, const size_t size, uint64_t seed)
+{
+	/*По 8 байт за шаг, умножение и перемешивание как в splitmix64.
+	Модель весит десятки мегабайт, побайтовый хеш заметно удлинил бы запуск*/
+	const uint64_t prime = 0x9E3779B97F4A7C15ull;
+	uint64_t hash = seed ^ (size * prime);
+
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		std::memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * prime;
+		hash ^= hash >> 29;
+	}
+	for (; i < size; ++i)
+		hash = (hash ^ uint8_t(data[i])) * prime;
+
+	hash ^= hash >> 32;
+	hash *= 0xBF58476D1CE4E5B9ull;
+	hash ^= hash >> 29;
+	return hash;
+}
+
+std::string engineCachePath(const std::string& modelPath, const std::string& cacheDir)
+{
+	MappedFile model;
+	if (!model.open(modelPath))
+		return "";
+
+	//Все, от чего зависит собранный движок, кроме самой модели
+	std::ostringstream settings;
+	settings << "batch " << MAX_BATCH << ", tensorrt " << nvinfer1::getInferLibVersion();
+
+	int device = 0;
+	cudaDeviceProp properties;
+	if (cudaGetDevice(&device) == cudaSuccess && cudaGetDeviceProperties(&properties, device) == cudaSuccess)
+		settings << ", " << properties.name << " sm " << properties.major << properties.minor;
+
+	const std::string text = settings.str();
+	uint64_t hash = hashBytes(text.data(), text.size(), hashBytes(model.data(), model.size()));
+
+	std::ostringstream path;
+	path << cacheDir << "/Model-" << std::hex << hash << ".engine";
+	return path.str();
+}
+
+void benchStartup(const std::string& modelPath, const std::string& cacheDir)
+{
+	std::cout << "start\tcache hit\thash, ms\tbuild, ms\tload, ms\ttotal, ms" << std::endl;
+	auto print = [](const char* start, const NNet::LoadReport& report) {
+		std::cout << start << '\t' << report.m_cacheHit << '\t' << report.m_hashTime << '\t'
+			<< report.m_buildTime << '\t' << report.m_loadTime << '\t'
+			<< report.m_hashTime + report.m_buildTime + report.m_loadTime << std::endl;
+	};
+
+	NNet cold(modelPath, cacheDir, true);
+	if (!cold.load())
+	{
+		std::cout << "failed to build engine for " << modelPath << std::endl;
+		return;
+	}
+	print("cold", cold.loadReport());
+
+	for (int i = 0; i < 3; ++i)
+	{
+		NNet warm(modelPath, cacheDir);
+		if (warm.load())
+			print("warm", warm.loadReport());
+	}
+}
+#endif
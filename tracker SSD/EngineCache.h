@@ -0,0 +1,46 @@
+#pragma once
+
+/*Только для сборки с TensorRT (TRACKER_WITH_TENSORRT), см. NNet*/
+
+#include <cstdint>
+#include <string>
+
+/*Файл, отображенный в память только для чтения. Движок TensorRT и модель .onnx
+читаются без копирования в std::vector, страницы подгружает система по мере надобности*/
+class MappedFile
+{
+public:
+	MappedFile() {};
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/*false, если файла нет, он пустой или его не удалось отобразить*/
+	bool open(const std::string& path);
+	void close();
+
+	const char* data() const { return m_data; };
+	size_t size() const { return m_size; };
+
+private:
+	const char* m_data = nullptr;
+	size_t m_size = 0;
+
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#endif
+};
+
+/*64-битный хеш массива байт, не криптографический*/
+uint64_t hashBytes(const char* data, const size_t size, uint64_t seed = 0);
+
+/*Путь к движку в каталоге cacheDir для модели modelPath. Имя содержит хеш содержимого
+модели и всего, от чего зависит собранный движок: наибольший батч, версия TensorRT
+и видеокарта. Если что-то из этого поменялось, путь будет другим и движок соберется заново.
+Пустая строка, если модель не удалось прочитать*/
+std::string engineCachePath(const std::string& modelPath, const std::string& cacheDir);
+
+/*Замер холодного запуска (сборка движка и загрузка) и теплого (загрузка из кеша)*/
+void benchStartup(const std::string& modelPath, const std::string& cacheDir);
@@ -1,12 +1,17 @@
 ﻿#include "Header.h"
+#include "../shared/SyntheticScene.h"
+#include "../shared/TrackingScore.h"
 
+#include <random>
+
+#ifdef TRACKER_WITH_TENSORRT
 void Logger::log(Severity severity, const char* msg) noexcept {
 	if (severity <= Severity::kWARNING) {
 		std::cout << msg << std::endl;
 	}
 }
 
-bool NNet::buildEngine(const char modelPath[]) {
+bool NNet::buildEngine(const std::string& modelPath, const std::string& enginePath) {
 
 	std::unique_ptr<nvinfer1::IBuilder> builder(nvinfer1::createInferBuilder(m_logger));
 
@@ -15,11 +20,12 @@ bool NNet::buildEngine(const char modelPath[]) {
 	auto network = std::unique_ptr<nvinfer1::INetworkDefinition>(builder->createNetworkV2(flag));
 
 	std::unique_ptr<nvonnxparser::IParser> parser(nvonnxparser::createParser(*network, m_logger));
-	parser->parseFromFile(modelPath,
+	parser->parseFromFile(modelPath.c_str(),
 		static_cast<int32_t>(nvinfer1::ILogger::Severity::kWARNING));
 
 	for (int32_t i = 0; i < parser->getNbErrors(); ++i)
 		std::cout << parser->getError(i)->desc() << std::endl;
+	if (parser->getNbErrors() > 0) return false;
 
 
 	const auto input = network->getInput(0);
@@ -30,272 +36,335 @@ bool NNet::buildEngine(const char modelPath[]) {
 	int32_t inputH = inputDims.d[2];
 	int32_t inputW = inputDims.d[3];
 
+	/*Если размер батча в модели не зафиксирован, движок принимает от 1 до MAX_BATCH
+	кадров за раз, чтобы можно было считать кадры нескольких камер одним инференсом*/
+	int32_t minBatch = inputDims.d[0] > 0 ? inputDims.d[0] : 1;
+	int32_t maxBatch = inputDims.d[0] > 0 ? inputDims.d[0] : MAX_BATCH;
+
 	std::unique_ptr<nvinfer1::IBuilderConfig> config(builder->createBuilderConfig());
 
 	nvinfer1::IOptimizationProfile* profile = builder->createOptimizationProfile();
-	profile->setDimensions(inputName, OptProfileSelector::kMIN, Dims4(1, inputC, inputH, inputW));
-	profile->setDimensions(inputName, OptProfileSelector::kOPT, Dims4(1, inputC, inputH, inputW));
-	profile->setDimensions(inputName, OptProfileSelector::kMAX, Dims4(1, inputC, inputH, inputW));
+	profile->setDimensions(inputName, OptProfileSelector::kMIN, Dims4(minBatch, inputC, inputH, inputW));
+	profile->setDimensions(inputName, OptProfileSelector::kOPT, Dims4(maxBatch, inputC, inputH, inputW));
+	profile->setDimensions(inputName, OptProfileSelector::kMAX, Dims4(maxBatch, inputC, inputH, inputW));
 	config->addOptimizationProfile(profile);
 
 	
 	std::unique_ptr<nvinfer1::IHostMemory> serializedModel(builder->buildSerializedNetwork(*network, *config));
 	if (!(serializedModel)) return false;
 
-	std::ofstream ofs("../Model.engine", std::ios::binary);
+	//Пишу во временный файл и переименовываю, чтобы при сбое в кеше не остался
+	//недописанный движок
+	std::string tempPath = enginePath + ".tmp";
+	std::ofstream ofs(tempPath, std::ios::binary);
 	ofs.write((char*)(serializedModel->data()), serializedModel->size());
 	ofs.close();
+	if (!ofs) return false;
 
-	return true;
+	std::remove(enginePath.c_str());
+	return std::rename(tempPath.c_str(), enginePath.c_str()) == 0;
 }
 
-bool NNet::load() {
-	
-	std::ifstream ifs(ENGINE_PATH, std::ios::binary | std::ios::ate);
-	size_t engine_size = ifs.tellg();
-	ifs.seekg(0, ifs.beg);
+bool NNet::deserialize(const std::string& enginePath) {
 
-	std::vector<char> modelStream;
-	modelStream.resize(engine_size);
-	ifs.read(modelStream.data(), engine_size);
+	//Движок отображается в память, TensorRT читает его прямо оттуда
+	MappedFile engine;
+	if (!engine.open(enginePath)) return false;
 
-	std::unique_ptr<nvinfer1::IRuntime> runtime(nvinfer1::createInferRuntime(m_logger));
-	if (!(runtime)) return false;
+	m_context = nullptr;
+	m_engine = nullptr;
+	m_runtime = std::unique_ptr<nvinfer1::IRuntime>(nvinfer1::createInferRuntime(m_logger));
+	if (!(m_runtime)) return false;
 
-	m_engine = std::unique_ptr<nvinfer1::ICudaEngine>(runtime->deserializeCudaEngine(modelStream.data(), engine_size));
+	m_engine = std::unique_ptr<nvinfer1::ICudaEngine>(m_runtime->deserializeCudaEngine(engine.data(), engine.size()));
 	if (!(m_engine)) return false;
 
 	m_context = std::unique_ptr<nvinfer1::IExecutionContext>(m_engine->createExecutionContext());
-	if (!(m_context)) return false;
-	
-	return true;
+	return m_context != nullptr;
 }
 
-bool NNet::infer(const cv::Mat& img, std::vector<float>& features) {
+bool NNet::load() {
 
-	//Смотрю, какие сеть ожидает входы и делаю ресайз буфера
-	auto dims = m_engine->getBindingDimensions(0);
-	auto outputL = (m_engine->getBindingDimensions(1).d[1]) * (m_engine->getBindingDimensions(1).d[0]);
-	Dims4 inputDims = { int32_t(1), dims.d[1], dims.d[2], dims.d[3] };
+	using Clock = std::chrono::steady_clock;
+	auto elapsed = [](const Clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	};
+
+	//Путь к движку зависит от хеша модели и настроек сборки
+	auto start = Clock::now();
+	m_report = LoadReport();
+	m_report.m_enginePath = engineCachePath(m_modelPath, m_cacheDir);
+	m_report.m_hashTime = elapsed(start);
+	if (m_report.m_enginePath.empty()) {
+		std::cout << "failed to read model " << m_modelPath << std::endl;
+		return false;
+	}
 
-	m_inputBuff.hostBuffer.resize(inputDims);
-	m_inputBuff.deviceBuffer.resize(inputDims);
+	//Если готового движка нет или он не загружается, собираю заново
+	start = Clock::now();
+	m_report.m_cacheHit = !m_rebuild && deserialize(m_report.m_enginePath);
+	if (!m_report.m_cacheHit) {
+		if (!buildEngine(m_modelPath, m_report.m_enginePath)) return false;
+		m_report.m_buildTime = elapsed(start);
 
-	//Аналогично с выходами
-	Dims3 outputDims{ int32_t(1), m_engine->getBindingDimensions(1).d[1], m_engine->getBindingDimensions(1).d[0] };
-	m_outputBuff.hostBuffer.resize(outputDims);
-	m_outputBuff.deviceBuffer.resize(outputDims);
+		start = Clock::now();
+		if (!deserialize(m_report.m_enginePath)) return false;
+	}
 
-	//Копирую входной кадр на gpu
-	cudaMemcpy(m_inputBuff.deviceBuffer.data(), img.ptr<float>(0), m_inputBuff.hostBuffer.nbBytes(), cudaMemcpyHostToDevice);
-	
-	std::vector<void*> predicitonBindings = { m_inputBuff.deviceBuffer.data(), m_outputBuff.deviceBuffer.data() };
+	//Размер батча либо зафиксирован в модели, либо задан профилем при сборке движка
+	auto inputDims = m_engine->getBindingDimensions(0);
+	m_maxBatch = inputDims.d[0] > 0 ? inputDims.d[0] :
+		m_engine->getProfileDimensions(0, 0, OptProfileSelector::kMAX).d[0];
+	if (inputDims.d[1] != INPUT_CHANNELS || inputDims.d[2] != INPUT_HEIGHT || inputDims.d[3] != INPUT_WIDTH)
+		return false;
 
-	bool status = m_context->executeV2(predicitonBindings.data());
-	if (!status) return false;
+	//Размеры входа и выхода задаю один раз, буферы выделяю сразу под наибольший батч
+	Dims4 maxDims = { int32_t(m_maxBatch), inputDims.d[1], inputDims.d[2], inputDims.d[3] };
+	if (inputDims.d[0] < 0 && !m_context->setBindingDimensions(0, maxDims)) return false;
+	m_batch = m_maxBatch;
 
-	//Возвращаю обратно результаты инференса
-	cudaMemcpy(m_outputBuff.hostBuffer.data(), m_outputBuff.deviceBuffer.data(), 
-		m_outputBuff.deviceBuffer.nbBytes(), cudaMemcpyDeviceToHost);
+	auto outputDims = m_context->getBindingDimensions(1);
+	size_t outputL = 1;
+	for (int32_t i = 0; i < outputDims.nbDims; ++i)
+		outputL *= outputDims.d[i];
+	m_outputSize = outputL / m_maxBatch;
+	m_outputRowSize = outputDims.d[outputDims.nbDims - 1];
 
-	features.resize(outputL);
+	m_inputBuff.hostBuffer.resize(maxDims);
+	m_inputBuff.deviceBuffer.resize(maxDims);
+	m_outputBuff.hostBuffer.resize(outputDims);
+	m_outputBuff.deviceBuffer.resize(outputDims);
 
-	//Записываю результаты в вектор
-	memcpy(features.data(), reinterpret_cast<const char*>(m_outputBuff.hostBuffer.data()), outputL * sizeof(float));
+	//Закрепляю память на хосте, тогда копирование на gpu и обратно идет напрямую,
+	//без промежуточного буфера драйвера
+	m_pinned = cudaHostRegister(m_inputBuff.hostBuffer.data(), m_inputBuff.hostBuffer.nbBytes(),
+		cudaHostRegisterDefault) == cudaSuccess &&
+		cudaHostRegister(m_outputBuff.hostBuffer.data(), m_outputBuff.hostBuffer.nbBytes(),
+		cudaHostRegisterDefault) == cudaSuccess;
+
+	m_bindings[0] = m_inputBuff.deviceBuffer.data();
+	m_bindings[1] = m_outputBuff.deviceBuffer.data();
+	setInputBuffer(static_cast<float*>(m_inputBuff.hostBuffer.data()), m_maxBatch);
+
+	m_report.m_loadTime = elapsed(start);
+	std::cout << "engine " << m_report.m_enginePath << (m_report.m_cacheHit ? " loaded from cache" : " built")
+		<< ": hash " << m_report.m_hashTime << " ms, build " << m_report.m_buildTime << " ms, load "
+		<< m_report.m_loadTime << " ms" << std::endl;
 	
 	return true;
 }
 
-void MyTracker::nms(double thresh, int neighbors)
-{
-
-	m_outRects.clear();
+NNet::~NNet() {
+	if (m_pinned) {
+		cudaHostUnregister(m_inputBuff.hostBuffer.data());
+		cudaHostUnregister(m_outputBuff.hostBuffer.data());
+	}
+}
 
-	const size_t size = m_scores.size();
-	std::multimap<float, size_t> sorted;
-	for (size_t i = 0; i < size; ++i)
-		sorted.emplace(m_scores[i], i);
+bool NNet::infer(const cv::Mat& img) {
 
-	while (sorted.size() > 0) {
+	//Первая размерность blob - количество кадров в батче
+	const int32_t batch = img.size[0];
+	if (!m_context || batch > m_maxBatch) return false;
 
-		auto highest = --std::end(sorted);
-		const cv::Rect& rect1 = m_rects[highest->second];
+	//Если вход подготовлен не в input(), копирую его туда
+	stageInput(img);
 
-		int neighborsCount = 0;
+	//Размер батча задаю контексту, только если он поменялся
+	if (batch != m_batch) {
+		auto dims = m_engine->getBindingDimensions(0);
+		Dims4 inputDims = { batch, dims.d[1], dims.d[2], dims.d[3] };
+		if (dims.d[0] < 0 && !m_context->setBindingDimensions(0, inputDims)) return false;
+		m_batch = batch;
+	}
 
-		sorted.erase(highest);
+	//Копирую входные кадры на gpu
+	cudaMemcpy(m_inputBuff.deviceBuffer.data(), m_inputBuff.hostBuffer.data(), batch * INPUT_SIZE * sizeof(float),
+		cudaMemcpyHostToDevice);
 
-		for (auto iter = std::begin(sorted); iter != std::end(sorted);) {
+	bool status = m_context->executeV2(m_bindings);
+	if (!status) return false;
 
-			const cv::Rect& rect2 = m_rects[iter->second];
+	//Возвращаю обратно результаты инференса, их читают прямо из буфера через outputs()
+	cudaMemcpy(m_outputBuff.hostBuffer.data(), m_outputBuff.deviceBuffer.data(),
+		batch * m_outputSize * sizeof(float), cudaMemcpyDeviceToHost);
+	
+	return true;
+}
+#endif
 
-			if (IOU(rect1, rect2) > thresh) {
-				iter = sorted.erase(iter);
-				++neighborsCount;
-			}
-			else {
-				++iter;
-			}
+void MyTracker::nms(double thresh, int neighbors)
+{
+	MEASURE_STAGE(Stage::Nms, m_camera);
 
-		}
+	m_outRects.clear();
 
-		if (neighborsCount >= neighbors)
-			m_outRects.push_back(rect1);
+	NmsOptions options;
+	options.m_iouThreshold = thresh;
+	options.m_minNeighbors = neighbors;
+	m_nms.setOptions(options);
 
-	}
+	for (int index : m_nms.run(m_detections))
+		m_outRects.push_back(m_detections.rect(index));
 
 }
 
-void MyTracker::processOutputs(const double thresh, const cv::Mat& frame) {
+void MyTracker::processOutputs(const cv::Mat& frame) {
 
-	for (int i = 0; i < 8732; ++i) {
-		float score = m_rawOutputs[i * 6 + 5];
-		if (score > thresh) {
-			cv::Point p1(m_rawOutputs[i * 6] * frame.cols, m_rawOutputs[i * 6 + 1] * frame.rows);
-			cv::Point p2(m_rawOutputs[i * 6 + 2] * frame.cols, m_rawOutputs[i * 6 + 3] * frame.rows);
-			m_rects.push_back(cv::Rect(p1, p2));
-			m_scores.push_back(score);
-		}
-	}
+	if (!m_rawOutputs)
+		return;
+	MEASURE_STAGE(Stage::Decode, m_camera);
+
+	//Разметка меняется только при смене модели, тогда же перестраиваются пороги
+	const int rowSize = m_model->outputRowSize();
+	m_decoder.setLayout({ int(m_model->outputSize() / rowSize), rowSize });
+	m_decoder.decode(m_rawOutputs, m_preprocessor.mapping(frame.size()), m_detections);
 
 }
 
 double MyTracker::IOU(const cv::Rect& rect1, const cv::Rect& rect2) const
 {
-
-	if (rect1.area() != 0 && rect2.area() != 0) 
-	{
-		double intArea = (rect1 & rect2).area();
-		double totalArea = rect1.area() + rect2.area() - intArea;
-		return (intArea / totalArea) * 100;
-	}
-	else
-		return 0;
+	return percentIou(rect1, rect2);
 }
 
 void MyTracker::updateTracks()
 {
+	MEASURE_STAGE(Stage::Association, m_camera);
 
-	if (m_tracks.size() > 0) {
-		
-		/*Определяем наибольший id среди всех треков*/
-		int largestId = m_tracks[0]->m_id;
-		for (auto& track : m_tracks)
-		{
-			if (track->m_id > largestId)
-				largestId = track->m_id;
-		}
+	const int elapsed = std::max(m_sinceUpdate, 1);
+	m_sinceUpdate = 0;
 
-		/*Для каждого непропавшего (expired) трека, ищу по всем
-		выходам сети пересекающиеся с треком. Обновляю трек в зависимости
-		от результата*/
-		for (auto& track : m_tracks) 
-		{ 
-			if (track->m_expired)
-				continue;
-			
-			/*Флаг нужен, чтобы понять, выполнился ли один из if-ов в цикле
-			for. Такое возможно, только если выход сети пересекся с треком*/
-			bool trackFlag = false;
-			if (m_outRects.size() > 0) {
-				for (auto& output : m_outRects) {
-					auto iou = IOU(output, track->m_box);
-					/*Если трек активирован и пересекается с выходом сети,
-					обновляю его координаты соответственно*/
-					if (iou > 20 && track->m_activated) {
-						track->m_liveFrames = LIVE_FRAMES;
-						track->m_box = output;
-						track->m_present = true;
-						trackFlag = true;
-						break;
-					}
-					/*Если трек еще не активирован, но есть пересечение с выходом
-					сети, обновляю координаты. Увеличиваю время жизни (эквивалентно
-					уменьшению оставшегося времени до активации). Если пора активировать трек,
-					то делаю это и обновляю остальные члены структуры.*/
-					else if (iou > 20 && !track->m_activated) {
-						track->m_box = output;
-						if (++track->m_actvFrames >= ACTIVATION_FRAMES) {
-							track->m_liveFrames = LIVE_FRAMES;
-							track->m_actvFrames = 0;
-							track->m_activated = true;
-							track->m_present = true;
-							track->m_id = largestId + 1;
-						}
-						trackFlag = true;
-						break;
-					}
-				}
-
-				/*Если трек не пересекся ни с одним выходом, помечаю его пропавшим*/
-				if (!trackFlag)
-					track->m_present = false;
-			}
-			
-			/*Если дошли до сюда, значит сеть не дала ни один выход. Считаю трек пропавшим*/
-			else {
-				if (track->m_activated) {
-					track->m_present = false;
-					--track->m_liveFrames;
-				}
-				else {
-					track->m_actvFrames = 0;
-				}
-				
+	/*Сопоставляю выходы сети с предсказанными боксами треков так, чтобы сумма IoU
+	пар была наибольшей, и чтобы каждый выход достался не больше чем одному треку*/
+	m_trackBoxes.clear();
+	for (size_t i = 0; i < m_tracks.size(); ++i)
+		m_trackBoxes.push_back(m_motion.box(i));
+	m_association.assign(m_trackBoxes, m_outRects);
+
+	for (size_t i = 0; i < m_tracks.size(); ++i)
+	{
+		Track& track = m_tracks[i];
+
+		/*Если трек не сопоставлен ни с одним выходом (в том числе когда сеть не дала ни одного),
+		помечаю его пропавшим. Неактивированный трек начинает активацию заново и удаляется,
+		если выхода нет CANDIDATE_FRAMES кадров*/
+		const int match = m_association.trackMatches()[i];
+		if (match < 0) {
+			if (track.m_activated && track.m_present)
+				addEvent(TrackEventType::Lost, track);
+			if (!track.m_activated) {
+				track.m_actvFrames = 0;
+				track.m_liveFrames -= elapsed;
 			}
+			track.m_present = false;
+			continue;
 		}
 
-		/*Ищу индексы выходов в векторе outputs, которые
-		не пересекаются ни с какими треками. Создаю из них треки*/
-		std::vector<int> inds = searchNew(m_outRects);
-		for (int i = 0; i < inds.size(); ++i)
-		{
-			m_tracks.emplace_back(std::make_unique<Track>(m_outRects[inds[i]]));
+		/*Если трек активирован, обновляю его координаты по выходу сети*/
+		const cv::Rect& output = m_outRects[match];
+		m_motion.update(i, output);
+		if (track.m_activated) {
+			track.m_liveFrames = LIVE_FRAMES;
+			track.m_box = output;
+			addEvent(track.m_present ? TrackEventType::Update : TrackEventType::Reidentified, track);
+			track.m_present = true;
 		}
-
-		/*Уменьшаю время жизни исчезнувших треков. Если время вышло, помечаю
-		их пропавшими*/
-		for (auto& track : m_tracks) {
-			if (!track->m_present && track->m_activated)
-				--track->m_liveFrames;
-			if (track->m_liveFrames <= 0) {
-				track->m_liveFrames = 0;
-				track->m_expired = true;
+		/*Если трек еще не активирован, обновляю координаты. Увеличиваю время жизни
+		(эквивалентно уменьшению оставшегося времени до активации) на число кадров
+		с прошлого инференса. Если пора активировать трек, то делаю это и выдаю ему новый id*/
+		else {
+			track.m_box = output;
+			track.m_liveFrames = CANDIDATE_FRAMES;
+			if ((track.m_actvFrames += elapsed) >= ACTIVATION_FRAMES) {
+				track.m_liveFrames = LIVE_FRAMES;
+				track.m_actvFrames = 0;
+				track.m_activated = true;
+				track.m_present = true;
+				track.m_id = ++m_largestId;
+				addEvent(TrackEventType::Start, track);
 			}
 		}
 	}
 
-	/*Если дошли до сюда, значит нет ни одного трека. Создаем новые треки из выходов*/
-	else 
+	/*Выходы, которые не пересекаются ни с какими треками после обновления, становятся
+	новыми треками. Сетка выходов осталась от сопоставления*/
+	for (size_t i = 0; i < m_tracks.size(); ++i)
+		m_trackBoxes[i] = m_tracks[i].m_box;
+	m_association.findOverlaps(m_trackBoxes);
+	for (size_t i = 0; i < m_outRects.size(); ++i)
 	{
-		for (int i = 0; i < m_outRects.size(); ++i)
-			m_tracks.emplace_back(std::make_unique<Track>(m_outRects[i], m_tracks.size()));
+		if (!m_association.overlapsTrack(i)) {
+			Track candidate(m_outRects[i]);
+			candidate.m_liveFrames = CANDIDATE_FRAMES;
+			m_tracks.insert(candidate);
+			m_motion.add(m_outRects[i]);
+		}
 	}
 
-}
+	/*Время жизни уменьшается один раз за вызов: у неактивированных треков без выхода -
+	в цикле выше, у пропавших активированных - здесь. Если время вышло, трек больше
+	не нужен, убираю его вместе с фильтром, чтобы не просматривать каждый кадр. На его
+	место переносится последний трек и его фильтр, поэтому i не увеличиваю*/
+	for (size_t i = 0; i < m_tracks.size();) {
+		Track& track = m_tracks[i];
+		if (!track.m_present && track.m_activated)
+			track.m_liveFrames -= elapsed;
+		if (track.m_liveFrames > 0) {
+			++i;
+			continue;
+		}
+		if (track.m_activated)
+			addEvent(TrackEventType::Expired, track);
+		m_motion.move(m_tracks.size() - 1, i);
+		m_tracks.eraseAt(i);
+	}
+	m_motion.resize(m_tracks.size());
 
+}
 
-std::vector<int> MyTracker::searchNew(const std::vector<cv::Rect>& outputs) const
+void MyTracker::advance(const int elapsed)
 {
+	m_motion.predict(elapsed);
+	m_sinceUpdate += elapsed;
+	for (size_t i = 0; i < m_tracks.size(); ++i) {
+		if (m_tracks[i].m_present)
+			m_tracks[i].m_box = m_motion.box(i);
+	}
+}
 
-	std::vector<int> inds;
-	for (auto i = 0; i < outputs.size(); ++i) {
-		bool flag = false;
-		for (auto& track : m_tracks) {
-			if (track->m_expired)
-				continue;
-
-			if (IOU(outputs[i], track->m_box) > 0) {
-				flag = true;
-				break;
-			}
-		}
-		if (!flag)
-			inds.push_back(i);
+void MyTracker::predict(const int elapsed)
+{
+	advance(elapsed);
+	for (auto& track : m_tracks) {
+		if (track.m_present && track.m_activated)
+			addEvent(TrackEventType::Update, track);
 	}
+}
+
+void MyTracker::addEvent(const TrackEventType type, const Track& track)
+{
+	TrackEvent event;
+	event.m_type = type;
+	event.m_camera = m_camera;
+	event.m_id = track.m_id;
+	event.m_box = track.m_box;
+	m_events.push_back(event);
+}
 
-	return inds;
+void MyTracker::takeEvents(std::vector<TrackEvent>& events)
+{
+	events.clear();
+	std::swap(events, m_events);
+}
 
+double MyTracker::uncertainty() const
+{
+	double largest = 0;
+	for (size_t i = 0; i < m_tracks.size(); ++i) {
+		if (m_tracks[i].m_present && m_tracks[i].m_activated)
+			largest = std::max(largest, m_motion.uncertainty(i));
+	}
+	return largest;
 }
 
 bool MyTracker::drawTracks(cv::Mat& frame)
@@ -303,29 +372,199 @@ bool MyTracker::drawTracks(cv::Mat& frame)
 	if (m_tracks.size() == 0)
 		return false;
 
+	drawTracks(frame, visibleTracks());
+	return true;
+}
+
+std::vector<std::pair<int, cv::Rect>> MyTracker::visibleTracks() const
+{
+	std::vector<std::pair<int, cv::Rect>> visible;
 	for (auto& track : m_tracks) {
-		
-		if (track->m_expired || !track->m_activated)
-			continue;
+		if (track.m_activated)
+			visible.emplace_back(track.m_id, track.m_box);
+	}
+	return visible;
+}
+
+void MyTracker::drawTracks(cv::Mat& frame, const std::vector<std::pair<int, cv::Rect>>& tracks)
+{
+	for (auto& track : tracks) {
 
-		cv::Point p1(track->m_box.x, track->m_box.y);
-		cv::Point p2(track->m_box.x + track->m_box.width,
-			track->m_box.y + track->m_box.height);
+		const cv::Rect& box = track.second;
+		cv::Point p1(box.x, box.y);
+		cv::Point p2(box.x + box.width, box.y + box.height);
 		cv::rectangle(frame, p1, p2, { 0, 255, 0 });
 
 		std::string text = "ID: ";
-		text += std::to_string(track->m_id);
-		cv::putText(frame, text, cv::Point(track->m_box.x, track->m_box.y + track->m_box.height / 2),
+		text += std::to_string(track.first);
+		cv::putText(frame, text, cv::Point(box.x, box.y + box.height / 2),
 			cv::FONT_HERSHEY_SIMPLEX, 1, cv::Scalar(0, 0, 255));
 	}
-
-	return true;
 }
 
 void MyTracker::clearOutputs()
 {
-	m_rawOutputs.clear();
-	m_rects.clear();
-	m_scores.clear();
+	m_rawOutputs = nullptr;
+	m_detections.clear();
 	m_outRects.clear();
+}
+
+void MyTracker::process(const cv::Mat& frame, const int elapsed)
+{
+	//События update выдает updateTracks по выходам сети, а не предсказание
+	advance(elapsed);
+	detect(frame);
+	updateTracks();
+}
+
+void MyTracker::processDetections(const std::vector<cv::Rect>& detections, const int elapsed)
+{
+	advance(elapsed);
+	clearOutputs();
+	m_outRects.assign(detections.begin(), detections.end());
+	updateTracks();
+}
+
+void MyTracker::detect(const cv::Mat& frame)
+{
+	//Выходы прошлого кадра чистятся здесь, а не в конце process, чтобы их можно было
+	//прочитать через detections()
+	clearOutputs();
+	if (m_tiles.options().enabled()) {
+		detectTiles(frame);
+		nms(50, 1);
+		return;
+	}
+
+	/*Транформирую кадр в подходящий для нейросети формат прямо во входном тензоре.
+	То есть NCHW размерность, размер 300x300 (растянутый или с полями, см. ResizeMode),
+	средние по каналам (123, 117, 104) и свап B,R каналов, т.к. opencv считывает BGR*/
+	cv::Mat& blob = m_model->input(1);
+	{
+		MEASURE_STAGE(Stage::Preprocess, m_camera);
+		m_preprocessor.run(frame, blob.ptr<float>(0));
+	}
+	{
+		MEASURE_STAGE(Stage::Inference, m_camera);
+		inferModel(blob);
+	}
+	m_images = 1;
+	processOutputs(frame);
+	nms(50, 1);
+}
+
+void MyTracker::detectTiles(const cv::Mat& frame)
+{
+	/*Тайлы около предсказанных боксов всех треков, в т.ч. еще не активированных*/
+	m_trackBoxes.clear();
+	for (size_t i = 0; i < m_tracks.size(); ++i)
+		m_trackBoxes.push_back(m_motion.box(i));
+	const std::vector<cv::Rect>& tiles = m_tiles.plan(frame, m_trackBoxes);
+
+	//Изображение 0 - кадр целиком, если он считается, дальше тайлы
+	const bool fullFrame = m_tiles.options().m_fullFrame;
+	const int first = fullFrame ? 1 : 0;
+	const int images = first + int(tiles.size());
+	const int maxBatch = std::max(m_model->maxBatch(), 1);
+	m_images = size_t(images);
+
+	for (int begin = 0; begin < images; begin += maxBatch) {
+		const int count = std::min(maxBatch, images - begin);
+		cv::Mat& blob = m_model->input(count);
+		{
+			MEASURE_STAGE(Stage::Preprocess, m_camera);
+			for (int k = 0; k < count; ++k) {
+				const int image = begin + k;
+				if (image < first)
+					m_preprocessor.run(frame, blob.ptr<float>(k));
+				else
+					m_tilePreprocessor.run(frame(tiles[image - first]), blob.ptr<float>(k));
+			}
+		}
+		{
+			MEASURE_STAGE(Stage::Inference, m_camera);
+			inferModel(blob);
+		}
+		if (!m_rawOutputs)
+			continue;
+
+		/*Боксы тайла переводятся в координаты кадра сдвигом на начало тайла, и все боксы
+		кадра проходят общий nms, так что дубли на стыках тайлов убираются вместе с остальными*/
+		MEASURE_STAGE(Stage::Decode, m_camera);
+		const int rowSize = m_model->outputRowSize();
+		m_decoder.setLayout({ int(m_model->outputSize() / rowSize), rowSize });
+		for (int k = 0; k < count; ++k) {
+			const int image = begin + k;
+			const float* outputs = m_rawOutputs + k * m_model->outputSize();
+			if (image < first) {
+				m_decoder.decode(outputs, m_preprocessor.mapping(frame.size()), m_tileDetections);
+				for (size_t i = 0; i < m_tileDetections.size(); ++i)
+					m_detections.append(m_tileDetections, i);
+				continue;
+			}
+
+			const cv::Rect& tile = tiles[image - first];
+			BoxMapping mapping = m_tilePreprocessor.mapping(tile.size());
+			mapping.m_offset += cv::Point2f(float(tile.x), float(tile.y));
+			m_decoder.decode(outputs, mapping, m_tileDetections);
+			for (size_t i = 0; i < m_tileDetections.size(); ++i) {
+				if (!fullFrame || !m_tiles.cut(m_tileDetections.rect(i), tile))
+					m_detections.append(m_tileDetections, i);
+			}
+		}
+	}
+}
+void benchUpdateTracks()
+{
+	constexpr int FRAMES = 300;
+	std::cout << "objects\tupdate, us\ttracks per frame\tMOTA\tid switches" << std::endl;
+
+	for (int objects : { 10, 50, 200 })
+	{
+		/*Площадь кадра растет вместе с количеством объектов, чтобы плотность сцены
+		была одинаковой и замер показывал рост цены сопоставления, а не пересечений*/
+		SceneOptions options;
+		options.m_objects = objects;
+		const double scale = std::max(1., std::sqrt(objects * 20000. / options.m_size.area()));
+		options.m_size = cv::Size(int(options.m_size.width * scale), int(options.m_size.height * scale));
+		const SyntheticScene scene(options);
+
+		MyTracker tracker(nullptr);
+		std::mt19937 random(1);
+		std::uniform_int_distribution<int> jitter(-3, 3);
+		SyntheticScene::Boxes truth;
+		std::vector<cv::Rect> detections;
+		std::vector<TrackEvent> events;
+		TrackingEvaluator evaluator;
+		size_t tracks = 0;
+		double seconds = 0;
+		for (int index = 0; index < FRAMES; ++index)
+		{
+			/*Выходы сети: истинные боксы со сдвигом в несколько пикселей, в случайном
+			порядке и без 5% объектов*/
+			scene.boxes(index, truth);
+			detections.clear();
+			for (auto& object : truth)
+			{
+				if (random() % 20 == 0)
+					continue;
+				const cv::Rect& box = object.second;
+				detections.emplace_back(box.x + jitter(random), box.y + jitter(random), box.width, box.height);
+			}
+			std::shuffle(detections.begin(), detections.end(), random);
+
+			auto start = std::chrono::steady_clock::now();
+			tracker.processDetections(detections);
+			seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			tracker.takeEvents(events);
+			const auto visible = tracker.visibleTracks();
+			tracks += visible.size();
+			evaluator.add(truth, visible);
+		}
+
+		const TrackingScore& score = evaluator.score();
+		std::cout << objects << '\t' << seconds * 1e6 / FRAMES << '\t' << double(tracks) / FRAMES << '\t'
+			<< score.mota() << '\t' << score.m_idSwitches << std::endl;
+	}
 }
\ No newline at end of file
@@ -7,6 +7,9 @@
 #include <list>
 #include <chrono>
 #include <thread>
+#include <memory>
+#include <utility>
+#include <algorithm>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -14,6 +17,7 @@
 #include <opencv2/opencv.hpp>
 #include <opencv2/dnn/dnn.hpp>
 
+#ifdef TRACKER_WITH_TENSORRT
 #include <NvInfer.h>
 #include <NvInferRuntime.h>
 #include <NvInferRuntimeCommon.h>
@@ -21,49 +25,104 @@
 #include <cuda.h>
 #include <buffers.h>
 
+#include "EngineCache.h"
+#endif
+
+#include "Inference.h"
+#include "Decode.h"
+#include "Nms.h"
+#include "Association.h"
+#include "Motion.h"
+#include "Tiling.h"
+#include "../shared/Metrics.h"
+#include "../shared/SlotMap.h"
+#include "../shared/TrackEvents.h"
+
 
 const std::string VIDEO_PATH = "../test.avi";
 const char MODEL_PATH[] = "../GeneralNMHuman_v1.0GPU_onnx.onnx";
-const char ENGINE_PATH[] = "../Model.engine";
+//Каталог, где хранятся собранные движки, см. EngineCache.h
+const char ENGINE_DIR[] = "..";
 
 constexpr int UPDATE_RATE = 1;
 constexpr int ACTIVATION_FRAMES = 20;
 constexpr int LIVE_FRAMES = 80;
+//Сколько кадров без выхода сети живет еще не активированный трек
+constexpr int CANDIDATE_FRAMES = 5;
 
 
+//Без TensorRT (сборка без TRACKER_WITH_TENSORRT) сеть считается только на процессоре
+#ifdef TRACKER_WITH_TENSORRT
 class Logger : public nvinfer1::ILogger {
     void log(Severity severity, const char* msg) noexcept override;
 };
 
 
-/*Класс, который использую для работы с нейросетью*/
-class NNet {
+/*Класс, который использую для работы с нейросетью на видеокарте через TensorRT*/
+class NNet : public InferenceBackend {
+public:
+    /*Как прошла загрузка: нашелся ли готовый движок и сколько заняли этапы, мс*/
+    struct LoadReport {
+        std::string m_enginePath;
+        bool m_cacheHit = false;
+        double m_hashTime = 0;
+        double m_buildTime = 0;
+        double m_loadTime = 0;
+    };
+
 private:
+    //Порядок важен: runtime должен пережить движок, а logger - их всех
+    Logger m_logger;
+    std::unique_ptr<nvinfer1::IRuntime> m_runtime = nullptr;
     std::unique_ptr<nvinfer1::ICudaEngine> m_engine = nullptr;
     std::unique_ptr<nvinfer1::IExecutionContext> m_context = nullptr;
-    Logger m_logger;
+    std::string m_modelPath;
+    std::string m_cacheDir;
+    bool m_rebuild;
+    LoadReport m_report;
     samplesCommon::ManagedBuffer m_inputBuff;
     samplesCommon::ManagedBuffer m_outputBuff;
+    void* m_bindings[2] = { nullptr, nullptr };
+    bool m_pinned = false;
+    int m_maxBatch = 1;
+    //Размер батча, который сейчас задан контексту
+    int m_batch = 0;
+    //Количество выходов на один кадр и на один бокс
+    size_t m_outputSize = 0;
+    int m_outputRowSize = 0;
+
+    /*Загружает движок из файла, false если файла нет или он не подходит*/
+    bool deserialize(const std::string& enginePath);
 
 public:
-    NNet() {};
+    /*rebuild - собрать движок заново, даже если готовый уже есть*/
+    NNet(const std::string& modelPath = MODEL_PATH, const std::string& cacheDir = ENGINE_DIR,
+        const bool rebuild = false) : m_modelPath(modelPath), m_cacheDir(cacheDir), m_rebuild(rebuild) {};
 
-    /*Чистить нечего, поэтому пустой*/
-    ~NNet() {};
+    /*Снимает закрепление буферов, остальное почистится автоматически*/
+    ~NNet();
 
     /*Считывает из modelPath модель .onnx, создает из нее движок .engine
-и сохраняет его в файл*/
-    bool buildEngine(const char modelPath[]);
+и сохраняет его в файл enginePath*/
+    bool buildEngine(const std::string& modelPath, const std::string& enginePath);
+
+    /*Ищет движок для модели в каталоге кеша и, если его нет или он не загружается,
+собирает заново. Затем загружает его и выделяет буферы входа и выхода*/
+    bool load() override;
 
-    /*Загружает из файла движок*/
-    bool load();
+    const LoadReport& loadReport() const { return m_report; };
 
-    /*Смотрит на размеры входа и выхода, которые ожидает нейросеть.
-Задает их соответственно и выполняет инференс на видеокарте,
-записывает результат в одномерный вектор. Форматировать в более удобный
-формат буду позже*/
-    bool infer(const cv::Mat& img, std::vector<float>& features);
+    /*Выполняет инференс на видеокарте. Размеры и буферы уже заданы в load,
+поэтому здесь только копирование на gpu, инференс и копирование обратно*/
+    bool infer(const cv::Mat& img) override;
+    const float* outputs() const override { return static_cast<const float*>(m_outputBuff.hostBuffer.data()); };
+    size_t outputSize() const override { return m_outputSize; };
+    int outputRowSize() const override { return m_outputRowSize; };
+
+    const char* name() const override { return "tensorrt"; };
+    int maxBatch() const override { return m_maxBatch; };
 };
+#endif
 
 struct Track {
 
@@ -79,8 +138,6 @@ struct Track {
     bool m_activated = false;
     //Находится ли трек в кадре
     bool m_present = false;
-    //Считается ли трек исчезнувшим
-    bool m_expired = false;
     int m_id = 0;
 
 };
@@ -88,48 +145,150 @@ struct Track {
 class MyTracker
 {
 private:
-    //Можно было public наследование сделать, но мне кажется так логичней
-    NNet m_model;
+    //Можно было public наследование сделать, но мне кажется так логичней.
+    //Где считается сеть, выбирается при запуске, см. Inference.h
+    std::unique_ptr<InferenceBackend> m_model;
+
+    Preprocessor m_preprocessor;
 
-    //Векторы для обработки результатов инференса
-    std::vector<float> m_rawOutputs;
-    std::vector<cv::Rect> m_rects;
-    std::vector<float> m_scores;
+    //Раскладка тайлов и подготовка входа для них. Тайлы одного размера, поэтому у них
+    //свои таблицы интерполяции, отдельно от кадра целиком. Выходы тайла разбираются
+    //в m_tileDetections и переносятся в m_detections
+    TilePlanner m_tiles;
+    Preprocessor m_tilePreprocessor;
+    Detections m_tileDetections;
+    //Сколько изображений посчитала сеть на последнем detect
+    size_t m_images = 0;
+
+    //Выходы сети для текущего кадра, указывают прямо в буфер выхода m_model.
+    //Ниже отбор выходов и его результаты
+    const float* m_rawOutputs = nullptr;
+    OutputDecoder m_decoder;
+    Detections m_detections;
+    NmsEngine m_nms;
     std::vector<cv::Rect> m_outRects;
 
-    //Все существовавшие треки
-    std::vector<std::unique_ptr<Track>> m_tracks;
+    //Непропавшие треки, лежат подряд без указателей. Пропавшие удаляются в конце
+    //updateTracks, их место занимает последний трек, поэтому наибольший выданный id
+    //хранится отдельно
+    SlotMap<Track> m_tracks;
+    int m_largestId = 0;
+
+    //Сопоставление выходов с треками и боксы треков для него
+    TrackAssociation m_association;
+    std::vector<cv::Rect> m_trackBoxes;
+
+    //Фильтр Калмана трека m_tracks[i] - фильтр i в m_motion. Сколько кадров предсказано
+    //с прошлого updateTracks
+    MotionModel m_motion;
+    int m_sinceUpdate = 0;
+
+    //События треков с прошлого takeEvents и номер камеры для них, см. TrackEvents.h
+    std::vector<TrackEvent> m_events;
+    int m_camera = 0;
+
+    void addEvent(const TrackEventType type, const Track& track);
+
+    /*Сдвигает фильтры и боксы треков в кадре по предсказанию, без событий*/
+    void advance(const int elapsed);
+
+    /*Кадр целиком и выбранные тайлы батчами по maxBatch() модели, выходы в координатах кадра*/
+    void detectTiles(const cv::Mat& frame);
 
 public:
-    MyTracker() {};
+    MyTracker() : m_model(makeInferenceBackend(DEFAULT_BACKEND, 0)) {};
+    MyTracker(std::unique_ptr<InferenceBackend> model) : m_model(std::move(model)) {};
 
     /*Всё почистится автоматически, оставляю пустым деструктор*/
     ~MyTracker() {};
 
-    /*Обновляет время жизни треков и создает новые*/
+    /*Сопоставляет выходы сети с треками (см. Association.h), обновляет время жизни
+треков, создает новые из выходов, которые не пересекаются ни с какими треками,
+и удаляет пропавшие. Треки сопоставляются по боксам, предсказанным фильтрами Калмана.
+Время активации и жизни треков отсчитывается в кадрах, поэтому не зависит от того,
+как часто запускается сеть*/
     void updateTracks();
 
-    /*Вспомогательная функция для updateTracks.
-    Ищет индексы выходов, которые не пересекаются ни с какими треками.*/
-    std::vector<int> searchNew(const std::vector<cv::Rect>& outputs) const;
+    /*Сдвигает фильтры на elapsed кадров и боксы треков, которые сейчас в кадре, по
+предсказанию. На кадрах без инференса вызывается вместо process*/
+    void predict(const int elapsed = 1);
+
+    /*Забирает события, накопленные с прошлого вызова: start при активации, update на
+каждом кадре для треков в кадре, lost, когда трек не сопоставился с выходом сети,
+reidentified, когда потерянный трек снова сопоставился, и expired при удалении.
+Номер кадра и время проставляет вызывающий, см. stampEvents*/
+    void takeEvents(std::vector<TrackEvent>& events);
+
+    /*Номер камеры в событиях и замерах времени стадий*/
+    void setCamera(const int camera) { m_camera = camera; };
+    int camera() const { return m_camera; };
+
+    /*Наибольшая неопределенность положения среди треков в кадре, в долях высоты бокса.
+По ней можно решить, что пора снова запускать сеть*/
+    double uncertainty() const;
     bool drawTracks(cv::Mat& frame);
 
+    /*id и координаты активных треков. Снимок можно передать в другой поток
+и нарисовать там, см. Pipeline.h*/
+    std::vector<std::pair<int, cv::Rect>> visibleTracks() const;
+    static void drawTracks(cv::Mat& frame, const std::vector<std::pair<int, cv::Rect>>& tracks);
+
     double IOU(const cv::Rect& rect1, const cv::Rect& rect2) const;
 
-    /*Из сырого вектора выходов сети ищет те, которые проходят по порогу вероятности,
-записывает их в private члены. Еще делает ресайз координат под размеры видео, т.к.
-они изначально нормализованы*/
-    void processOutputs(const double thresh, const cv::Mat& frame);
+    /*Пороги вероятности по классам начиная с 1, см. OutputDecoder::setThresholds*/
+    void setThresholds(const std::vector<float>& thresholds) { m_decoder.setThresholds(thresholds); };
+
+    /*Как кадр вписывается во вход сети и пул для подготовки входа, см. Preprocessor.
+Боксы выходов переводятся в координаты кадра с учетом режима*/
+    void setPreprocessing(const ResizeMode mode, ThreadPool* pool = nullptr)
+    {
+        m_preprocessor.setMode(mode);
+        m_preprocessor.setPool(pool);
+        m_tilePreprocessor.setMode(mode);
+        m_tilePreprocessor.setPool(pool);
+    };
+
+    /*Деление кадра на тайлы для мелких объектов, см. Tiling.h. Тайлы кадра считаются
+одним инференсом, если модель принимает батчи, поэтому трекеру через InferenceBatcher
+нужен client на столько кадров*/
+    void setTiling(const TilingOptions& options) { m_tiles.setOptions(options); };
+    const TilingOptions& tiling() const { return m_tiles.options(); };
+
+    /*Выходы сети после nms и сколько изображений посчитала сеть на последнем process*/
+    const std::vector<cv::Rect>& detections() const { return m_outRects; };
+    size_t images() const { return m_images; };
+
+    /*Из сырого вектора выходов сети ищет те, которые проходят по порогам вероятности,
+записывает их в m_detections. Еще делает ресайз координат под размеры видео, т.к.
+они изначально нормализованы. Разметка выхода берется из размерностей выхода модели*/
+    void processOutputs(const cv::Mat& frame);
 
     /*Упрощенный вариант nms. Сначала отсеивает скопления боксов, где недостаточно
 "соседей". Если соседствующих боксов много, выделяет из них тот, у которого
-наибольший score. Добавляет такие боксы в private член*/
+наибольший score. Добавляет такие боксы в private член. thresh - IoU в процентах.
+Считается через NmsEngine, см. Nms.h*/
     void nms(double thresh, int neighbors);
 
-    void inferModel(cv::Mat& blob) { m_model.infer(blob, m_rawOutputs); };
-    void loadModel() { m_model.load(); };
-    void buildEngine(const char modelPath[]) { m_model.buildEngine(modelPath); };
+    void inferModel(const cv::Mat& blob) { m_rawOutputs = m_model->infer(blob) ? m_model->outputs() : nullptr; };
+    bool loadModel() { return m_model && m_model->load(); };
 
     //Чистит private члены, иначе будут скапливаться результаты инференсов
     void clearOutputs();
+
+    /*Подготовка входа, инференс, отбор выходов и nms без обновления треков. Результат
+в detections() до следующего вызова*/
+    void detect(const cv::Mat& frame);
+
+    /*Полный шаг анализа кадра: подготовка входа, инференс, отбор выходов,
+nms и обновление треков. elapsed - сколько кадров прошло с прошлого process или predict*/
+    void process(const cv::Mat& frame, const int elapsed = 1);
+
+    /*Шаг трекинга по готовым выходам вместо сети: сдвиг треков по предсказанию на elapsed
+кадров и updateTracks по detections. Для замеров и проверок без модели*/
+    void processDetections(const std::vector<cv::Rect>& detections, const int elapsed = 1);
 };
+
+/*Время updateTracks на кадр и точность треков (MOTA, смены id) для синтетических сцен
+с 10, 50 и 200 объектами. Выходы сети заменяют истинные боксы в случайном порядке,
+сдвинутые на несколько пикселей, и часть из них пропущена*/
+void benchUpdateTracks();
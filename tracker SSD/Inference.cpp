@@ -0,0 +1,234 @@
+#include "Inference.h"
+#include "Header.h"
+#include "../shared/Allocations.h"
+
+#include <algorithm>
+#include <cstring>
+
+void InferenceBackend::setInputBuffer(float* data, const int maxBatch)
+{
+	m_inputs.clear();
+	for (int batch = 1; batch <= maxBatch; ++batch)
+	{
+		const int sizes[] = { batch, INPUT_CHANNELS, INPUT_HEIGHT, INPUT_WIDTH };
+		m_inputs.emplace_back(4, sizes, CV_32F, data);
+	}
+}
+
+void InferenceBackend::stageInput(const cv::Mat& img)
+{
+	float* data = m_inputs[0].ptr<float>(0);
+	if (img.ptr<float>(0) != data)
+		std::memcpy(data, img.ptr<float>(0), img.total() * sizeof(float));
+}
+
+bool OpenCvNet::load()
+{
+	/*Число потоков в opencv общее на весь процесс, отрицательное значение
+	возвращает число по умолчанию, т.е. по количеству ядер*/
+	cv::setNumThreads(m_threads > 0 ? m_threads : -1);
+
+	try
+	{
+		m_net = cv::dnn::readNetFromONNX(m_modelPath);
+	}
+	catch (const cv::Exception& e)
+	{
+		std::cout << "failed to read " << m_modelPath << ": " << e.what() << std::endl;
+		return false;
+	}
+	if (m_net.empty())
+		return false;
+
+	m_net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+	m_net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+
+	m_input.assign(size_t(MAX_BATCH) * INPUT_SIZE, 0.f);
+	setInputBuffer(m_input.data(), MAX_BATCH);
+
+	/*Размер выхода узнаем пробным инференсом, чтобы он был известен сразу после load*/
+	m_maxBatch = 1;
+	try
+	{
+		if (!infer(input(1)))
+			return false;
+	}
+	catch (const cv::Exception& e)
+	{
+		std::cout << "failed to run " << m_modelPath << ": " << e.what() << std::endl;
+		return false;
+	}
+
+	/*dnn не сообщает размер батча, заданный в модели, поэтому проверяем его вторым
+	пробным инференсом: модель с батчем 1 на нем падает или дает выход не того размера.
+	Тогда батчер и тайлы посылают ей кадры по одному*/
+	const size_t outputSize = m_outputSize;
+	m_maxBatch = MAX_BATCH;
+	try
+	{
+		if (!infer(input(MAX_BATCH)) || m_output.total() != MAX_BATCH * outputSize)
+			m_maxBatch = 1;
+	}
+	catch (const cv::Exception&)
+	{
+		m_maxBatch = 1;
+	}
+	m_outputSize = outputSize;
+	return true;
+}
+
+bool OpenCvNet::infer(const cv::Mat& img)
+{
+	const int batch = img.size[0];
+	if (m_net.empty() || batch > m_maxBatch)
+		return false;
+
+	stageInput(img);
+	m_net.setInput(input(batch));
+
+	//Выход сети тот же, что у движка TensorRT. forward переиспользует m_output,
+	//если размер батча не поменялся
+	m_net.forward(m_output);
+	m_outputSize = m_output.total() / batch;
+	return true;
+}
+
+std::unique_ptr<InferenceBackend> makeInferenceBackend(const std::string& name, const int threads)
+{
+#ifdef TRACKER_WITH_TENSORRT
+	if (name == "tensorrt")
+		return std::make_unique<NNet>();
+#endif
+	if (name == "opencv")
+		return std::make_unique<OpenCvNet>(MODEL_PATH, threads);
+	return nullptr;
+}
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	/*Прогоняет все blobs через backend и печатает строку таблицы замера*/
+	void benchBackend(InferenceBackend& backend, const int threads, const std::vector<cv::Mat>& blobs)
+	{
+		/*Первые инференсы медленнее из-за выделения памяти, их не учитываем*/
+		for (size_t i = 0; i < std::min<size_t>(blobs.size(), 3); ++i)
+			backend.infer(blobs[i]);
+
+		std::vector<double> latencies;
+		auto start = Clock::now();
+		for (auto& blob : blobs)
+		{
+			auto begin = Clock::now();
+			backend.infer(blob);
+			latencies.push_back(std::chrono::duration<double, std::milli>(Clock::now() - begin).count());
+		}
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		std::sort(latencies.begin(), latencies.end());
+		double mean = 0;
+		for (auto latency : latencies)
+			mean += latency / latencies.size();
+
+		std::cout << backend.name() << '\t' << threads << '\t' << mean << '\t'
+			<< latencies[latencies.size() / 2] << '\t' << latencies[latencies.size() * 95 / 100] << '\t'
+			<< blobs.size() / seconds << std::endl;
+	}
+}
+
+void benchBackends(const std::string& path, const size_t frames)
+{
+	cv::VideoCapture video(path);
+	std::vector<cv::Mat> blobs;
+	cv::Mat frame;
+	Preprocessor preprocessor;
+	const int sizes[] = { 1, INPUT_CHANNELS, INPUT_HEIGHT, INPUT_WIDTH };
+	while (blobs.size() < frames && video.read(frame))
+	{
+		blobs.emplace_back(4, sizes, CV_32F);
+		preprocessor.run(frame, blobs.back().ptr<float>(0));
+	}
+
+	if (blobs.empty())
+	{
+		std::cout << "no frames in " << path << std::endl;
+		return;
+	}
+
+	std::cout << "frames: " << blobs.size() << '\n';
+	std::cout << "backend\tthreads\tmean latency, ms\tmedian, ms\tp95, ms\tthroughput, fps" << std::endl;
+
+	auto tensorRt = makeInferenceBackend("tensorrt", 0);
+	if (!tensorRt)
+		std::cout << "tensorrt\tnot built" << std::endl;
+	else if (tensorRt->load())
+		benchBackend(*tensorRt, 0, blobs);
+	else
+		std::cout << "tensorrt\tengine not available" << std::endl;
+
+	const int cpus = cv::getNumberOfCPUs();
+	std::vector<int> threadCounts;
+	for (int threads = 1; threads < cpus; threads *= 2)
+		threadCounts.push_back(threads);
+	threadCounts.push_back(cpus);
+
+	for (auto threads : threadCounts)
+	{
+		auto openCv = makeInferenceBackend("opencv", threads);
+		if (!openCv->load())
+			return;
+		benchBackend(*openCv, threads, blobs);
+	}
+
+	cv::setNumThreads(-1);
+}
+
+bool checkAllocations(const std::string& backend, const std::string& path, const size_t frames)
+{
+	if (!allocationCountingSupported())
+	{
+		std::cout << "allocations are not counted in this build or on this platform" << std::endl;
+		return false;
+	}
+
+	auto model = makeInferenceBackend(backend, 0);
+	if (!model || !model->load())
+	{
+		std::cout << "failed to load " << backend << " model" << std::endl;
+		return false;
+	}
+
+	cv::VideoCapture video(path);
+	std::vector<cv::Mat> images;
+	cv::Mat frame;
+	while (images.size() < frames && video.read(frame))
+		images.push_back(frame.clone());
+	if (images.empty())
+	{
+		std::cout << "no frames in " << path << std::endl;
+		return false;
+	}
+
+	/*Тот же путь, что в MyTracker::process, до разбора выходов*/
+	Preprocessor preprocessor;
+	cv::Mat& blob = model->input(1);
+	float checksum = 0;
+	auto step = [&](const cv::Mat& image) {
+		preprocessor.run(image, blob.ptr<float>(0));
+		if (model->infer(blob))
+			checksum += model->outputs()[5];
+	};
+
+	/*Первые кадры выделяют буферы, их не считаем*/
+	for (size_t i = 0; i < std::min<size_t>(images.size(), 3); ++i)
+		step(images[i]);
+
+	size_t before = allocationCount();
+	for (auto& image : images)
+		step(image);
+	size_t allocations = allocationCount() - before;
+
+	std::cout << backend << ": " << allocations << " allocations in " << images.size()
+		<< " frames (checksum " << checksum << ")" << std::endl;
+	return allocations == 0;
+}
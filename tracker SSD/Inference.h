@@ -0,0 +1,106 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/dnn/dnn.hpp>
+
+#include "Preprocess.h"
+
+/*Наибольшее количество кадров в одном инференсе, если модель это допускает*/
+constexpr int MAX_BATCH = 8;
+
+/*Способ по умолчанию: видеокарта, если трекер собран с TensorRT, иначе процессор*/
+#ifdef TRACKER_WITH_TENSORRT
+const char DEFAULT_BACKEND[] = "tensorrt";
+#else
+const char DEFAULT_BACKEND[] = "opencv";
+#endif
+
+/*Способ выполнить инференс сети. Трекеру все равно, где считается сеть: на видеокарте
+через TensorRT (NNet, см. Header.h) или на процессоре. Вход - blob NCHW Nx3x300x300,
+выход - сырые векторы выходов сети для каждого из N кадров подряд. Выход одного кадра
+разбирает MyTracker::processOutputs.
+Буферы входа и выхода выделяются в load под наибольший батч. Вход лучше готовить прямо
+в input(), а выход читать из outputs() без копирования, тогда infer не выделяет память*/
+class InferenceBackend
+{
+public:
+	virtual ~InferenceBackend() {};
+
+	/*Подготавливает сеть к инференсу, возвращает false при ошибке*/
+	virtual bool load() = 0;
+
+	/*img - либо input(N), либо любой другой blob Nx3x300x300, тогда он копируется во вход*/
+	virtual bool infer(const cv::Mat& img) = 0;
+
+	/*Выходы последнего infer, по outputSize() чисел на кадр подряд.
+	Указатель действителен до следующего infer*/
+	virtual const float* outputs() const = 0;
+	virtual size_t outputSize() const = 0;
+
+	/*Сколько чисел в выходе приходится на один бокс - последняя размерность выхода*/
+	virtual int outputRowSize() const = 0;
+
+	virtual const char* name() const = 0;
+
+	/*Сколько кадров можно передать в infer за раз. Известно после load*/
+	virtual int maxBatch() const { return 1; };
+
+	/*Входной тензор на batch кадров, кадр i начинается с input(batch).ptr<float>(i).
+	Возвращается ссылка на заранее созданный заголовок, т.к. создание и копирование
+	заголовка четырехмерного cv::Mat выделяет память*/
+	cv::Mat& input(const int batch) { return m_inputs[batch - 1]; };
+
+protected:
+	/*Создает заголовки input() для батчей от 1 до maxBatch поверх буфера data*/
+	void setInputBuffer(float* data, const int maxBatch);
+
+	/*Копирует img во входной буфер, если он подготовлен не в нем*/
+	void stageInput(const cv::Mat& img);
+
+private:
+	std::vector<cv::Mat> m_inputs;
+};
+
+/*Инференс модели .onnx на процессоре модулем dnn из opencv. Видеокарта не нужна,
+поэтому подходит для серверов без NVIDIA и для проверки логики трекинга*/
+class OpenCvNet : public InferenceBackend
+{
+public:
+	/*threads - сколько потоков opencv использует для инференса, 0 - по числу ядер*/
+	OpenCvNet(const std::string& modelPath, const int threads) : m_modelPath(modelPath), m_threads(threads) {};
+
+	bool load() override;
+	bool infer(const cv::Mat& img) override;
+	const float* outputs() const override { return m_output.ptr<float>(0); };
+	size_t outputSize() const override { return m_outputSize; };
+	int outputRowSize() const override { return m_output.size[m_output.dims - 1]; };
+	const char* name() const override { return "opencv"; };
+	int maxBatch() const override { return m_maxBatch; };
+
+private:
+	std::string m_modelPath;
+	int m_threads;
+	//MAX_BATCH, если модель принимает батчи, иначе 1. Проверяется в load
+	int m_maxBatch = 1;
+	cv::dnn::Net m_net;
+	std::vector<float> m_input;
+	cv::Mat m_output;
+	size_t m_outputSize = 0;
+};
+
+/*Возвращает способ по имени ("tensorrt" или "opencv"), либо nullptr если имя неизвестно
+или трекер собран без TensorRT. threads учитывается только для opencv*/
+std::unique_ptr<InferenceBackend> makeInferenceBackend(const std::string& name, const int threads);
+
+/*Замер задержки и пропускной способности инференса на кадрах из видео path
+для каждого способа, для opencv - с разным числом потоков*/
+void benchBackends(const std::string& path, const size_t frames);
+
+/*Считает выделения памяти за frames кадров установившегося режима: подготовка входа,
+инференс и чтение выхода. Возвращает false, если память выделялась или счетчика нет
+в этой сборке, см. shared/Allocations.h*/
+bool checkAllocations(const std::string& backend, const std::string& path, const size_t frames);
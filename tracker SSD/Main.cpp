@@ -1,61 +1,240 @@
 #include "Header.h"
+#include "Batching.h"
+#include "Pipeline.h"
+#include "../shared/ThreadPool.h"
 
-int main()
+#include <algorithm>
+#include <sstream>
+
+int main(int argc, char* argv[])
 {
 
-	MyTracker tracker;
+	std::vector<std::string> args(argv + 1, argv + argc);
 
-	std::cout << "Type Y to build an engine or N no use existing engine: ";
-	char ans;
-	std::cin >> ans;
+	/*--bench [замер] [видео] [способ]:
+	backends - задержка и пропускная способность инференса для каждого способа,
+	batch - выигрыш от батчей для нескольких камер, по умолчанию на процессоре,
+	alloc - проверка, что инференс в установившемся режиме не выделяет память,
+	startup - время запуска со сборкой движка и с готовым движком из кеша (только с TensorRT),
+	decode - отбор боксов из выхода сети при разных порогах,
+	nms - NMS на скоплениях боксов разного размера,
+	assign - сопоставление выходов с треками для 10, 100 и 1000 объектов,
+	sparse - fps и смены id при инференсе не на каждом кадре,
+	preprocess - подготовка входа сети против blobFromImage для кадров разного размера,
+	tiling - полнота и цена обнаружения для нескольких раскладок тайлов,
+	update - время updateTracks и точность треков для 10, 50 и 200 объектов без сети*/
+	if (!args.empty() && args[0] == "--bench")
+	{
+		std::string bench = args.size() > 1 ? args[1] : "backends";
+		std::string path = args.size() > 2 ? args[2] : VIDEO_PATH;
+		if (bench == "backends")
+			benchBackends(path, 200);
+		else if (bench == "batch")
+			benchBatching(args.size() > 3 ? args[3] : "opencv", path, 200);
+		else if (bench == "alloc")
+			return checkAllocations(args.size() > 3 ? args[3] : DEFAULT_BACKEND, path, 100) ? 0 : 1;
+#ifdef TRACKER_WITH_TENSORRT
+		else if (bench == "startup")
+			benchStartup(MODEL_PATH, ENGINE_DIR);
+#endif
+		else if (bench == "decode")
+			return benchDecode() ? 0 : 1;
+		else if (bench == "nms")
+			return benchNms() ? 0 : 1;
+		else if (bench == "assign")
+			return benchAssociation() ? 0 : 1;
+		else if (bench == "sparse")
+			benchSparseDetection(args.size() > 3 ? args[3] : DEFAULT_BACKEND, path, 300);
+		else if (bench == "preprocess")
+			return benchPreprocess(path) ? 0 : 1;
+		else if (bench == "tiling")
+			benchTiling(args.size() > 3 ? args[3] : DEFAULT_BACKEND, path, 100);
+		else if (bench == "update")
+			benchUpdateTracks();
+		else
+		{
+			std::cout << "unknown benchmark " << bench << std::endl;
+			return 1;
+		}
+		return 0;
+	}
 
-	if (ans == 'Y' || ans == 'y')
-		tracker.buildEngine(MODEL_PATH);
-	else if (ans == 'N' || ans == 'n') { }
-	else { throw; }
+	/*--test kalman: проверка фильтра Калмана треков, см. Motion.h*/
+	if (args.size() > 1 && args[0] == "--test" && args[1] == "kalman")
+		return testMotionModel() ? 0 : 1;
+	if (!args.empty() && args[0] == "--test")
+	{
+		std::cout << "unknown test " << (args.size() > 1 ? args[1] : "") << std::endl;
+		return 1;
+	}
 
-	tracker.loadModel();
+	/*--headless: пакетная обработка без окон и на полной скорости, треки пишутся в файл*/
+	PipelineOptions options;
+	bool headless = std::find(args.begin(), args.end(), "--headless") != args.end();
+	if (headless)
+		options = PipelineOptions::headless("tracks.csv");
 
-	cv::VideoCapture video(VIDEO_PATH);
-	cv::Mat frame;
+	/*Остальные аргументы - где считать сеть, настройки батчей и очередей между стадиями
+	конвейера и пути к видео, по камере на каждое. Вместо видео можно передать картинки,
+	файл Y4M или "-", см. FrameSource.h*/
+	std::vector<std::string> paths;
+	std::string backend = DEFAULT_BACKEND;
+	int threads = 0;
+	int maxBatch = MAX_BATCH;
+	int maxWait = 2;
+	bool rebuild = false;
+	ResizeMode resizeMode = ResizeMode::Stretch;
+	int preprocessThreads = 1;
+	TilingOptions tiling;
+	std::vector<float> thresholds;
+	std::string metricsPath;
+	MetricsFormat metricsFormat = MetricsFormat::Text;
+	for (size_t i = 0; i < args.size(); ++i)
+	{
+		if (args[i] == "--headless")
+			continue;
+		else if (args[i] == "--metrics" && i + 1 < args.size())
+			metricsPath = args[++i];
+		else if (args[i] == "--metrics-format" && i + 1 < args.size())
+		{
+			std::string format = args[++i];
+			if (format != "text" && format != "json")
+			{
+				std::cout << "unknown metrics format " << format << std::endl;
+				return 1;
+			}
+			metricsFormat = format == "json" ? MetricsFormat::Json : MetricsFormat::Text;
+		}
+		else if (args[i] == "--rebuild")
+			rebuild = true;
+		else if (args[i] == "--backend" && i + 1 < args.size())
+			backend = args[++i];
+		else if (args[i] == "--threads" && i + 1 < args.size())
+			threads = std::stoi(args[++i]);
+		else if (args[i] == "--batch" && i + 1 < args.size())
+			maxBatch = std::stoi(args[++i]);
+		else if (args[i] == "--batch-wait" && i + 1 < args.size())
+			maxWait = std::stoi(args[++i]);
+		else if (args[i] == "--tracks" && i + 1 < args.size())
+			options.m_tracksPath = args[++i];
+		else if (args[i] == "--events" && i + 1 < args.size())
+			options.m_eventsPath = args[++i];
+		else if (args[i] == "--events-format" && i + 1 < args.size())
+		{
+			std::string format = args[++i];
+			if (format != "json" && format != "binary")
+			{
+				std::cout << "unknown events format " << format << std::endl;
+				return 1;
+			}
+			options.m_eventFormat = format == "binary" ? EventFormat::Binary : EventFormat::Lines;
+		}
+		else if (args[i] == "--block")
+			options.m_policy = QueuePolicy::Block;
+		else if (args[i] == "--drop")
+			options.m_policy = QueuePolicy::DropOldest;
+		else if (args[i] == "--queue" && i + 1 < args.size())
+			options.m_queueSize = std::stoul(args[++i]);
+		else if (args[i] == "--decode-threads" && i + 1 < args.size())
+			options.m_source.m_threads = std::stoi(args[++i]);
+		else if (args[i] == "--hw-decode")
+			options.m_source.m_hardware = true;
+		else if (args[i] == "--letterbox")
+			resizeMode = ResizeMode::Letterbox;
+		else if (args[i] == "--preprocess-threads" && i + 1 < args.size())
+			preprocessThreads = std::stoi(args[++i]);
+		else if (args[i] == "--tiles" && i + 1 < args.size())
+		{
+			//Сетка тайлов в виде 3x2
+			char separator = 0;
+			std::stringstream grid(args[++i]);
+			grid >> tiling.m_columns >> separator >> tiling.m_rows;
+			if (!grid || separator != 'x' || !tiling.enabled())
+			{
+				std::cout << "bad tile grid " << args[i] << std::endl;
+				return 1;
+			}
+		}
+		else if (args[i] == "--tile-overlap" && i + 1 < args.size())
+			tiling.m_overlap = std::stof(args[++i]);
+		else if (args[i] == "--tile-focus")
+			tiling.m_focus = true;
+		else if (args[i] == "--detect-every" && i + 1 < args.size())
+			options.m_detectEvery = std::stoi(args[++i]);
+		else if (args[i] == "--max-uncertainty" && i + 1 < args.size())
+			options.m_maxUncertainty = std::stod(args[++i]);
+		else if (args[i] == "--thresholds" && i + 1 < args.size())
+		{
+			//Пороги классов через запятую, начиная с класса 1
+			std::stringstream list(args[++i]);
+			for (std::string value; std::getline(list, value, ',');)
+				thresholds.push_back(std::stof(value));
+		}
+		else
+			paths.push_back(args[i]);
+	}
+	if (paths.empty())
+		paths.push_back(VIDEO_PATH);
 
-	using FPS = std::chrono::duration<uint64_t, std::ratio<1, 30>>;
+	/*Движок TensorRT собирается сам, если для этой модели и видеокарты его еще нет,
+	см. EngineCache.h. --rebuild собирает его заново в любом случае*/
+#ifdef TRACKER_WITH_TENSORRT
+	auto model = backend == "tensorrt" && rebuild ? std::make_unique<NNet>(MODEL_PATH, ENGINE_DIR, true) :
+		makeInferenceBackend(backend, threads);
+#else
+	if (rebuild)
+		std::cout << "--rebuild is ignored without TensorRT" << std::endl;
+	auto model = makeInferenceBackend(backend, threads);
+#endif
+	if (!model)
+	{
+		std::cout << "unknown backend " << backend << std::endl;
+		return 1;
+	}
 
-	auto start = std::chrono::system_clock::now();
-	while (video.read(frame)) 
+	/*Кадры всех камер считаются общими батчами, у каждой камеры свои треки*/
+	InferenceBatcher batcher(std::move(model), maxBatch, std::chrono::milliseconds(maxWait));
+	if (!batcher.load())
 	{
-		auto curTime = std::chrono::system_clock::now();
-		auto elapsed = std::chrono::duration_cast<FPS> (curTime - start);
-		/*Если не прошло UPDATE_RATE кадров (точнее времени для стольких кадров),
-		просто рисую треки*/
-		if (elapsed % FPS(UPDATE_RATE) >= FPS(1))
-		{
-			tracker.drawTracks(frame);
-			cv::waitKey(1);
-			cv::imshow("1", frame);
+		std::cout << "failed to load " << backend << " model" << std::endl;
+		return 1;
+	}
 
-			std::this_thread::sleep_for(FPS(1));
-			continue;
-		}
+	/*--letterbox: кадр вписывается во вход сети с сохранением пропорций, иначе растягивается.
+	--preprocess-threads N: строки входа сети делятся между потоком камеры и N - 1 потоками
+	общего для камер пула, 0 - пул по числу ядер, 1 - без пула*/
+	std::unique_ptr<ThreadPool> preprocessPool;
+	if (preprocessThreads != 1)
+		preprocessPool = std::make_unique<ThreadPool>(size_t(preprocessThreads > 1 ? preprocessThreads - 1 : 0));
 
-		auto curTimeInfer = std::chrono::system_clock::now();
-		/*Транформирую кадр в подходящий для нейросети формат. То есть NCHW размерность,
-		размер 300x300, средние по каналам (123, 117, 104) и свап B,R каналов, т.к.
-		opencv считывает BGR*/
-		cv::Mat blob = cv::dnn::blobFromImage(frame, 1.0, { 300, 300 }, { 123.0, 117.0, 104.0 }, true);
-		
-		tracker.inferModel(blob);
-		tracker.processOutputs(0.2, frame);
-		tracker.nms(50, 1);
-
-		tracker.updateTracks();
-
-		tracker.drawTracks(frame);
-		tracker.clearOutputs();
-		cv::waitKey(1);
-		cv::imshow("1", frame);
-		auto elapsedInfer = std::chrono::duration_cast<std::chrono::milliseconds>(
-			std::chrono::system_clock::now() - curTime);
-		std::this_thread::sleep_for(FPS(1) - elapsedInfer);
+	/*--tiles CxR: кадр делится на C x R перекрывающихся тайлов, которые считаются вместе
+	с кадром целиком одним инференсом, --tile-overlap F - перекрытие в долях тайла,
+	--tile-focus - только тайлы около треков и движения, см. Tiling.h*/
+	const int tileFrames = tiling.enabled() ? tiling.m_columns * tiling.m_rows + 1 : 1;
+
+	std::vector<std::unique_ptr<MyTracker>> trackers;
+	for (size_t i = 0; i < paths.size(); ++i)
+	{
+		trackers.emplace_back(std::make_unique<MyTracker>(batcher.client(tileFrames)));
+		trackers.back()->setPreprocessing(resizeMode, preprocessPool.get());
+		trackers.back()->setTiling(tiling);
+		if (!thresholds.empty())
+			trackers.back()->setThresholds(thresholds);
+	}
+
+	/*--metrics FILE: замеры времени стадий по камерам, в конце пишутся в FILE ("-" - на экран)*/
+	Metrics::setEnabled(!metricsPath.empty());
+
+	auto stats = runPipeline(trackers, paths, options);
+	printStats(stats);
+	std::cout << "inferences: " << batcher.batches() << ", frames per inference: "
+		<< (batcher.batches() > 0 ? double(batcher.frames()) / batcher.batches() : 0) << std::endl;
+
+	if (metricsPath == "-")
+		Metrics::write(std::cout, metricsFormat);
+	else if (!metricsPath.empty())
+	{
+		std::ofstream metricsFile(metricsPath);
+		Metrics::write(metricsFile, metricsFormat);
 	}
 }
@@ -0,0 +1,205 @@
+#include "Motion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+
+namespace
+{
+	/*Стандартные отклонения в долях высоты бокса: шум выхода сети и положения за кадр,
+	шум скорости за кадр и начальная неопределенность скорости*/
+	constexpr float POSITION_STD = 1.f / 20;
+	constexpr float VELOCITY_STD = 1.f / 160;
+	constexpr float INITIAL_VELOCITY_STD = 10.f / 160;
+
+	inline float square(const float value) { return value * value; }
+
+	/*Шаг предсказания фильтра из положения p и скорости v с ковариацией (ppp ppv; ppv pvv)*/
+	inline void predictAxis(float& p, const float v, float& ppp, float& ppv, float& pvv, const float dt,
+		const float qp, const float qv)
+	{
+		p += v * dt;
+		ppp += dt * (2 * ppv + dt * pvv) + qp;
+		ppv += dt * pvv;
+		pvv += qv;
+	}
+
+	/*Коррекция по измерению положения z с дисперсией r*/
+	inline void updateAxis(float& p, float& v, float& ppp, float& ppv, float& pvv, const float z, const float r)
+	{
+		const float s = ppp + r;
+		const float k0 = ppp / s, k1 = ppv / s;
+		const float residual = z - p;
+		p += k0 * residual;
+		v += k1 * residual;
+		pvv -= k1 * ppv;
+		ppv -= k0 * ppv;
+		ppp -= k0 * ppp;
+	}
+
+	/*То же для величины без скорости*/
+	inline void updateValue(float& x, float& pxx, const float z, const float r)
+	{
+		const float k = pxx / (pxx + r);
+		x += k * (z - x);
+		pxx -= k * pxx;
+	}
+}
+
+void MotionModel::add(const cv::Rect& box)
+{
+	const float h = float(std::max(box.height, 1));
+	const float r = square(POSITION_STD * h), rv = square(INITIAL_VELOCITY_STD * h);
+
+	m_cx.push_back(box.x + box.width / 2.f);
+	m_vx.push_back(0);
+	m_pxx.push_back(r);
+	m_pxv.push_back(0);
+	m_pvvx.push_back(rv);
+
+	m_cy.push_back(box.y + box.height / 2.f);
+	m_vy.push_back(0);
+	m_pyy.push_back(r);
+	m_pyv.push_back(0);
+	m_pvvy.push_back(rv);
+
+	m_w.push_back(float(box.width));
+	m_pw.push_back(r);
+	m_h.push_back(float(box.height));
+	m_ph.push_back(r);
+}
+
+void MotionModel::move(const size_t from, const size_t to)
+{
+	if (from == to)
+		return;
+	for (auto array : { &m_cx, &m_vx, &m_pxx, &m_pxv, &m_pvvx, &m_cy, &m_vy, &m_pyy, &m_pyv, &m_pvvy,
+		&m_w, &m_pw, &m_h, &m_ph })
+		(*array)[to] = (*array)[from];
+}
+
+void MotionModel::resize(const size_t count)
+{
+	for (auto array : { &m_cx, &m_vx, &m_pxx, &m_pxv, &m_pvvx, &m_cy, &m_vy, &m_pyy, &m_pyv, &m_pvvy,
+		&m_w, &m_pw, &m_h, &m_ph })
+		array->resize(count);
+}
+
+void MotionModel::predict(const int elapsed)
+{
+	const float dt = float(elapsed);
+	const size_t count = size();
+
+	//Шум за elapsed кадров складывается из шумов отдельных кадров
+	for (size_t i = 0; i < count; ++i)
+	{
+		const float h = std::max(m_h[i], 1.f);
+		const float qp = dt * square(POSITION_STD * h), qv = dt * square(VELOCITY_STD * h);
+		predictAxis(m_cx[i], m_vx[i], m_pxx[i], m_pxv[i], m_pvvx[i], dt, qp, qv);
+		predictAxis(m_cy[i], m_vy[i], m_pyy[i], m_pyv[i], m_pvvy[i], dt, qp, qv);
+		m_pw[i] += qp;
+		m_ph[i] += qp;
+	}
+}
+
+void MotionModel::update(const size_t i, const cv::Rect& box)
+{
+	const float r = square(POSITION_STD * std::max(m_h[i], 1.f));
+	updateAxis(m_cx[i], m_vx[i], m_pxx[i], m_pxv[i], m_pvvx[i], box.x + box.width / 2.f, r);
+	updateAxis(m_cy[i], m_vy[i], m_pyy[i], m_pyv[i], m_pvvy[i], box.y + box.height / 2.f, r);
+	updateValue(m_w[i], m_pw[i], float(box.width), r);
+	updateValue(m_h[i], m_ph[i], float(box.height), r);
+}
+
+cv::Rect MotionModel::box(const size_t i) const
+{
+	const int w = std::max(cvRound(m_w[i]), 0), h = std::max(cvRound(m_h[i]), 0);
+	return cv::Rect(cvRound(m_cx[i] - w / 2.f), cvRound(m_cy[i] - h / 2.f), w, h);
+}
+
+double MotionModel::uncertainty(const size_t i) const
+{
+	return std::sqrt(m_pxx[i] + m_pyy[i]) / std::max(m_h[i], 1.f);
+}
+
+bool testMotionModel()
+{
+	int failed = 0;
+	auto check = [&](const bool passed, const std::string& what) {
+		std::cout << "kalman: " << what << (passed ? " - ok" : " - FAILED") << std::endl;
+		failed += !passed;
+	};
+	auto near = [](const cv::Rect& box1, const cv::Rect& box2, const int tolerance) {
+		return std::abs(box1.x - box2.x) <= tolerance && std::abs(box1.y - box2.y) <= tolerance &&
+			std::abs(box1.width - box2.width) <= tolerance && std::abs(box1.height - box2.height) <= tolerance;
+	};
+	auto moving = [](const int frame) { return cv::Rect(100 + 5 * frame, 300 - 2 * frame, 40, 100); };
+
+	{
+		MotionModel model;
+		model.add(cv::Rect(200, 100, 40, 100));
+		for (int frame = 0; frame < 30; ++frame)
+		{
+			model.predict(1);
+			model.update(0, cv::Rect(200, 100, 40, 100));
+		}
+		check(model.box(0) == cv::Rect(200, 100, 40, 100), "a box that does not move stays in place");
+	}
+	{
+		/*Скорость выучивается по выходам сети, дальше боксы предсказываются без них*/
+		MotionModel model;
+		model.add(moving(0));
+		for (int frame = 1; frame <= 60; ++frame)
+		{
+			model.predict(1);
+			model.update(0, moving(frame));
+		}
+		check(near(model.box(0), moving(60), 1), "the filter follows a box moving with constant velocity");
+
+		const double certain = model.uncertainty(0);
+		bool growing = true;
+		double last = certain;
+		for (int frame = 61; frame <= 70; ++frame)
+		{
+			model.predict(1);
+			growing = growing && model.uncertainty(0) > last;
+			last = model.uncertainty(0);
+		}
+		check(near(model.box(0), moving(70), 2), "10 frames without detections are predicted from the velocity");
+		check(growing, "uncertainty grows with every frame without detections");
+		model.update(0, moving(70));
+		check(model.uncertainty(0) < last, "a detection reduces uncertainty");
+	}
+	{
+		/*Инференс раз в 4 кадра: predict(4) сдвигает так же, как четыре predict(1)*/
+		MotionModel sparse, dense;
+		sparse.add(moving(0));
+		dense.add(moving(0));
+		for (int frame = 4; frame <= 80; frame += 4)
+		{
+			sparse.predict(4);
+			for (int i = 0; i < 4; ++i)
+				dense.predict(1);
+			sparse.update(0, moving(frame));
+			dense.update(0, moving(frame));
+		}
+		sparse.predict(4);
+		for (int i = 0; i < 4; ++i)
+			dense.predict(1);
+		check(near(sparse.box(0), moving(84), 2) && near(sparse.box(0), dense.box(0), 1),
+			"predict(4) moves boxes like four predict(1) when detections come every 4 frames");
+	}
+	{
+		/*Удаление трека из середины: последний фильтр переезжает на его место*/
+		MotionModel model;
+		model.add(cv::Rect(0, 0, 10, 20));
+		model.add(cv::Rect(100, 100, 30, 60));
+		model.add(cv::Rect(500, 50, 20, 40));
+		model.move(2, 0);
+		model.resize(2);
+		check(model.size() == 2 && model.box(0) == cv::Rect(500, 50, 20, 40) && model.box(1) == cv::Rect(100, 100, 30, 60),
+			"move and resize keep the remaining filters");
+	}
+	return failed == 0;
+}
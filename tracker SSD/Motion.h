@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+/*Фильтры Калмана с постоянной скоростью для всех треков одной камеры. Центр бокса
+по x и по y - независимые фильтры из положения и скорости, ширина и высота -
+случайное блуждание. Шумы пропорциональны высоте бокса, как в DeepSORT.
+Состояния хранятся структурой массивов, фильтр i соответствует треку i, поэтому
+предсказание для всех треков - несколько коротких циклов по непрерывным массивам*/
+class MotionModel
+{
+public:
+	size_t size() const { return m_cx.size(); };
+
+	/*Новый фильтр в конце с нулевой скоростью*/
+	void add(const cv::Rect& box);
+
+	/*Переносит фильтр from на место to и уменьшает количество фильтров до count,
+	вместе с удалением треков из вектора*/
+	void move(const size_t from, const size_t to);
+	void resize(const size_t count);
+
+	/*Сдвигает все фильтры на elapsed кадров вперед*/
+	void predict(const int elapsed);
+
+	/*Учитывает выход сети box для фильтра i*/
+	void update(const size_t i, const cv::Rect& box);
+
+	cv::Rect box(const size_t i) const;
+
+	/*Неопределенность положения центра относительно высоты бокса, растет с каждым
+	кадром без выхода сети*/
+	double uncertainty(const size_t i) const;
+
+private:
+	//Центр и скорость по x и по y и их ковариации
+	std::vector<float> m_cx, m_vx, m_pxx, m_pxv, m_pvvx;
+	std::vector<float> m_cy, m_vy, m_pyy, m_pyv, m_pvvy;
+	//Размеры и их дисперсии
+	std::vector<float> m_w, m_pw;
+	std::vector<float> m_h, m_ph;
+};
+
+/*Проверка поведения фильтров: неподвижный бокс, постоянная скорость, предсказание
+без выходов сети, рост и уменьшение неопределенности, инференс не на каждом кадре,
+move и resize. false, если хоть одна проверка не прошла*/
+bool testMotionModel();
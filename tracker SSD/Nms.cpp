@@ -0,0 +1,338 @@
+#include "Nms.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <random>
+
+#include <opencv2/core/hal/intrin.hpp>
+
+namespace
+{
+	/*Ошибка IoU во float намного меньше, боксы ближе к порогу проверяются точно*/
+	constexpr float IOU_MARGIN = 1e-3f;
+
+	/*Прежний MyTracker::nms на std::multimap*/
+	void legacyNms(const std::vector<cv::Rect>& rects, const std::vector<float>& scores, const double thresh,
+		const int neighbors, std::vector<cv::Rect>& outRects)
+	{
+		outRects.clear();
+
+		std::multimap<float, size_t> sorted;
+		for (size_t i = 0; i < scores.size(); ++i)
+			sorted.emplace(scores[i], i);
+
+		while (sorted.size() > 0) {
+
+			auto highest = --std::end(sorted);
+			const cv::Rect& rect1 = rects[highest->second];
+
+			int neighborsCount = 0;
+
+			sorted.erase(highest);
+
+			for (auto iter = std::begin(sorted); iter != std::end(sorted);) {
+
+				if (percentIou(rect1, rects[iter->second]) > thresh) {
+					iter = sorted.erase(iter);
+					++neighborsCount;
+				}
+				else {
+					++iter;
+				}
+
+			}
+
+			if (neighborsCount >= neighbors)
+				outRects.push_back(rect1);
+
+		}
+	}
+
+	double microsecondsSince(const std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+double percentIou(const cv::Rect& rect1, const cv::Rect& rect2)
+{
+	if (rect1.area() != 0 && rect2.area() != 0)
+	{
+		double intArea = (rect1 & rect2).area();
+		double totalArea = rect1.area() + rect2.area() - intArea;
+		return (intArea / totalArea) * 100;
+	}
+	else
+		return 0;
+}
+
+const std::vector<int>& NmsEngine::run(const Detections& detections)
+{
+	m_kept.clear();
+	m_keptScores.clear();
+	m_kept.reserve(detections.size());
+	m_keptScores.reserve(detections.size());
+
+	sort(detections);
+	if (m_options.m_method == NmsMethod::Hard)
+		runHard(detections);
+	else
+		runSoft();
+	return m_kept;
+}
+
+void NmsEngine::sort(const Detections& detections)
+{
+	const size_t count = detections.size();
+	m_order.resize(count);
+	std::iota(m_order.begin(), m_order.end(), 0);
+
+	//Тот же порядок, в котором боксы выходят из std::multimap с конца
+	const std::vector<float>& scores = detections.m_scores;
+	std::sort(m_order.begin(), m_order.end(), [&scores](const int a, const int b) {
+		return scores[a] > scores[b] || (scores[a] == scores[b] && a > b);
+	});
+
+	m_left.resize(count);
+	m_top.resize(count);
+	m_right.resize(count);
+	m_bottom.resize(count);
+	m_areas.resize(count);
+	m_classes.resize(count);
+	m_scores.resize(count);
+	m_ious.resize(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const int index = m_order[i];
+		m_left[i] = float(detections.m_left[index]);
+		m_top[i] = float(detections.m_top[index]);
+		m_right[i] = float(detections.m_right[index]);
+		m_bottom[i] = float(detections.m_bottom[index]);
+		m_areas[i] = (m_right[i] - m_left[i]) * (m_bottom[i] - m_top[i]);
+		m_classes[i] = float(detections.m_classes[index]);
+		m_scores[i] = scores[index];
+	}
+}
+
+void NmsEngine::computeIous(const size_t best, const size_t begin, const size_t end)
+{
+	const float left = m_left[best], top = m_top[best], right = m_right[best], bottom = m_bottom[best];
+	const float area = m_areas[best];
+	size_t i = begin;
+
+#if CV_SIMD
+	const int lanes = cv::v_float32::nlanes;
+	const cv::v_float32 vLeft = cv::vx_setall_f32(left), vTop = cv::vx_setall_f32(top);
+	const cv::v_float32 vRight = cv::vx_setall_f32(right), vBottom = cv::vx_setall_f32(bottom);
+	const cv::v_float32 vArea = cv::vx_setall_f32(area);
+	const cv::v_float32 zero = cv::vx_setzero_f32(), one = cv::vx_setall_f32(1.f), hundred = cv::vx_setall_f32(100.f);
+	for (; i + lanes <= end; i += lanes)
+	{
+		cv::v_float32 width = cv::v_max(cv::v_min(vRight, cv::vx_load(&m_right[i])) -
+			cv::v_max(vLeft, cv::vx_load(&m_left[i])), zero);
+		cv::v_float32 height = cv::v_max(cv::v_min(vBottom, cv::vx_load(&m_bottom[i])) -
+			cv::v_max(vTop, cv::vx_load(&m_top[i])), zero);
+		cv::v_float32 intersection = width * height;
+		//У пустого бокса пересечение 0, единица только убирает деление на 0
+		cv::v_float32 total = cv::v_max(vArea + cv::vx_load(&m_areas[i]) - intersection, one);
+		cv::v_store(&m_ious[i], intersection * hundred / total);
+	}
+#endif
+
+	for (; i < end; ++i)
+	{
+		float width = std::max(std::min(right, m_right[i]) - std::max(left, m_left[i]), 0.f);
+		float height = std::max(std::min(bottom, m_bottom[i]) - std::max(top, m_top[i]), 0.f);
+		float intersection = width * height;
+		float total = std::max(area + m_areas[i] - intersection, 1.f);
+		m_ious[i] = intersection * 100.f / total;
+	}
+}
+
+bool NmsEngine::sameClass(const size_t best, const size_t other) const
+{
+	return !m_options.m_classAware || m_classes[best] == m_classes[other];
+}
+
+bool NmsEngine::exceeds(const Detections& detections, const size_t best, const size_t other, const float iou) const
+{
+	const float thresh = float(m_options.m_iouThreshold);
+	if (iou > thresh + IOU_MARGIN)
+		return true;
+	if (iou < thresh - IOU_MARGIN)
+		return false;
+	return percentIou(detections.rect(m_order[best]), detections.rect(m_order[other])) > m_options.m_iouThreshold;
+}
+
+void NmsEngine::move(const size_t from, const size_t to)
+{
+	if (from == to)
+		return;
+	m_order[to] = m_order[from];
+	m_left[to] = m_left[from];
+	m_top[to] = m_top[from];
+	m_right[to] = m_right[from];
+	m_bottom[to] = m_bottom[from];
+	m_areas[to] = m_areas[from];
+	m_classes[to] = m_classes[from];
+	m_scores[to] = m_scores[from];
+}
+
+void NmsEngine::runHard(const Detections& detections)
+{
+	size_t count = m_order.size();
+	for (size_t best = 0; best < count; ++best)
+	{
+		computeIous(best, best + 1, count);
+
+		//Подавленные боксы выбрасываются, остальные сдвигаются на их место
+		int neighbors = 0;
+		size_t remaining = best + 1;
+		for (size_t i = best + 1; i < count; ++i)
+		{
+			if (sameClass(best, i) && exceeds(detections, best, i, m_ious[i]))
+				++neighbors;
+			else
+				move(i, remaining++);
+		}
+		count = remaining;
+
+		if (neighbors >= m_options.m_minNeighbors)
+		{
+			m_kept.push_back(m_order[best]);
+			m_keptScores.push_back(m_scores[best]);
+			if (m_kept.size() == m_options.m_topK)
+				return;
+		}
+	}
+}
+
+void NmsEngine::runSoft()
+{
+	size_t count = m_order.size();
+	while (count > 0)
+	{
+		//Score меняются, поэтому лучший ищется заново. При равных - первый по исходному порядку
+		size_t best = 0;
+		for (size_t i = 1; i < count; ++i)
+		{
+			if (m_scores[i] > m_scores[best])
+				best = i;
+		}
+		if (m_scores[best] < m_options.m_scoreThreshold)
+			return;
+
+		m_kept.push_back(m_order[best]);
+		m_keptScores.push_back(m_scores[best]);
+		if (m_kept.size() == m_options.m_topK)
+			return;
+
+		computeIous(best, 0, count);
+
+		//Сдвиг оставшихся может затереть лучший бокс, поэтому его класс запоминаем
+		const float bestClass = m_classes[best];
+		size_t remaining = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (i == best)
+				continue;
+			if (!m_options.m_classAware || m_classes[i] == bestClass)
+			{
+				const float iou = m_ious[i] / 100;
+				if (m_options.m_method == NmsMethod::SoftGaussian)
+					m_scores[i] *= std::exp(-iou * iou / m_options.m_sigma);
+				else if (m_ious[i] > m_options.m_iouThreshold)
+					m_scores[i] *= 1 - iou;
+			}
+			if (m_scores[i] >= m_options.m_scoreThreshold)
+				move(i, remaining++);
+		}
+		count = remaining;
+	}
+}
+
+bool benchNms()
+{
+	/*Синтетические скопления: вокруг каждого человека по 20 боксов со сдвигом и
+	другим размером, как у SSD на соседних анкерах*/
+	const cv::Size frameSize(1280, 720);
+	std::mt19937 random(11);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+
+	bool allSame = true;
+	std::cout << "boxes\tkept\tlegacy, us\tnms, us\ttop 10, us\tsoft-nms, us\tsame result" << std::endl;
+	for (size_t size : { 100, 500, 1000, 2000, 5000 })
+	{
+		Detections detections;
+		detections.reserve(size);
+		std::vector<cv::Rect> rects;
+		std::vector<float> scores;
+		int x = 0, y = 0;
+		for (size_t i = 0; i < size; ++i)
+		{
+			if (i % 20 == 0)
+			{
+				x = int(uniform(random) * (frameSize.width - 100));
+				y = int(uniform(random) * (frameSize.height - 200));
+			}
+			int left = x + int(uniform(random) * 20), top = y + int(uniform(random) * 20);
+			int right = left + 60 + int(uniform(random) * 30), bottom = top + 150 + int(uniform(random) * 40);
+			float score = 0.2f + 0.8f * uniform(random);
+
+			size_t k = detections.m_count++;
+			detections.m_left[k] = left;
+			detections.m_top[k] = top;
+			detections.m_right[k] = right;
+			detections.m_bottom[k] = bottom;
+			detections.m_scores[k] = score;
+			detections.m_classes[k] = 1;
+			rects.push_back(detections.rect(k));
+			scores.push_back(score);
+		}
+
+		const int repeats = int(std::max<size_t>(1, 20000 / size));
+		std::vector<cv::Rect> legacy;
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeats; ++r)
+			legacyNms(rects, scores, 50, 1, legacy);
+		double legacyTime = microsecondsSince(start) / repeats;
+
+		NmsEngine engine;
+		NmsOptions options;
+		options.m_minNeighbors = 1;
+		engine.setOptions(options);
+		start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeats; ++r)
+			engine.run(detections);
+		double nmsTime = microsecondsSince(start) / repeats;
+
+		std::vector<int> kept = engine.run(detections);
+		bool same = kept.size() == legacy.size();
+		for (size_t i = 0; same && i < kept.size(); ++i)
+			same = detections.rect(kept[i]) == legacy[i];
+		allSame = allSame && same;
+
+		options.m_topK = 10;
+		engine.setOptions(options);
+		start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeats; ++r)
+			engine.run(detections);
+		double topTime = microsecondsSince(start) / repeats;
+
+		options = NmsOptions();
+		options.m_method = NmsMethod::SoftGaussian;
+		engine.setOptions(options);
+		start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeats; ++r)
+			engine.run(detections);
+		double softTime = microsecondsSince(start) / repeats;
+
+		std::cout << size << '\t' << legacy.size() << '\t' << legacyTime << '\t' << nmsTime << '\t' << topTime << '\t'
+			<< softTime << '\t' << (same ? "yes" : "no") << std::endl;
+	}
+	return allSame;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "Decode.h"
+
+enum class NmsMethod
+{
+	//Бокс, пересекающийся с лучшим сильнее порога, удаляется
+	Hard,
+	//Soft-NMS: score пересекающихся боксов уменьшается, а не обнуляется.
+	//Линейно - умножается на 1 - IoU, если IoU больше порога
+	SoftLinear,
+	//Умножается на exp(-IoU^2 / sigma) при любом пересечении
+	SoftGaussian
+};
+
+/*IoU здесь и в настройках в процентах, как в MyTracker::IOU*/
+struct NmsOptions
+{
+	NmsMethod m_method = NmsMethod::Hard;
+	double m_iouThreshold = 50;
+	//Только для Hard: бокс остается, если он удалил хотя бы столько соседей.
+	//0 - обычный NMS, 1 - правило прежнего MyTracker::nms
+	int m_minNeighbors = 0;
+	//Подавлять только боксы того же класса
+	bool m_classAware = false;
+	//Остановиться, когда найдено столько боксов, 0 - без ограничения.
+	//Первые m_topK боксов те же, что и без ограничения
+	size_t m_topK = 0;
+	//Только для Soft-NMS: параметр гауссианы (IoU от 0 до 1) и score,
+	//ниже которого бокс выбрасывается
+	float m_sigma = 0.5f;
+	float m_scoreThreshold = 0.001f;
+};
+
+/*NMS над боксами Detections. Индексы сортируются по score, координаты копируются
+в том же порядке в плоские массивы float, и IoU лучшего бокса со всеми оставшимися
+считается векторно. Оставшиеся боксы после каждого шага сдвигаются к началу, поэтому
+следующий шаг просматривает только их. Если IoU во float слишком близко к порогу,
+решение принимается точным расчетом, как в MyTracker::IOU, так что результат Hard
+совпадает с прежним nms на std::multimap до порядка боксов.
+Буферы растут до наибольшего количества боксов и дальше не выделяются*/
+class NmsEngine
+{
+public:
+	void setOptions(const NmsOptions& options) { m_options = options; };
+	const NmsOptions& options() const { return m_options; };
+
+	/*Возвращает индексы оставленных боксов detections в порядке убывания score,
+	при равных score - в порядке убывания индекса. Действительны до следующего run*/
+	const std::vector<int>& run(const Detections& detections);
+
+	/*score оставленных боксов, для Soft-NMS - уменьшенные*/
+	const std::vector<float>& scores() const { return m_keptScores; };
+
+private:
+	void sort(const Detections& detections);
+	void computeIous(const size_t best, const size_t begin, const size_t end);
+	bool sameClass(const size_t best, const size_t other) const;
+	bool exceeds(const Detections& detections, const size_t best, const size_t other, const float iou) const;
+	void move(const size_t from, const size_t to);
+	void runHard(const Detections& detections);
+	void runSoft();
+
+	NmsOptions m_options;
+
+	//Оставшиеся боксы в порядке убывания score
+	std::vector<int> m_order;
+	std::vector<float> m_left;
+	std::vector<float> m_top;
+	std::vector<float> m_right;
+	std::vector<float> m_bottom;
+	std::vector<float> m_areas;
+	std::vector<float> m_classes;
+	std::vector<float> m_scores;
+
+	//IoU лучшего бокса с оставшимися
+	std::vector<float> m_ious;
+
+	std::vector<int> m_kept;
+	std::vector<float> m_keptScores;
+};
+
+/*IoU в процентах, как в MyTracker::IOU*/
+double percentIou(const cv::Rect& rect1, const cv::Rect& rect2);
+
+/*Сравнение с прежним nms на std::multimap на синтетических скоплениях боксов
+разного размера. false, если результаты хоть раз не совпали*/
+bool benchNms();
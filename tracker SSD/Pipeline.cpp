@@ -0,0 +1,204 @@
+#include "Pipeline.h"
+#include "Batching.h"
+#include "../shared/SyntheticScene.h"
+#include "../shared/TrackingScore.h"
+
+#include <algorithm>
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	/*Решает, на каких кадрах запускать сеть, а на каких только предсказывать треки*/
+	class DetectionSchedule
+	{
+	public:
+		DetectionSchedule(const PipelineOptions& options) :
+			m_every(std::max(options.m_detectEvery, 1)), m_maxUncertainty(options.m_maxUncertainty) {};
+
+		/*Шаг трекера для кадра index. Кадры могут идти с пропусками, если часть выброшена
+		из очереди. Возвращает true, если запускалась сеть*/
+		bool step(MyTracker& tracker, const cv::Mat& frame, const size_t index)
+		{
+			const int elapsed = m_started ? int(index - m_last) : 1;
+			m_started = true;
+			m_last = index;
+
+			bool uncertain = m_maxUncertainty > 0 && tracker.uncertainty() > m_maxUncertainty;
+			if (index < m_next && !uncertain)
+			{
+				tracker.predict(elapsed);
+				return false;
+			}
+
+			tracker.process(frame, elapsed);
+			m_next = index + m_every;
+			return true;
+		}
+
+	private:
+		int m_every;
+		double m_maxUncertainty;
+		size_t m_next = 0;
+		size_t m_last = 0;
+		bool m_started = false;
+	};
+
+	/*events - nullptr, если события не записываются*/
+	void trackingStage(MyTracker& tracker, EventWriter* events, const PipelineOptions& options, PipelineStream& stream)
+	{
+		/*Инференс раз в m_detectEvery кадров. Считаем по номеру кадра, т.к. часть
+		кадров может быть выброшена из очереди*/
+		DetectionSchedule schedule(options);
+		PipelineFrame item;
+		while (stream.m_captured.pop(item))
+		{
+			{
+				MEASURE_STAGE(Stage::Tracking, tracker.camera());
+				schedule.step(tracker, item.m_frame.image(), item.m_index);
+			}
+			publishFrame(tracker, events, options, stream, item);
+		}
+
+		stream.m_processed.close();
+	}
+}
+
+PipelineStats runPipeline(std::vector<std::unique_ptr<MyTracker>>& trackers, const std::vector<std::string>& paths,
+	const PipelineOptions& options)
+{
+	auto startTracking = [&](const size_t i, PipelineStream& stream, EventWriter* events) {
+		trackers[i]->setCamera(int(i));
+		return std::thread(trackingStage, std::ref(*trackers[i]), events, std::cref(options), std::ref(stream));
+	};
+	auto show = [](const size_t i, cv::Mat& canvas, const std::vector<std::pair<int, cv::Rect>>& tracks) {
+		MyTracker::drawTracks(canvas, tracks);
+		cv::imshow(std::to_string(i + 1), canvas);
+	};
+	return runStages(paths, options, startTracking, show);
+}
+
+void benchBatching(const std::string& backend, const std::string& path, const size_t frames)
+{
+	/*Кадры не выбрасываем, иначе fps будет считаться по разному количеству работы*/
+	PipelineOptions options;
+	options.m_display = false;
+	options.m_paced = false;
+	options.m_maxFrames = frames;
+	options.m_policy = QueuePolicy::Block;
+
+	std::cout << "backend: " << backend << std::endl;
+	std::cout << "streams\tbatch\tinferences\tmean batch\tfps per stream\tgain" << std::endl;
+	for (size_t count : { 1, 2, 4, 8 })
+	{
+		/*Батч 1 - прежний путь, по инференсу на кадр*/
+		double single = 0;
+		for (int maxBatch : { 1, int(count) })
+		{
+			if (maxBatch == 1 && single > 0)
+				continue;
+
+			InferenceBatcher batcher(makeInferenceBackend(backend, 0), maxBatch, std::chrono::milliseconds(2));
+			if (!batcher.load())
+			{
+				std::cout << "failed to load " << backend << " model" << std::endl;
+				return;
+			}
+
+			std::vector<std::unique_ptr<MyTracker>> trackers;
+			for (size_t i = 0; i < count; ++i)
+				trackers.emplace_back(std::make_unique<MyTracker>(batcher.client()));
+
+			auto stats = runPipeline(trackers, std::vector<std::string>(count, path), options);
+			double perStream = stats.fps() / count;
+			if (maxBatch == 1)
+				single = perStream;
+
+			std::cout << count << '\t' << batcher.maxBatch() << '\t' << batcher.batches() << '\t'
+				<< (batcher.batches() > 0 ? double(batcher.frames()) / batcher.batches() : 0) << '\t'
+				<< perStream << '\t' << (single > 0 ? perStream / single : 0) << std::endl;
+		}
+	}
+}
+
+void benchSparseDetection(const std::string& backend, const std::string& path, const size_t frames)
+{
+	struct Mode
+	{
+		const char* m_name;
+		int m_every;
+		double m_maxUncertainty;
+	};
+	const Mode modes[] = { { "every 1", 1, 0 }, { "every 2", 2, 0 }, { "every 4", 4, 0 }, { "every 8", 8, 0 },
+		{ "adaptive, up to 8", 8, 0.25 } };
+
+	/*Истинные боксы - из файла рядом с видео (например, записанного tracker_common --generate),
+	а если его нет, кадры рисуются синтетической сценой в памяти*/
+	std::vector<SyntheticScene::Boxes> truth;
+	const std::string truthPath = SyntheticScene::truthPath(path);
+	const bool annotated = cv::VideoCapture(path).isOpened() && SyntheticScene::readTruth(truthPath, truth);
+	const SyntheticScene scene{ SceneOptions() };
+
+	std::cout << "backend: " << backend << ", truth: " << (annotated ? truthPath : std::string("synthetic scene"))
+		<< std::endl;
+	std::cout << "mode\tinferences\ttracking fps\ttracks per frame\tMOTA\tMOTP\tid switches\tmisses\tfalse positives"
+		<< std::endl;
+
+	for (const Mode& mode : modes)
+	{
+		auto model = makeInferenceBackend(backend, 0);
+		MyTracker tracker(std::move(model));
+		if (!tracker.loadModel())
+		{
+			std::cout << "failed to load " << backend << " model" << std::endl;
+			return;
+		}
+
+		PipelineOptions options;
+		options.m_detectEvery = mode.m_every;
+		options.m_maxUncertainty = mode.m_maxUncertainty;
+		DetectionSchedule schedule(options);
+
+		/*Время считаем только для трекинга, чтение и рисование кадров одинаковы во всех режимах*/
+		cv::VideoCapture video;
+		if (annotated)
+			video.open(path);
+		cv::Mat frame;
+		SyntheticScene::Boxes objects;
+		TrackingEvaluator evaluator;
+		std::vector<TrackEvent> events;
+		size_t processed = 0, inferences = 0, tracks = 0;
+		double seconds = 0;
+		for (size_t index = 0; index < frames; ++index)
+		{
+			if (annotated)
+			{
+				if (!video.read(frame))
+					break;
+				objects = index < truth.size() ? truth[index] : SyntheticScene::Boxes();
+			}
+			else
+				scene.render(int(index), frame, &objects);
+
+			auto start = Clock::now();
+			inferences += schedule.step(tracker, frame, index);
+			seconds += std::chrono::duration<double>(Clock::now() - start).count();
+
+			tracker.takeEvents(events);
+			const auto visible = tracker.visibleTracks();
+			tracks += visible.size();
+			evaluator.add(objects, visible);
+			++processed;
+		}
+		if (processed == 0)
+		{
+			std::cout << "failed to read " << path << std::endl;
+			return;
+		}
+
+		const TrackingScore& score = evaluator.score();
+		std::cout << mode.m_name << '\t' << inferences << '\t' << (seconds > 0 ? processed / seconds : 0) << '\t'
+			<< double(tracks) / processed << '\t' << score.mota() << '\t' << score.motp() << '\t'
+			<< score.m_idSwitches << '\t' << score.m_misses << '\t' << score.m_falsePositives << std::endl;
+	}
+}
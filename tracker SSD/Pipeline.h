@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Header.h"
+#include "../shared/Pipeline.h"
+
+/*Конвейер из трех стадий (см. shared/Pipeline.h): захват кадра -> инференс и трекинг ->
+вывод (отрисовка и imshow). Каждая камера получает свой конвейер и свой MyTracker,
+а общий инференс для нескольких камер собирает InferenceBatcher, см. Batching.h.
+Трекинг выдает события треков (TrackEvents.h): их пишет в файл отдельный поток,
+а треки для отрисовки собираются из тех же событий*/
+
+struct PipelineOptions : StageOptions
+{
+	/*Инференс раз в m_detectEvery кадров, между ними боксы треков предсказываются
+	фильтрами Калмана. Если m_maxUncertainty больше 0, сеть запускается и раньше, как
+	только неопределенность положения какого-то трека превысит эту долю высоты бокса*/
+	int m_detectEvery = UPDATE_RATE;
+	double m_maxUncertainty = 0;
+
+	/*Пакетная обработка, см. StageOptions::setHeadless. Инференс идет по номеру кадра,
+	поэтому треки совпадают с обычным режимом с --block*/
+	static PipelineOptions headless(const std::string& tracksPath)
+	{
+		PipelineOptions options;
+		options.setHeadless(tracksPath);
+		return options;
+	};
+};
+
+/*Обрабатывает видео paths[i] трекером trackers[i], модели уже должны быть загружены*/
+PipelineStats runPipeline(std::vector<std::unique_ptr<MyTracker>>& trackers, const std::vector<std::string>& paths,
+	const PipelineOptions& options);
+
+/*Замер пропускной способности на камеру при инференсе по одному кадру и батчами
+для 1, 2, 4 и 8 камер. Все камеры читают одно и то же видео path*/
+void benchBatching(const std::string& backend, const std::string& path, const size_t frames);
+
+/*Замер fps трекинга и точности (MOTA, MOTP, смены id) при инференсе раз в 1, 2, 4 и 8
+кадров и адаптивно. Треки сравниваются с истинными боксами из SyntheticScene::truthPath(path),
+а если файла нет - с боксами синтетической сцены, кадры которой рисуются в памяти*/
+void benchSparseDetection(const std::string& backend, const std::string& path, const size_t frames);
@@ -0,0 +1,413 @@
+#include "Preprocess.h"
+#include "../shared/ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/dnn.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+namespace
+{
+	/*Средние по каналам R, G, B, т.е. уже после свапа*/
+	constexpr float MEAN[INPUT_CHANNELS] = { 123.f, 117.f, 104.f };
+
+	/*Меньше строк входа на часть не делим, иначе задание пула дороже самой работы*/
+	constexpr int MIN_ROWS_PER_PART = 16;
+
+	/*Та же привязка пикселей, что у cv::resize с INTER_LINEAR: по центрам пикселей,
+	на краях кадра берется крайний пиксель*/
+	void makeTable(const int srcSize, const int dstSize, std::vector<int>& first, std::vector<int>& second,
+		std::vector<float>& weights)
+	{
+		first.resize(dstSize);
+		second.resize(dstSize);
+		weights.resize(dstSize);
+
+		const double scale = double(srcSize) / dstSize;
+		for (int i = 0; i < dstSize; ++i)
+		{
+			double position = (i + 0.5) * scale - 0.5;
+			int index = int(std::floor(position));
+			float weight = float(position - index);
+			if (index < 0)
+			{
+				index = 0;
+				weight = 0;
+			}
+			if (index >= srcSize - 1)
+			{
+				index = srcSize - 1;
+				weight = 0;
+			}
+			first[i] = index;
+			second[i] = std::min(index + 1, srcSize - 1);
+			weights[i] = weight;
+		}
+	}
+}
+
+void Preprocessor::setMode(const ResizeMode mode)
+{
+	m_mode = mode;
+	m_frameSize = cv::Size();
+}
+
+void Preprocessor::setPool(ThreadPool* pool)
+{
+	m_pool = pool;
+	m_frameSize = cv::Size();
+}
+
+cv::Rect Preprocessor::content(const ResizeMode mode, const cv::Size& frameSize)
+{
+	if (mode == ResizeMode::Stretch || frameSize.width <= 0 || frameSize.height <= 0)
+		return cv::Rect(0, 0, INPUT_WIDTH, INPUT_HEIGHT);
+
+	const double scale = std::min(double(INPUT_WIDTH) / frameSize.width, double(INPUT_HEIGHT) / frameSize.height);
+	const int width = std::min(std::max(int(std::lround(frameSize.width * scale)), 1), INPUT_WIDTH);
+	const int height = std::min(std::max(int(std::lround(frameSize.height * scale)), 1), INPUT_HEIGHT);
+	return cv::Rect((INPUT_WIDTH - width) / 2, (INPUT_HEIGHT - height) / 2, width, height);
+}
+
+BoxMapping Preprocessor::mapping(const cv::Size& frameSize) const
+{
+	//Выход нормирован на вход сети: x кадра = (x * 300 - поле) * ширина кадра / ширина содержимого.
+	//Без полей это ровно x * ширина кадра
+	const cv::Rect area = content(m_mode, frameSize);
+	const double scaleX = double(frameSize.width) / area.width;
+	const double scaleY = double(frameSize.height) / area.height;
+	return BoxMapping(cv::Point2f(float(double(INPUT_WIDTH) * frameSize.width / area.width),
+		float(double(INPUT_HEIGHT) * frameSize.height / area.height)),
+		cv::Point2f(float(-area.x * scaleX), float(-area.y * scaleY)));
+}
+
+void Preprocessor::prepare(const cv::Size& frameSize)
+{
+	m_frameSize = frameSize;
+	m_content = content(m_mode, frameSize);
+
+	std::vector<int> x0, x1;
+	std::vector<float> xWeights;
+	makeTable(frameSize.width, m_content.width, x0, x1, xWeights);
+	makeTable(frameSize.height, m_content.height, m_y0, m_y1, m_yWeights);
+
+	//Столбцы храним сразу смещениями в байтах строки BGR, отдельно для каждого канала,
+	//чтобы строка интерполировалась одним циклом
+	const int count = m_content.width * INPUT_CHANNELS;
+	m_x0.resize(count);
+	m_x1.resize(count);
+	m_xWeights.resize(count);
+	for (int x = 0; x < m_content.width; ++x)
+	{
+		for (int c = 0; c < INPUT_CHANNELS; ++c)
+		{
+			m_x0[x * INPUT_CHANNELS + c] = x0[x] * INPUT_CHANNELS + c;
+			m_x1[x * INPUT_CHANNELS + c] = x1[x] * INPUT_CHANNELS + c;
+			m_xWeights[x * INPUT_CHANNELS + c] = xWeights[x];
+		}
+	}
+
+	int parts = 1;
+	if (m_pool != nullptr)
+		parts = std::max(std::min(int(m_pool->size()) + 1, m_content.height / MIN_ROWS_PER_PART), 1);
+	m_caches.assign(parts, RowCache());
+	for (auto& cache : m_caches)
+	{
+		for (auto& row : cache.m_rows)
+			row.resize(count);
+	}
+}
+
+const float* Preprocessor::interpolated(const cv::Mat& frame, const int source, const int keep, RowCache& cache) const
+{
+	for (int i = 0; i < 2; ++i)
+	{
+		if (cache.m_sources[i] == source)
+			return cache.m_rows[i].data();
+	}
+
+	//Занимаем место строки, которая не нужна текущей строке входа
+	const int slot = cache.m_sources[0] == keep ? 1 : 0;
+	cache.m_sources[slot] = source;
+	float* out = cache.m_rows[slot].data();
+
+	const uchar* row = frame.ptr<uchar>(source);
+	const int count = int(m_x0.size());
+	for (int i = 0; i < count; ++i)
+	{
+		const float left = row[m_x0[i]];
+		out[i] = left + m_xWeights[i] * (float(row[m_x1[i]]) - left);
+	}
+	return out;
+}
+
+void Preprocessor::runRows(const cv::Mat& frame, float* tensor, const int begin, const int end, RowCache& cache) const
+{
+	const int plane = INPUT_WIDTH * INPUT_HEIGHT;
+	const int width = m_content.width;
+
+	//В кэше строки прошлого кадра
+	cache.m_sources[0] = cache.m_sources[1] = -1;
+
+	for (int y = begin; y < end; ++y)
+	{
+		const float* top = interpolated(frame, m_y0[y], m_y1[y], cache);
+		const float* bottom = interpolated(frame, m_y1[y], m_y0[y], cache);
+		const float wy = m_yWeights[y];
+
+		//Канал c входа - это канал 2 - c кадра
+		float* red = tensor + (m_content.y + y) * INPUT_WIDTH + m_content.x;
+		float* green = red + plane;
+		float* blue = green + plane;
+
+		int x = 0;
+#if CV_SIMD
+		/*Каналы разбираются из BGR подряд прямо при загрузке. Порядок операций тот же,
+		что в скалярном хвосте, поэтому результат не зависит от ширины вектора*/
+		const int lanes = cv::v_float32::nlanes;
+		const cv::v_float32 weight = cv::vx_setall_f32(wy);
+		const cv::v_float32 meanRed = cv::vx_setall_f32(MEAN[0]);
+		const cv::v_float32 meanGreen = cv::vx_setall_f32(MEAN[1]);
+		const cv::v_float32 meanBlue = cv::vx_setall_f32(MEAN[2]);
+		for (; x <= width - lanes; x += lanes)
+		{
+			cv::v_float32 topBlue, topGreen, topRed, bottomBlue, bottomGreen, bottomRed;
+			cv::v_load_deinterleave(top + x * INPUT_CHANNELS, topBlue, topGreen, topRed);
+			cv::v_load_deinterleave(bottom + x * INPUT_CHANNELS, bottomBlue, bottomGreen, bottomRed);
+			cv::v_store(red + x, topRed + weight * (bottomRed - topRed) - meanRed);
+			cv::v_store(green + x, topGreen + weight * (bottomGreen - topGreen) - meanGreen);
+			cv::v_store(blue + x, topBlue + weight * (bottomBlue - topBlue) - meanBlue);
+		}
+#endif
+		for (; x < width; ++x)
+		{
+			const float* up = top + x * INPUT_CHANNELS;
+			const float* down = bottom + x * INPUT_CHANNELS;
+			red[x] = up[2] + wy * (down[2] - up[2]) - MEAN[0];
+			green[x] = up[1] + wy * (down[1] - up[1]) - MEAN[1];
+			blue[x] = up[0] + wy * (down[0] - up[0]) - MEAN[2];
+		}
+	}
+}
+
+void Preprocessor::run(const cv::Mat& frame, float* tensor)
+{
+	CV_Assert(frame.type() == CV_8UC3);
+	if (frame.cols != m_frameSize.width || frame.rows != m_frameSize.height)
+		prepare(cv::Size(frame.cols, frame.rows));
+
+	//Поля - это средние по каналам, т.е. нули. Тензор могут переиспользовать, поэтому
+	//заполняем их на каждом кадре
+	if (m_content.area() < INPUT_WIDTH * INPUT_HEIGHT)
+	{
+		for (int c = 0; c < INPUT_CHANNELS; ++c)
+		{
+			float* plane = tensor + c * INPUT_WIDTH * INPUT_HEIGHT;
+			std::fill(plane, plane + m_content.y * INPUT_WIDTH, 0.f);
+			std::fill(plane + m_content.br().y * INPUT_WIDTH, plane + INPUT_WIDTH * INPUT_HEIGHT, 0.f);
+			for (int y = m_content.y; y < m_content.br().y; ++y)
+			{
+				std::fill(plane + y * INPUT_WIDTH, plane + y * INPUT_WIDTH + m_content.x, 0.f);
+				std::fill(plane + y * INPUT_WIDTH + m_content.br().x, plane + (y + 1) * INPUT_WIDTH, 0.f);
+			}
+		}
+	}
+
+	const size_t parts = m_caches.size();
+	if (parts == 1)
+	{
+		runRows(frame, tensor, 0, m_content.height, m_caches.front());
+		return;
+	}
+
+	//Лямбда захватывает два указателя, тогда std::function хранит ее без выделения памяти
+	struct Task
+	{
+		const cv::Mat* m_frame;
+		float* m_tensor;
+	};
+	const Task task{ &frame, tensor };
+	m_pool->parallelFor(parts, [this, &task](const size_t part)
+	{
+		const int height = m_content.height;
+		const int count = int(m_caches.size());
+		runRows(*task.m_frame, task.m_tensor, height * int(part) / count, height * (int(part) + 1) / count,
+			m_caches[part]);
+	});
+}
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	/*Прежний Preprocessor::run: обе интерполяции по горизонтали заново для каждого
+	канала каждого пикселя входа. Только растяжение*/
+	class LegacyPreprocessor
+	{
+	public:
+		void run(const cv::Mat& frame, float* tensor)
+		{
+			if (frame.size() != m_frameSize)
+			{
+				m_frameSize = frame.size();
+				makeTable(frame.cols, INPUT_WIDTH, m_x0, m_x1, m_xWeights);
+				makeTable(frame.rows, INPUT_HEIGHT, m_y0, m_y1, m_yWeights);
+				for (int x = 0; x < INPUT_WIDTH; ++x)
+				{
+					m_x0[x] *= 3;
+					m_x1[x] *= 3;
+				}
+			}
+
+			const int plane = INPUT_WIDTH * INPUT_HEIGHT;
+			for (int y = 0; y < INPUT_HEIGHT; ++y)
+			{
+				const uchar* row0 = frame.ptr<uchar>(m_y0[y]);
+				const uchar* row1 = frame.ptr<uchar>(m_y1[y]);
+				const float wy = m_yWeights[y];
+				float* out = tensor + y * INPUT_WIDTH;
+				for (int x = 0; x < INPUT_WIDTH; ++x)
+				{
+					const int x0 = m_x0[x];
+					const int x1 = m_x1[x];
+					const float wx = m_xWeights[x];
+					for (int c = 0; c < INPUT_CHANNELS; ++c)
+					{
+						const int channel = 2 - c;
+						float top = row0[x0 + channel] + wx * (row0[x1 + channel] - row0[x0 + channel]);
+						float bottom = row1[x0 + channel] + wx * (row1[x1 + channel] - row1[x0 + channel]);
+						out[c * plane + x] = top + wy * (bottom - top) - MEAN[c];
+					}
+				}
+			}
+		};
+
+	private:
+		cv::Size m_frameSize;
+		std::vector<int> m_x0, m_x1;
+		std::vector<float> m_xWeights;
+		std::vector<int> m_y0, m_y1;
+		std::vector<float> m_yWeights;
+	};
+
+	/*Вход сети, как его готовил прежний main: blobFromImage и копия во входной тензор.
+	Поля для Letterbox добавляет copyMakeBorder после cv::resize*/
+	void referenceBlob(const cv::Mat& frame, const ResizeMode mode, float* tensor)
+	{
+		cv::Mat blob;
+		if (mode == ResizeMode::Stretch)
+			blob = cv::dnn::blobFromImage(frame, 1.0, cv::Size(INPUT_WIDTH, INPUT_HEIGHT), cv::Scalar(123, 117, 104), true);
+		else
+		{
+			const cv::Rect area = Preprocessor::content(mode, frame.size());
+			cv::Mat resized, padded;
+			cv::resize(frame, resized, area.size(), 0, 0, cv::INTER_LINEAR);
+			cv::copyMakeBorder(resized, padded, area.y, INPUT_HEIGHT - area.br().y, area.x, INPUT_WIDTH - area.br().x,
+				cv::BORDER_CONSTANT, cv::Scalar(104, 117, 123));
+			blob = cv::dnn::blobFromImage(padded, 1.0, cv::Size(), cv::Scalar(123, 117, 104), true);
+		}
+		std::memcpy(tensor, blob.ptr<float>(0), INPUT_SIZE * sizeof(float));
+	}
+}
+
+bool benchPreprocess(const std::string& path)
+{
+	/*Кадры видео, уменьшенные или увеличенные до разных размеров. Без видео - шум:
+	время от содержимого кадра не зависит*/
+	std::vector<cv::Mat> source;
+	{
+		cv::VideoCapture video(path);
+		cv::Mat frame;
+		while (source.size() < 20 && video.read(frame))
+			source.push_back(frame.clone());
+	}
+	if (source.empty())
+	{
+		std::cout << "cannot read " << path << ", using noise frames" << std::endl;
+		cv::RNG rng(1);
+		for (int i = 0; i < 20; ++i)
+		{
+			source.emplace_back(1080, 1920, CV_8UC3);
+			rng.fill(source.back(), cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+		}
+	}
+
+	/*Допуск к blobFromImage: округление уменьшенного кадра до 8 бит и веса с фиксированной точкой*/
+	constexpr float TOLERANCE = 1.f;
+	constexpr int REPEATS = 10;
+	ThreadPool pool;
+	std::vector<float> tensor(INPUT_SIZE), reference(INPUT_SIZE);
+	bool within = true;
+
+	std::cout << "cores: " << std::thread::hardware_concurrency() << std::endl;
+	std::cout << "frame\tmode\tmethod\tus per frame\tspeedup\tmax difference\twithin " << TOLERANCE << std::endl;
+	for (const cv::Size size : { source.front().size(), cv::Size(1920, 1080), cv::Size(640, 360) })
+	{
+		std::vector<cv::Mat> frames(source.size());
+		for (size_t i = 0; i < source.size(); ++i)
+			cv::resize(source[i], frames[i], size, 0, 0, cv::INTER_AREA);
+
+		for (const ResizeMode mode : { ResizeMode::Stretch, ResizeMode::Letterbox })
+		{
+			LegacyPreprocessor legacy;
+			Preprocessor single, parallel;
+			single.setMode(mode);
+			parallel.setMode(mode);
+			parallel.setPool(&pool);
+
+			struct Method
+			{
+				const char* m_name;
+				std::function<void(const cv::Mat&, float*)> m_run;
+				//Проверяется только Preprocessor, остальные отличия печатаются для сравнения
+				bool m_checked;
+			};
+			std::vector<Method> methods = {
+				{ "blobFromImage", [&](const cv::Mat& frame, float* out) { referenceBlob(frame, mode, out); }, false },
+				{ "fused, 1 thread", [&](const cv::Mat& frame, float* out) { single.run(frame, out); }, true },
+				{ "fused, pool", [&](const cv::Mat& frame, float* out) { parallel.run(frame, out); }, true } };
+			if (mode == ResizeMode::Stretch)
+				methods.insert(methods.begin() + 1, { "previous loop", [&](const cv::Mat& frame, float* out) { legacy.run(frame, out); }, false });
+
+			double baseline = 0;
+			for (auto& method : methods)
+			{
+				float difference = 0;
+				for (auto& frame : frames)
+				{
+					referenceBlob(frame, mode, reference.data());
+					method.m_run(frame, tensor.data());
+					for (int i = 0; i < INPUT_SIZE; ++i)
+						difference = std::max(difference, std::abs(tensor[i] - reference[i]));
+				}
+				if (method.m_checked && difference > TOLERANCE)
+					within = false;
+
+				auto start = Clock::now();
+				for (int r = 0; r < REPEATS; ++r)
+				{
+					for (auto& frame : frames)
+						method.m_run(frame, tensor.data());
+				}
+				double time = std::chrono::duration<double, std::micro>(Clock::now() - start).count() /
+					(REPEATS * frames.size());
+				if (baseline == 0)
+					baseline = time;
+
+				std::cout << size.width << 'x' << size.height << '\t'
+					<< (mode == ResizeMode::Stretch ? "stretch" : "letterbox") << '\t' << method.m_name << '\t'
+					<< time << '\t' << (time > 0 ? baseline / time : 0) << '\t' << difference << '\t'
+					<< (difference <= TOLERANCE ? "yes" : "no") << std::endl;
+			}
+		}
+	}
+	return within;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "Decode.h"
+
+class ThreadPool;
+
+/*Размер входа сети SSD*/
+constexpr int INPUT_WIDTH = 300;
+constexpr int INPUT_HEIGHT = 300;
+constexpr int INPUT_CHANNELS = 3;
+constexpr int INPUT_SIZE = INPUT_WIDTH * INPUT_HEIGHT * INPUT_CHANNELS;
+
+/*Как кадр вписывается во вход сети*/
+enum class ResizeMode
+{
+	/*Кадр растягивается на весь вход, пропорции меняются. Как у blobFromImage*/
+	Stretch,
+
+	/*Кадр уменьшается с сохранением пропорций и ставится по центру входа. Поля
+	заполняются средними по каналам, т.е. во входе это нули*/
+	Letterbox
+};
+
+/*Подготовка входа сети из кадра BGR за один проход: билинейный ресайз до 300x300,
+свап B и R каналов, вычитание средних (123, 117, 104) и перестановка в NCHW.
+Результат пишется прямо во входной тензор, поэтому промежуточные кадры не нужны.
+Строка кадра интерполируется по горизонтали один раз, даже если нужна двум строкам
+входа, а интерполяция по вертикали, свап каналов и вычитание средних идут векторно
+сразу в три плоскости. Строки входа можно поделить между потоками пула.
+Таблицы интерполяции считаются один раз на размер кадра, и в установившемся режиме
+память не выделяется. От blobFromImage отличается только тем, что не округляет
+уменьшенный кадр до 8 бит и считает веса во float, т.е. меньше чем на 1 на канал*/
+class Preprocessor
+{
+public:
+	void setMode(const ResizeMode mode);
+	ResizeMode mode() const { return m_mode; };
+
+	/*Пул, между потоками которого делятся строки входа. nullptr - все в вызывающем потоке*/
+	void setPool(ThreadPool* pool);
+
+	/*tensor - место для одного кадра, INPUT_SIZE чисел*/
+	void run(const cv::Mat& frame, float* tensor);
+
+	/*Перевод координат выхода сети в пиксели кадра размера frameSize в текущем режиме*/
+	BoxMapping mapping(const cv::Size& frameSize) const;
+
+	/*Часть входа сети, которую занимает кадр размера frameSize, остальное - поля*/
+	static cv::Rect content(const ResizeMode mode, const cv::Size& frameSize);
+
+private:
+	/*Строки кадра после интерполяции по горизонтали, каналы BGR подряд. Две последние
+	строки переиспользуются, если нужны и следующей строке входа*/
+	struct RowCache
+	{
+		std::vector<float> m_rows[2];
+		int m_sources[2] = { -1, -1 };
+	};
+
+	void prepare(const cv::Size& frameSize);
+	const float* interpolated(const cv::Mat& frame, const int source, const int keep, RowCache& cache) const;
+	void runRows(const cv::Mat& frame, float* tensor, const int begin, const int end, RowCache& cache) const;
+
+	ResizeMode m_mode = ResizeMode::Stretch;
+	ThreadPool* m_pool = nullptr;
+
+	cv::Size m_frameSize;
+	cv::Rect m_content;
+
+	//Для каждого числа строки входа (столбец * 3 + канал кадра): смещение в строке
+	//кадра левого пикселя, правого и вес правого
+	std::vector<int> m_x0, m_x1;
+	std::vector<float> m_xWeights;
+	//Для каждой строки входа: верхняя и нижняя строка кадра и вес нижней
+	std::vector<int> m_y0, m_y1;
+	std::vector<float> m_yWeights;
+
+	//По кэшу строк на каждую часть входа, которые считаются параллельно
+	std::vector<RowCache> m_caches;
+};
+
+/*Время подготовки входа и наибольшее отличие от blobFromImage для кадров видео path
+разного размера в обоих режимах: blobFromImage, прежний поэлементный цикл, Preprocessor
+в одном потоке и с пулом. false, если Preprocessor отличается от blobFromImage больше допуска*/
+bool benchPreprocess(const std::string& path);
@@ -0,0 +1,251 @@
+#include "Tiling.h"
+#include "Header.h"
+#include "../shared/SyntheticScene.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+namespace
+{
+	/*Движение ищется на кадре, уменьшенном во столько раз*/
+	constexpr int MOTION_STEP = 8;
+	/*Пиксель изменился, если яркость отличается больше чем на столько*/
+	constexpr double MOTION_THRESHOLD = 20;
+	/*Тайл считается, если в нем столько изменившихся пикселей уменьшенного кадра*/
+	constexpr int MIN_CHANGED_PIXELS = 4;
+}
+
+void TilePlanner::setOptions(const TilingOptions& options)
+{
+	m_options = options;
+	m_options.m_overlap = std::min(std::max(options.m_overlap, 0.f), 0.9f);
+	m_frameSize = cv::Size();
+}
+
+std::vector<cv::Rect> TilePlanner::makeLayout(const cv::Size& frameSize, const int columns, const int rows,
+	const float overlap)
+{
+	//n тайлов с перекрытием overlap покрывают n - (n - 1) * overlap тайла
+	auto span = [overlap](const int size, const int count) {
+		return std::min(size, int(std::ceil(size / (count - (count - 1) * double(overlap)))));
+	};
+	auto position = [](const int size, const int tile, const int i, const int count) {
+		return count > 1 ? int(int64_t(size - tile) * i / (count - 1)) : (size - tile) / 2;
+	};
+
+	const int width = span(frameSize.width, columns);
+	const int height = span(frameSize.height, rows);
+	std::vector<cv::Rect> tiles;
+	for (int row = 0; row < rows; ++row)
+	{
+		for (int column = 0; column < columns; ++column)
+		{
+			tiles.emplace_back(position(frameSize.width, width, column, columns),
+				position(frameSize.height, height, row, rows), width, height);
+		}
+	}
+	return tiles;
+}
+
+const std::vector<cv::Rect>& TilePlanner::plan(const cv::Mat& frame, const std::vector<cv::Rect>& boxes)
+{
+	if (frame.cols != m_frameSize.width || frame.rows != m_frameSize.height)
+	{
+		m_frameSize = cv::Size(frame.cols, frame.rows);
+		m_layout = makeLayout(m_frameSize, m_options.m_columns, m_options.m_rows, m_options.m_overlap);
+		m_selected.reserve(m_layout.size());
+		m_previous.release();
+		m_plans = 0;
+	}
+	if (!m_options.m_focus)
+		return m_layout;
+
+	findMotion(frame);
+	const bool sweep = m_plans++ % size_t(std::max(m_options.m_sweepEvery, 1)) == 0;
+
+	m_selected.clear();
+	for (const cv::Rect& tile : m_layout)
+	{
+		bool needed = sweep || moving(tile);
+		//Предсказание может ошибаться, поэтому бокс трека расширяется на половину размера
+		for (size_t i = 0; i < boxes.size() && !needed; ++i)
+		{
+			const cv::Rect& box = boxes[i];
+			const cv::Rect area(box.x - box.width / 2, box.y - box.height / 2, box.width * 2, box.height * 2);
+			needed = (area & tile).area() > 0;
+		}
+		if (needed)
+			m_selected.push_back(tile);
+	}
+	return m_selected;
+}
+
+void TilePlanner::findMotion(const cv::Mat& frame)
+{
+	const cv::Size size(std::max(frame.cols / MOTION_STEP, 1), std::max(frame.rows / MOTION_STEP, 1));
+	cv::resize(frame, m_small, size, 0, 0, cv::INTER_AREA);
+	cv::cvtColor(m_small, m_gray, cv::COLOR_BGR2GRAY);
+
+	//На первом кадре сравнивать не с чем, тогда считаются все тайлы
+	if (m_previous.size() == m_gray.size())
+	{
+		cv::absdiff(m_gray, m_previous, m_changed);
+		cv::threshold(m_changed, m_changed, MOTION_THRESHOLD, 255, cv::THRESH_BINARY);
+	}
+	else
+		m_changed.release();
+	std::swap(m_gray, m_previous);
+}
+
+bool TilePlanner::moving(const cv::Rect& tile) const
+{
+	if (m_changed.empty())
+		return false;
+	const cv::Rect area = cv::Rect(tile.x / MOTION_STEP, tile.y / MOTION_STEP,
+		(tile.width + MOTION_STEP - 1) / MOTION_STEP, (tile.height + MOTION_STEP - 1) / MOTION_STEP) &
+		cv::Rect(0, 0, m_changed.cols, m_changed.rows);
+	return area.area() > 0 && cv::countNonZero(m_changed(area)) >= MIN_CHANGED_PIXELS;
+}
+
+bool TilePlanner::cut(const cv::Rect& box, const cv::Rect& tile) const
+{
+	//Границы тайла, совпадающие с краем кадра, не внутренние
+	const int marginX = std::max(tile.width / 100, 2);
+	const int marginY = std::max(tile.height / 100, 2);
+	return (tile.x > 0 && box.x <= tile.x + marginX) ||
+		(tile.br().x < m_frameSize.width && box.br().x >= tile.br().x - marginX) ||
+		(tile.y > 0 && box.y <= tile.y + marginY) ||
+		(tile.br().y < m_frameSize.height && box.br().y >= tile.br().y - marginY);
+}
+
+void benchTiling(const std::string& backend, const std::string& path, const size_t frames)
+{
+	using Clock = std::chrono::steady_clock;
+
+	/*Истинные боксы - из файла рядом с видео, а если его нет, кадры и боксы дает
+	синтетическая сцена. Кадры готовятся заранее, чтобы время чтения не входило в замер*/
+	std::vector<SyntheticScene::Boxes> truth;
+	const std::string truthPath = SyntheticScene::truthPath(path);
+	cv::VideoCapture video(path);
+	const bool annotated = video.isOpened() && SyntheticScene::readTruth(truthPath, truth);
+	std::vector<cv::Mat> images;
+	cv::Mat frame;
+	if (annotated)
+	{
+		while (images.size() < frames && video.read(frame))
+			images.push_back(frame.clone());
+	}
+	else
+	{
+		const SyntheticScene scene{ SceneOptions() };
+		truth.resize(frames);
+		for (size_t index = 0; index < frames; ++index)
+		{
+			scene.render(int(index), frame, &truth[index]);
+			images.push_back(frame.clone());
+		}
+	}
+	if (images.empty())
+	{
+		std::cout << "failed to read " << path << std::endl;
+		return;
+	}
+	truth.resize(images.size());
+
+	struct Layout
+	{
+		const char* m_name;
+		int m_columns;
+		int m_rows;
+		bool m_focus;
+	};
+	const Layout layouts[] = { { "full frame", 0, 0, false }, { "2x1", 2, 1, false }, { "2x2", 2, 2, false },
+		{ "3x2", 3, 2, false }, { "4x3", 4, 3, false }, { "3x2 focus", 3, 2, true }, { "4x3 focus", 4, 3, true } };
+
+	struct Run
+	{
+		std::vector<std::vector<cv::Rect>> m_boxes;
+		size_t m_images = 0;
+		double m_seconds = 0;
+	};
+	std::vector<Run> runs;
+	for (const Layout& layout : layouts)
+	{
+		MyTracker tracker(makeInferenceBackend(backend, 0));
+		if (!tracker.loadModel())
+		{
+			std::cout << "failed to load " << backend << " model" << std::endl;
+			return;
+		}
+		TilingOptions options;
+		options.m_columns = layout.m_columns;
+		options.m_rows = layout.m_rows;
+		options.m_focus = layout.m_focus;
+		tracker.setTiling(options);
+
+		/*Треки нужны режиму фокуса, поэтому кадры проходят весь process*/
+		Run run;
+		std::vector<TrackEvent> events;
+		for (const cv::Mat& image : images)
+		{
+			auto start = Clock::now();
+			tracker.process(image);
+			run.m_seconds += std::chrono::duration<double>(Clock::now() - start).count();
+			run.m_images += tracker.images();
+			run.m_boxes.push_back(tracker.detections());
+			tracker.takeEvents(events);
+		}
+		runs.push_back(std::move(run));
+	}
+
+	/*Бокс найден, если с ним пересекается выход с IoU больше 50%. Мелкие объекты - ниже
+	десятой части кадра: на входе сети они меньше 30 пикселей*/
+	auto matches = [](const cv::Rect& box, const std::vector<cv::Rect>& others) {
+		for (auto& other : others)
+		{
+			if (percentIou(box, other) > 50)
+				return true;
+		}
+		return false;
+	};
+
+	std::cout << "backend: " << backend << ", frame " << images.front().cols << 'x' << images.front().rows
+		<< ", truth: " << (annotated ? truthPath : std::string("synthetic scene")) << std::endl;
+	std::cout << "layout\timages per frame\tms per frame\trecall\tsmall recall\tprecision" << std::endl;
+	for (size_t i = 0; i < runs.size(); ++i)
+	{
+		const Run& run = runs[i];
+		size_t total = 0, found = 0, small = 0, smallFound = 0, detected = 0, correct = 0;
+		for (size_t f = 0; f < images.size(); ++f)
+		{
+			std::vector<cv::Rect> expected;
+			for (auto& object : truth[f])
+			{
+				const bool hit = matches(object.second, run.m_boxes[f]);
+				++total;
+				found += hit;
+				if (object.second.height < images[f].rows / 10)
+				{
+					++small;
+					smallFound += hit;
+				}
+				expected.push_back(object.second);
+			}
+			for (auto& box : run.m_boxes[f])
+			{
+				++detected;
+				correct += matches(box, expected);
+			}
+		}
+
+		std::cout << layouts[i].m_name << '\t' << double(run.m_images) / images.size() << '\t'
+			<< 1000 * run.m_seconds / images.size() << '\t' << (total > 0 ? double(found) / total : 0) << '\t'
+			<< (small > 0 ? double(smallFound) / small : 0) << '\t' << (detected > 0 ? double(correct) / detected : 0)
+			<< std::endl;
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+/*Деление кадра на перекрывающиеся тайлы. Кадр 4K, сжатый до входа сети 300x300,
+уменьшается больше чем в 7 раз, и далекие люди становятся меньше того, что видит SSD.
+Каждый тайл подается на вход сети отдельно, все тайлы кадра считаются одним батчем,
+а боксы переводятся в координаты кадра и проходят общий nms, см. MyTracker::detect*/
+struct TilingOptions
+{
+	/*Сетка тайлов m_columns x m_rows. 0 - без тайлов, кадр считается целиком*/
+	int m_columns = 0;
+	int m_rows = 0;
+
+	/*Перекрытие соседних тайлов в долях тайла. Объект меньше перекрытия целиком
+	попадает хотя бы в один тайл*/
+	float m_overlap = 0.25f;
+
+	/*Считать и весь кадр: крупные объекты не помещаются в тайл. Тогда боксы у внутренних
+	границ тайлов выбрасываются, т.к. это обрезанные части объектов, которые целиком
+	видны в соседнем тайле или во всем кадре*/
+	bool m_fullFrame = true;
+
+	/*Считать только тайлы, которые пересекаются с предсказанными боксами треков или
+	где что-то двигалось с прошлого инференса. Все тайлы считаются раз в m_sweepEvery
+	инференсов, чтобы находить и неподвижные новые объекты*/
+	bool m_focus = false;
+	int m_sweepEvery = 10;
+
+	bool enabled() const { return m_columns > 0 && m_rows > 0; };
+};
+
+/*Выбирает тайлы кадра для очередного инференса. Раскладка строится один раз на размер
+кадра, все тайлы одного размера, поэтому таблицы интерполяции Preprocessor для них
+тоже строятся один раз. Движение ищется разностью уменьшенных кадров в оттенках серого.
+В установившемся режиме память не выделяется*/
+class TilePlanner
+{
+public:
+	void setOptions(const TilingOptions& options);
+	const TilingOptions& options() const { return m_options; };
+
+	/*Тайлы для кадра frame. boxes - предсказанные боксы треков, нужны только в режиме
+	фокуса. Ссылка действительна до следующего plan*/
+	const std::vector<cv::Rect>& plan(const cv::Mat& frame, const std::vector<cv::Rect>& boxes);
+
+	/*Бокс выхода сети для тайла tile касается его внутренней границы*/
+	bool cut(const cv::Rect& box, const cv::Rect& tile) const;
+
+	/*Сетка columns x rows одинаковых тайлов с перекрытием overlap, покрывающая кадр*/
+	static std::vector<cv::Rect> makeLayout(const cv::Size& frameSize, const int columns, const int rows,
+		const float overlap);
+
+private:
+	void findMotion(const cv::Mat& frame);
+	bool moving(const cv::Rect& tile) const;
+
+	TilingOptions m_options;
+	cv::Size m_frameSize;
+	std::vector<cv::Rect> m_layout;
+	std::vector<cv::Rect> m_selected;
+	size_t m_plans = 0;
+
+	//Уменьшенный кадр, он же в оттенках серого, прошлый такой же и маска изменившихся пикселей
+	cv::Mat m_small;
+	cv::Mat m_gray;
+	cv::Mat m_previous;
+	cv::Mat m_changed;
+};
+
+/*Полнота и цена обнаружения для нескольких раскладок тайлов на кадрах видео path:
+изображений на кадр, время кадра, полнота для всех и для мелких объектов и точность.
+Истинные боксы берутся из файла SyntheticScene::truthPath(path), а если его нет,
+кадры и истинные боксы дает синтетическая сцена в памяти*/
+void benchTiling(const std::string& backend, const std::string& path, const size_t frames);
@@ -0,0 +1,238 @@
+#include "Descriptor.h"
+#include "Header.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include <opencv2/core/hal/intrin.hpp>
+
+namespace
+{
+	/*На сколько бит сдвигать значение канала, чтобы получить номер корзины*/
+	constexpr int BGR_SHIFT = 5;
+	static_assert((256 >> BGR_SHIFT) == DESCRIPTOR_BINS, "BGR_SHIFT must match DESCRIPTOR_BINS");
+
+	/*Переводит количество пикселей в корзинах в доли от всех пикселей бокса*/
+	void normalize(const std::array<int, DESCRIPTOR_SIZE>& counts, Descriptor& descriptor)
+	{
+		int total = std::accumulate(counts.begin(), counts.end(), 0);
+		float scale = total > 0 ? 1.f / total : 0.f;
+		for (int i = 0; i < DESCRIPTOR_SIZE; ++i)
+			descriptor.m_bins[i] = counts[i] * scale;
+	}
+
+	/*Ранги значений, нужны для коэффициента корреляции Спирмена*/
+	std::vector<double> ranks(const std::vector<double>& values)
+	{
+		std::vector<size_t> order(values.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return values[a] < values[b]; });
+
+		std::vector<double> ranks(values.size());
+		for (size_t i = 0; i < order.size(); ++i)
+			ranks[order[i]] = double(i);
+		return ranks;
+	}
+
+	double spearman(const std::vector<double>& values1, const std::vector<double>& values2)
+	{
+		auto ranks1 = ranks(values1);
+		auto ranks2 = ranks(values2);
+		double n = double(values1.size());
+		double sum = 0;
+		for (size_t i = 0; i < ranks1.size(); ++i)
+			sum += (ranks1[i] - ranks2[i]) * (ranks1[i] - ranks2[i]);
+		return n > 1 ? 1 - 6 * sum / (n * (n * n - 1)) : 0;
+	}
+
+	/*Для каждого бокса ищет самый похожий на него другой бокс. scores - сходство
+	всех пар (i, j), i < j, в порядке обхода вложенными циклами*/
+	std::vector<size_t> mostSimilar(const std::vector<double>& scores, const size_t count)
+	{
+		std::vector<size_t> best(count, 0);
+		std::vector<double> bestScore(count, -1);
+		size_t pair = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			for (size_t j = i + 1; j < count; ++j, ++pair)
+			{
+				if (scores[pair] > bestScore[i]) { bestScore[i] = scores[pair]; best[i] = j; }
+				if (scores[pair] > bestScore[j]) { bestScore[j] = scores[pair]; best[j] = i; }
+			}
+		}
+		return best;
+	}
+
+	double millisecondsSince(const std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+void BgrHistExtractor::compute(const cv::Mat& roi, Descriptor& descriptor) const
+{
+	CV_Assert(roi.type() == CV_8UC3);
+
+	std::array<int, DESCRIPTOR_SIZE> counts{};
+	for (int y = 0; y < roi.rows; ++y)
+	{
+		const uchar* pixel = roi.ptr<uchar>(y);
+		for (int x = 0; x < roi.cols; ++x, pixel += 3)
+		{
+			int bin = ((pixel[0] >> BGR_SHIFT) * DESCRIPTOR_BINS + (pixel[1] >> BGR_SHIFT)) * DESCRIPTOR_BINS +
+				(pixel[2] >> BGR_SHIFT);
+			++counts[bin];
+		}
+	}
+
+	normalize(counts, descriptor);
+}
+
+void HsvHistExtractor::compute(const cv::Mat& roi, Descriptor& descriptor) const
+{
+	CV_Assert(roi.type() == CV_8UC3);
+	static_assert(16 * 8 * 4 == DESCRIPTOR_SIZE, "HSV bins must fill the descriptor");
+
+	/*Переводим в HSV построчно, чтобы временный буфер был размером со строку бокса.
+	H в opencv от 0 до 179, S и V от 0 до 255*/
+	cv::Mat hsv;
+	std::array<int, DESCRIPTOR_SIZE> counts{};
+	for (int y = 0; y < roi.rows; ++y)
+	{
+		cv::cvtColor(roi.row(y), hsv, cv::COLOR_BGR2HSV);
+		const uchar* pixel = hsv.ptr<uchar>(0);
+		for (int x = 0; x < hsv.cols; ++x, pixel += 3)
+			++counts[(pixel[0] * 16 / 180) * 32 + (pixel[1] >> 5) * 4 + (pixel[2] >> 6)];
+	}
+
+	normalize(counts, descriptor);
+}
+
+std::shared_ptr<const DescriptorExtractor> makeDescriptorExtractor(const std::string& name)
+{
+	if (name == "bgr")
+		return std::make_shared<BgrHistExtractor>();
+	if (name == "hsv")
+		return std::make_shared<HsvHistExtractor>();
+	return nullptr;
+}
+
+double compareDescriptors(const Descriptor& desc1, const Descriptor& desc2)
+{
+	return intersectHistograms(desc1.m_bins.data(), desc2.m_bins.data(), DESCRIPTOR_SIZE);
+}
+
+float intersectHistograms(const float* bins1, const float* bins2, const int size)
+{
+	int i = 0;
+	float sum = 0;
+
+#if CV_SIMD
+	cv::v_float32 acc = cv::vx_setzero_f32();
+	for (; i <= size - cv::v_float32::nlanes; i += cv::v_float32::nlanes)
+		acc += cv::v_min(cv::vx_load(bins1 + i), cv::vx_load(bins2 + i));
+	sum = cv::v_reduce_sum(acc);
+#endif
+
+	for (; i < size; ++i)
+		sum += std::min(bins1[i], bins2[i]);
+
+	return sum;
+}
+
+cv::Mat legacyBoxHist(const cv::Mat& frame, const cv::Rect& box)
+{
+	/*calcHist умеет читать каналы прямо из BGR, поэтому ни маска, ни split не нужны*/
+	cv::Mat roi = frame(box & cv::Rect(0, 0, frame.cols, frame.rows));
+
+	int histSize[] = { 256, 256, 256 };
+	int channels[] = { 0, 1, 2 };
+	float branges[] = { 0, 255 };
+	float granges[] = { 0, 255 };
+	float rranges[] = { 0, 255 };
+	const float* histRanges[] = {branges, granges, rranges};
+
+	cv::Mat histogram;
+	cv::calcHist(&roi, 1, channels, cv::Mat(), histogram, 3, histSize, histRanges);
+	cv::normalize(histogram, histogram, 0, 255, cv::NORM_MINMAX, -1, cv::Mat());
+
+	return histogram;
+}
+
+void benchDescriptors(const std::string& path, const size_t samples)
+{
+	/*Боксы берем из вычитания фона, как при обычной работе трекера. Соседние кадры
+	почти одинаковы, поэтому берем каждый десятый*/
+	cv::VideoCapture video(path);
+	cv::Mat frame;
+	TrackList trackList(makeDescriptorExtractor("bgr"));
+	MyTracker tracker(0, trackList, frame);
+
+	std::vector<std::pair<cv::Mat, cv::Rect>> boxes;
+	for (size_t index = 0; boxes.size() < samples && video.read(frame); ++index)
+	{
+		Box box = tracker.searchBox();
+		if (index % 10 == 0 && box.m_coords.area() > 0)
+			boxes.emplace_back(frame.clone(), box.m_coords);
+	}
+
+	const size_t count = boxes.size();
+	const size_t pairs = count * (count - 1) / 2;
+	if (pairs == 0)
+	{
+		std::cout << "not enough boxes in " << path << std::endl;
+		return;
+	}
+
+	/*Трехмерные гистограммы занимают по 64 МБ, поэтому боксов немного*/
+	auto start = std::chrono::steady_clock::now();
+	std::vector<cv::Mat> legacy;
+	for (auto& box : boxes)
+		legacy.push_back(legacyBoxHist(box.first, box.second));
+	double legacyCompute = millisecondsSince(start) / count;
+
+	std::vector<double> legacyScores;
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < count; ++i)
+		for (size_t j = i + 1; j < count; ++j)
+			legacyScores.push_back(std::abs(cv::compareHist(legacy[i], legacy[j], cv::HISTCMP_CORREL)));
+	double legacyCompare = millisecondsSince(start) / pairs;
+	size_t legacyBytes = legacy[0].total() * legacy[0].elemSize();
+	legacy.clear();
+
+	auto legacyBest = mostSimilar(legacyScores, count);
+
+	std::cout << "boxes: " << count << ", pairs: " << pairs << '\n';
+	std::cout << "descriptor\tbytes per track\tcompute, ms\tcompare, ms\trank correlation with legacy\t"
+		"same most similar box\n";
+	std::cout << "legacy 3d\t" << legacyBytes << '\t' << legacyCompute << '\t' << legacyCompare << "\t1\t1\n";
+
+	for (auto name : { "bgr", "hsv" })
+	{
+		auto extractor = makeDescriptorExtractor(name);
+
+		start = std::chrono::steady_clock::now();
+		std::vector<Descriptor> descriptors(count);
+		for (size_t i = 0; i < count; ++i)
+			extractor->compute(boxes[i].first(boxes[i].second), descriptors[i]);
+		double compute = millisecondsSince(start) / count;
+
+		std::vector<double> scores;
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < count; ++i)
+			for (size_t j = i + 1; j < count; ++j)
+				scores.push_back(compareDescriptors(descriptors[i], descriptors[j]));
+		double compare = millisecondsSince(start) / pairs;
+
+		auto best = mostSimilar(scores, count);
+		size_t agree = 0;
+		for (size_t i = 0; i < count; ++i)
+			agree += best[i] == legacyBest[i];
+
+		std::cout << name << '\t' << sizeof(Descriptor) << '\t' << compute << '\t' << compare << '\t'
+			<< spearman(legacyScores, scores) << '\t' << double(agree) / count << '\n';
+	}
+
+	std::cout << "memory for 1000 tracks: legacy " << legacyBytes * 1000 / (1 << 20) << " MiB, compact "
+		<< sizeof(Descriptor) * 1000 / (1 << 10) << " KiB" << std::endl;
+}
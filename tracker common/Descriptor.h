@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <string>
+
+#include <opencv2/core/core.hpp>
+
+/*Количество корзин гистограммы по каждому из трех каналов*/
+constexpr int DESCRIPTOR_BINS = 8;
+constexpr int DESCRIPTOR_SIZE = DESCRIPTOR_BINS * DESCRIPTOR_BINS * DESCRIPTOR_BINS;
+
+/*Дескриптор трека для повторной идентификации - гистограмма цветов бокса,
+нормированная так, что сумма корзин равна 1. Занимает 2 КБ против 64 МБ у
+трехмерной гистограммы 256x256x256, которую трек хранил раньше, и считается
+только по пикселям бокса*/
+struct Descriptor
+{
+	alignas(64) std::array<float, DESCRIPTOR_SIZE> m_bins{};
+};
+
+/*Способ получить дескриптор из бокса. Все камеры, которые сравнивают треки между
+собой, должны пользоваться одним и тем же способом, поэтому он хранится в TrackList*/
+class DescriptorExtractor
+{
+public:
+	virtual ~DescriptorExtractor() {};
+
+	/*roi - часть кадра BGR, которую занимает бокс*/
+	virtual void compute(const cv::Mat& roi, Descriptor& descriptor) const = 0;
+
+	virtual const char* name() const = 0;
+};
+
+/*8x8x8 корзин по каналам B, G, R. Самый дешевый, используется по умолчанию*/
+class BgrHistExtractor : public DescriptorExtractor
+{
+public:
+	void compute(const cv::Mat& roi, Descriptor& descriptor) const override;
+	const char* name() const override { return "bgr"; };
+};
+
+/*16x8x4 корзин по H, S, V. Яркость квантуется грубее, поэтому дескриптор меньше
+зависит от освещения разных камер*/
+class HsvHistExtractor : public DescriptorExtractor
+{
+public:
+	void compute(const cv::Mat& roi, Descriptor& descriptor) const override;
+	const char* name() const override { return "hsv"; };
+};
+
+/*Возвращает способ по имени ("bgr" или "hsv"), либо nullptr если имя неизвестно*/
+std::shared_ptr<const DescriptorExtractor> makeDescriptorExtractor(const std::string& name);
+
+/*Сходство дескрипторов от 0 до 1 - пересечение гистограмм, то есть сумма
+поэлементных минимумов*/
+double compareDescriptors(const Descriptor& desc1, const Descriptor& desc2);
+
+/*Сумма поэлементных минимумов двух массивов длины size.
+Векторизовано универсальными интринсиками opencv*/
+float intersectHistograms(const float* bins1, const float* bins2, const int size);
+
+/*Трехмерная гистограмма 256x256x256 бокса, которой треки сравнивались раньше.
+Оставлена только для замеров. Считается по ROI, без маски размером с кадр*/
+cv::Mat legacyBoxHist(const cv::Mat& frame, const cv::Rect& box);
+
+/*Замер памяти, времени и качества сопоставления дескрипторов по сравнению с
+трехмерной гистограммой на боксах из видео path*/
+void benchDescriptors(const std::string& path, const size_t samples);
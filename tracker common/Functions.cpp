@@ -1,78 +1,175 @@
 ﻿#include "Header.h"
+#include "../shared/Allocations.h"
+#include "../shared/SyntheticScene.h"
+#include "../shared/TrackingScore.h"
 
 Track::Track(const cv::Rect& coords,
 	const size_t id,
 	const Box& bgBox,
 	const size_t trackerId,
-	const cv::Mat hist) :
-	m_coords(coords), m_id(id), m_trackerId(trackerId), m_hist(hist)
+	const Descriptor& descriptor) :
+	m_coords(coords), m_id(id), m_descriptor(descriptor), m_trackerId(trackerId)
 {
-	m_lastPositions.push_back({ bgBox.m_coords.x, bgBox.m_coords.y });
+	m_lastPositions.push(bgBox.m_coords.tl());
 }
 
-Box MyTracker::searchBox()
+void TrackList::age(const int64_t frame, std::vector<TrackEvent>* events)
 {
+	int64_t clock = m_clock.load();
+	while (clock < frame && !m_clock.compare_exchange_weak(clock, frame))
+		;
+	clock = std::max(clock, frame);
+	if (clock < m_nextExpiry.load())
+		return;
 
-	m_bgSub->apply(m_frame, m_fgMask);
-
-	cv::erode(m_fgMask, m_fgMask, cv::Mat(), cv::Point(-1, -1), 1);
-	cv::dilate(m_fgMask, m_fgMask, cv::Mat(), cv::Point(-1, -1), 2);
-
-
-	std::vector<std::vector<cv::Point>> contours;
-	std::vector<cv::Vec4i> hierarchy;
-	cv::findContours(m_fgMask, contours, hierarchy, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
-
-	std::vector<Box> boxes;
-
-	for (auto& ctr : contours)
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+	while (!m_lost.empty() && clock - m_lost.front().second >= LIVE_FRAMES)
 	{
-		if (cv::contourArea(ctr) > SEARCH_BOX_AREA) 
+		const TrackHandle handle = m_lost.front().first;
+		const int64_t lostAt = m_lost.front().second;
+		m_lost.pop_front();
+
+		/*Трек уже удален, снова в кадре или отпущен позже, тогда в очереди есть запись новее*/
+		Track* track = m_tracks.get(handle);
+		if (track == nullptr || track->m_isPresent || track->m_lostAt != lostAt)
+			continue;
+
+		/*Пропавший трек больше нельзя повторно идентифицировать, убираем его из галереи
+		и из хранилища*/
+		if (events != nullptr)
 		{
-			Box box(cv::boundingRect(ctr));
-			boxes.emplace_back(box);
+			TrackEvent event;
+			event.m_type = TrackEventType::Expired;
+			event.m_camera = track->m_trackerId;
+			event.m_id = track->m_id;
+			event.m_box = track->m_coords;
+			events->push_back(event);
 		}
+		m_gallery.erase(int(handle.m_slot));
+		m_tracks.erase(handle);
 	}
+	m_nextExpiry = m_lost.empty() ? INT64_MAX : m_lost.front().second + LIVE_FRAMES;
+}
 
-	Box largest;
+std::vector<TrackList::Match> TrackList::match(const Descriptor& descriptor, const size_t count,
+	const double minScore) const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	std::vector<Match> matches;
+	for (auto& found : m_gallery.query(descriptor, count, minScore))
+		matches.push_back({ m_tracks.handleOfSlot(uint32_t(found.m_id)), found.m_score });
+	return matches;
+}
 
-	for (int i = 0; i < boxes.size(); i++)
-	{
-		if (boxes[i].m_coords.area() >= largest.m_coords.area())
-			largest = boxes[i];
-	}
+bool TrackList::claim(const TrackHandle handle, const Box& bgBox, const int trackerId,
+	const Descriptor& descriptor)
+{
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+
+	/*После поиска в галерее трек могла забрать другая камера, либо он мог пропасть*/
+	Track* track = m_tracks.get(handle);
+	if (track == nullptr || track->m_isPresent || m_clock.load() - track->m_lostAt >= LIVE_FRAMES)
+		return false;
+	m_gallery.erase(int(handle.m_slot));
+
+	track->m_coords = bgBox.m_coords;
+	track->m_descriptor = descriptor;
+	track->m_lastPositions.clear();
+	track->m_lastPositions.push(bgBox.m_coords.tl());
+	track->m_isPresent = true;
+	track->m_trackerId = trackerId;
+	return true;
+}
+
+TrackHandle TrackList::add(const Box& bgBox, const int trackerId, const Descriptor& descriptor)
+{
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+	return m_tracks.insert(Track(bgBox.m_coords, m_nextId++, bgBox, trackerId, descriptor));
+}
+
+void TrackList::update(const TrackHandle handle, const cv::Rect& coords)
+{
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+	Track* track = m_tracks.get(handle);
+	if (track == nullptr)
+		return;
+	track->m_coords = coords;
+	track->m_lastPositions.push(coords.tl());
+}
+
+void TrackList::release(const TrackHandle handle)
+{
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+	Track* track = m_tracks.get(handle);
+	if (track == nullptr)
+		return;
+	track->m_isPresent = false;
+	track->m_lostAt = m_clock.load();
+	m_gallery.insert(int(handle.m_slot), track->m_descriptor);
+	if (m_lost.empty())
+		m_nextExpiry = track->m_lostAt + LIVE_FRAMES;
+	m_lost.emplace_back(handle, track->m_lostAt);
+}
 
-	return largest;
+int TrackList::id(const TrackHandle handle) const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	const Track* track = m_tracks.get(handle);
+	return track != nullptr ? track->m_id : -1;
 }
 
-bool MyTracker::isStill() const
+bool TrackList::isStill(const TrackHandle handle) const
 {
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	const Track* track = m_tracks.get(handle);
+	return track != nullptr && track->m_lastPositions.isStill();
+}
 
-	if (m_track->m_lastPositions.size() < STILL_FRAMES)
+bool TrackList::history(const TrackHandle handle, PositionHistory<STILL_FRAMES, STILL_RADIUS>& history) const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	const Track* track = m_tracks.get(handle);
+	if (track == nullptr)
 		return false;
+	history = track->m_lastPositions;
+	return true;
+}
 
-	/*Считаем количество точек, которые находятся в определенном
-	радиусе от самой первой. Если таких точек STILL_FRAMES, вернем
-	true*/
-	else 
+std::vector<std::pair<int, cv::Rect>> TrackList::visible(const int trackerId) const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	const int64_t clock = m_clock.load();
+	std::vector<std::pair<int, cv::Rect>> visible;
+	for (auto& track : m_tracks)
 	{
-		auto pointsInRadius = 0;
+		if (track.m_trackerId == trackerId && (track.m_isPresent || clock - track.m_lostAt < 30))
+			visible.emplace_back(track.m_id, track.m_coords);
+	}
+	return visible;
+}
 
-		auto& first_point = m_track->m_lastPositions.front();
-		for (auto& point : m_track->m_lastPositions)
-		{
-			auto dist = sqrt(pow(point.front() - first_point.front(), 2) + 
-				(pow(point.back() - first_point.back(), 2)));
-			if (dist < STILL_RADIUS)
-				pointsInRadius += 1;
-		}
+size_t TrackList::size() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	return m_tracks.size();
+}
 
-		if (pointsInRadius == STILL_FRAMES)
-			return true;
-		else
-			return false;
-	}
+size_t TrackList::created() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	return size_t(m_nextId);
+}
+
+Box MyTracker::searchBox()
+{
+	MEASURE_STAGE(Stage::Motion, m_trackerId);
+	auto& boxes = m_motion.search(m_frame);
+	return boxes.empty() ? Box() : Box(boxes.front());
+}
 
+bool MyTracker::isStill(const size_t i) const
+{
+	return m_trackList.isStill(m_active[i].m_track);
 }
 
 double MyTracker::IOU(const cv::Rect& rect1, const cv::Rect& rect2) const
@@ -92,186 +189,622 @@ double MyTracker::IOU(const cv::Rect& rect1, const cv::Rect& rect2) const
 
 void MyTracker::updateTrack()
 {
+	m_trackList.age(++m_frames, &m_events);
+}
 
-	if (m_trackList.size() > 0)
+bool MyTracker::updateBoxes()
+{
+	const std::vector<cv::Rect>* found;
 	{
-		for (auto& track : m_trackList) 
-		{
-
-			if (!track->m_isPresent)
-				track->m_liveFrames -= 1;
+		MEASURE_STAGE(Stage::Motion, m_trackerId);
+		found = &m_motion.search(m_frame);
+	}
+	if (!m_motion.fresh())
+		return false;
 
-			if (track->m_liveFrames <= 0) 
+	MEASURE_STAGE(Stage::Association, m_trackerId);
+	m_nextBoxes.clear();
+	m_boxTaken.assign(m_boxes.size(), 0);
+	for (auto& coords : *found)
+	{
+		/*Движение уже ведет трекер объекта*/
+		bool tracked = false;
+		for (auto& active : m_active)
+			tracked = tracked || IOU(coords, active.m_coords) > IOU_THRESHOLD;
+		if (tracked)
+			continue;
+
+		/*Продолжаем самый пересекающийся бокс прошлого кадра, который еще не продолжен*/
+		Box box(coords);
+		double bestIou = IOU_THRESHOLD;
+		int best = -1;
+		for (size_t i = 0; i < m_boxes.size(); ++i)
+		{
+			double iou = IOU(coords, m_boxes[i].m_coords);
+			if (!m_boxTaken[i] && iou > bestIou)
 			{
-				track->m_liveFrames = 0;
-				track->m_expired = true;
+				bestIou = iou;
+				best = int(i);
 			}
 		}
+		if (best >= 0)
+		{
+			m_boxTaken[best] = 1;
+			box.m_framesAlive = m_boxes[best].m_framesAlive;
+		}
+		//Между поисками прошло m_stride анализов, время жизни считается в анализах
+		box.m_framesAlive += m_motion.options().m_stride;
+		m_nextBoxes.push_back(box);
 	}
+	std::swap(m_boxes, m_nextBoxes);
+	return true;
 }
 
-void MyTracker::updateBox()
+void MyTracker::initTracker()
 {
-
-	Box tempBox = searchBox();
-	if (m_track != nullptr) 
+	for (size_t i = 0; i < m_boxes.size();)
 	{
-		if (IOU(tempBox.m_coords, m_track->m_coords) > IOU_THRESHOLD)
+		/*Трекер не инициализируем, если бокс еще не живет достаточно долго*/
+		const Box box = m_boxes[i];
+		if (box.m_framesAlive < ACTIVATION_FRAMES || m_active.size() >= MAX_OBJECTS)
 		{
-			m_bgBox.m_coords = cv::Rect();
-			m_bgBox.m_framesAlive = 0;
-			return;
+			++i;
+			continue;
 		}
-
-		else 
+		m_boxes[i] = m_boxes.back();
+		m_boxes.pop_back();
+
+		/*Дескриптор бокса считаем один раз на активацию, он нужен и для поиска
+		в галерее, и для самого трека*/
+		const Descriptor boxDescriptor = calcBoxHist(box.m_coords);
+
+		/*Среди всех не пропавших (expired) треков ищем те, которые больше остальных похожи
+		по цвету на текущий трек и совпадают сильнее порога. Берем самый похожий.
+		Если его успела забрать другая камера, пробуем следующий. Если сопадение по цвету
+		не нашли, создаем новый трек и добавляем его в trackList*/
+		ActiveTrack active;
+		TrackEventType type = TrackEventType::Reidentified;
 		{
-			if (tempBox.m_coords != cv::Rect() && 
-				IOU(tempBox.m_coords, m_bgBox.m_coords) > IOU_THRESHOLD)
+			MEASURE_STAGE(Stage::Association, m_trackerId);
+			for (auto& match : m_trackList.match(boxDescriptor, REID_CANDIDATES, HIST_THRESHOLD))
 			{
-				m_bgBox.m_coords = tempBox.m_coords;
-				m_bgBox.m_framesAlive += 1;
-				return;
+				if (m_trackList.claim(match.m_track, box, m_trackerId, boxDescriptor))
+				{
+					active.m_track = match.m_track;
+					break;
+				}
 			}
-			else 
+			if (!active.m_track.valid())
 			{
-				m_bgBox.m_coords = cv::Rect();
-				m_bgBox.m_framesAlive = 0;
-				return;
+				active.m_track = m_trackList.add(box, m_trackerId, boxDescriptor);
+				type = TrackEventType::Start;
 			}
-			return;
+			active.m_id = m_trackList.id(active.m_track);
 		}
+		addEvent(type, active.m_id, box.m_coords);
+
+		/*Трекер берем из пула и инициализируем заново, без выделения новых буферов*/
+		active.m_coords = box.m_coords;
+		active.m_pointer = m_trackers.acquire();
+		active.m_pointer->init(m_frame, active.m_coords);
+		m_active.push_back(std::move(active));
 	}
+}
+
+void MyTracker::drawTracks()
+{
+	drawTracks(m_frame, visibleTracks());
+}
 
-	else 
+std::vector<std::pair<int, cv::Rect>> MyTracker::visibleTracks() const
+{
+	return m_trackList.visible(m_trackerId);
+}
+
+void MyTracker::drawTracks(cv::Mat& frame, const std::vector<std::pair<int, cv::Rect>>& tracks)
+{
+	for (auto& track : tracks)
 	{
-		m_bgBox.m_coords = tempBox.m_coords;
-		if (IOU(tempBox.m_coords, m_bgBox.m_coords) > IOU_THRESHOLD)
-			m_bgBox.m_framesAlive += 1;
-		else
-			m_bgBox.m_framesAlive = 0;
-		return;
+		const cv::Rect& coords = track.second;
+		cv::rectangle(frame, cv::Point(coords.x, coords.y),
+			cv::Point(coords.x + coords.width, coords.y + coords.height),
+			cv::Scalar(0, 255, 0));
+		std::string text = "ID: ";
+		text += std::to_string(track.first);
+		cv::putText(frame, text, cv::Point(coords.x, coords.y + coords.height / 2), 
+			cv::FONT_HERSHEY_SIMPLEX, 1, cv::Scalar(0, 0, 255));
 	}
+}
 
+Descriptor MyTracker::calcBoxHist(const cv::Rect& box) const
+{
+	/*Считаем только по пикселям бокса: ROI - это окно в данные кадра без копирования,
+	поэтому стоимость зависит от размера бокса, а не кадра*/
+	MEASURE_STAGE(Stage::Histogram, m_trackerId);
+	Descriptor descriptor;
+	m_trackList.extractor().compute(m_frame(box & cv::Rect(0, 0, m_frame.cols, m_frame.rows)), descriptor);
+	return descriptor;
 }
 
-void MyTracker::initTracker()
+void MyTracker::process()
 {
-	/*Трекер не инициализируем, если бокс еще не живет достаточно долго*/
-	if (m_bgBox.m_framesAlive < ACTIVATION_FRAMES)
-		return;
+	updateTrack();
+
+	/*Трекеры объектов запускаются только с боксов, найденных на этом кадре*/
+	if (updateBoxes())
+		initTracker();
 
-	/*Если дошли до сюда, значит надо занулить активный трек.
-	То есть, временно считаем, что теркер не следит ни за кем*/
-	if (m_track != nullptr)
+	/*Трекеры объектов ищут свои объекты на новом кадре независимо друг от друга
+	и только читают кадр, поэтому работают параллельно*/
+	auto update = [this](size_t i)
 	{
-		m_track->m_isPresent = false;
-		m_track = nullptr;
+		MEASURE_STAGE(Stage::ObjectTracker, m_trackerId);
+		ActiveTrack& active = m_active[i];
+		cv::Rect coords = active.m_coords;
+		active.m_found = active.m_pointer->update(m_frame, coords);
+		if (active.m_found)
+			active.m_coords = coords;
+	};
+	if (m_pool != nullptr)
+		m_pool->parallelFor(m_active.size(), update);
+	else
+	{
+		for (size_t i = 0; i < m_active.size(); ++i)
+			update(i);
+	}
+
+	/*Если трекер не нашел объект, либо если трек долго стоит на месте,
+	помечаем его пропавшим. Иначе, добавляем координаты трека
+	в список его последних положений. Координаты пишем через trackList,
+	т.к. трек могут читать трекеры других камер*/
+	for (size_t i = 0; i < m_active.size();)
+	{
+		if (m_active[i].m_found && !isStill(i))
+		{
+			m_trackList.update(m_active[i].m_track, m_active[i].m_coords);
+			addEvent(TrackEventType::Update, m_active[i].m_id, m_active[i].m_coords);
+			++i;
+			continue;
+		}
+		addEvent(TrackEventType::Lost, m_active[i].m_id, m_active[i].m_coords);
+		m_trackList.release(m_active[i].m_track);
+		m_trackers.release(std::move(m_active[i].m_pointer));
+		m_active[i] = std::move(m_active.back());
+		m_active.pop_back();
 	}
+}
+
+void MyTracker::addEvent(const TrackEventType type, const int id, const cv::Rect& box)
+{
+	TrackEvent event;
+	event.m_type = type;
+	event.m_camera = m_trackerId;
+	event.m_id = id;
+	event.m_box = box;
+	m_events.push_back(event);
+}
+
+void MyTracker::takeEvents(std::vector<TrackEvent>& events)
+{
+	events.clear();
+	std::swap(events, m_events);
+}
 
-	/*Среди всех не пропавших (expired) треков ищем такой, который больше остальных похож
-	по цвету на текущий трек.*/
-	double largest = 0;
-	std::shared_ptr<Track> mostSimilar = nullptr;
-	for (auto& compTrack : m_trackList) {  
-		if (!compTrack->m_isPresent && !compTrack->m_expired) 
+namespace
+{
+	/*Трек прежнего хранилища, каждый кадр уменьшал свое оставшееся время жизни*/
+	struct LegacyTrack : Track
+	{
+		using Track::Track;
+		int m_liveFrames = LIVE_FRAMES;
+	};
+}
+
+void benchTrackList()
+{
+	/*Каждый кадр появляется TRACKS_PER_FRAME новых треков, которые сразу пропадают из кадра и
+	через LIVE_FRAMES кадров пропадают совсем, поэтому живых треков все время около
+	TRACKS_PER_FRAME * LIVE_FRAMES. Для сравнения те же кадры проходит прежнее хранилище,
+	где вектор shared_ptr содержит все треки за время работы*/
+	constexpr int TRACKS_PER_FRAME = 10;
+	constexpr int WINDOW = 100;
+	const Box box(cv::Rect(10, 10, 50, 100));
+	const Descriptor descriptor;
+
+	TrackList trackList(makeDescriptorExtractor("bgr"));
+	std::vector<std::shared_ptr<LegacyTrack>> legacy;
+
+	std::cout << "created tracks\tlive tracks\tframe, us\tlegacy frame, us" << std::endl;
+	double time = 0, legacyTime = 0;
+	size_t milestone = 1000;
+	for (int frame = 0; milestone <= 100000; ++frame)
+	{
+		for (int i = 0; i < TRACKS_PER_FRAME; ++i)
 		{
-			auto comp = compHist(compTrack);
-			if (comp > largest)
+			const int trackerId = i % NUM_TRACKERS;
+			trackList.release(trackList.add(box, trackerId, descriptor));
+			legacy.push_back(std::make_shared<LegacyTrack>(box.m_coords, legacy.size(), box, trackerId, descriptor));
+			legacy.back()->m_isPresent = false;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		for (int trackerId = 0; trackerId < NUM_TRACKERS; ++trackerId)
+			trackList.age(frame + 1);
+		for (int trackerId = 0; trackerId < NUM_TRACKERS; ++trackerId)
+			trackList.visible(trackerId);
+		time += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+		/*Прежние age и visible: проход по всем когда-либо созданным трекам*/
+		start = std::chrono::steady_clock::now();
+		for (auto& track : legacy)
+		{
+			if (!track->m_isPresent)
+				track->m_liveFrames -= 1;
+			if (track->m_liveFrames <= 0)
+				track->m_liveFrames = 0;
+		}
+		for (int trackerId = 0; trackerId < NUM_TRACKERS; ++trackerId)
+		{
+			std::vector<std::pair<int, cv::Rect>> visible;
+			for (auto& track : legacy)
 			{
-				largest = comp;
-				mostSimilar = compTrack;
+				if (track->m_liveFrames > 0 && track->m_trackerId == trackerId && track->m_liveFrames > LIVE_FRAMES - 30)
+					visible.emplace_back(track->m_id, track->m_coords);
 			}
 		}
+		legacyTime += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+		if ((frame + 1) % WINDOW != 0)
+			continue;
+		if (trackList.created() >= milestone)
+		{
+			std::cout << trackList.created() << '\t' << trackList.size() << '\t' << time / WINDOW << '\t'
+				<< legacyTime / WINDOW << std::endl;
+			milestone *= 10;
+		}
+		time = legacyTime = 0;
 	}
+}
 
-	/*Если совпадение больше порога, присваиваем текущему треку совпавший. Также, обновляем
-	остальные члены структуры*/
-	if (largest > HIST_THRESHOLD)
+namespace
+{
+	/*Прежняя проверка из MyTracker::isStill по списку векторов*/
+	bool legacyIsStill(const std::list<std::vector<int>>& positions)
 	{
-		m_bgBox.m_framesAlive = 0;
-		m_track = mostSimilar;
-		m_track->m_coords = m_bgBox.m_coords;
-		m_track->m_hist = calcBoxHist();
-		m_track->m_lastPositions.clear();
-		m_track->m_lastPositions.push_back({ m_bgBox.m_coords.x, m_bgBox.m_coords.y });
-		m_track->m_isPresent = true;
-		m_track->m_liveFrames = LIVE_FRAMES;
-		m_track->m_trackerId = m_trackerId;
-		m_pointer = cv::TrackerKCF::create();
-		m_pointer->init(m_frame, m_track->m_coords);
-		return;
+		if (positions.size() < STILL_FRAMES)
+			return false;
+
+		auto pointsInRadius = 0;
+		auto& first_point = positions.front();
+		for (auto& point : positions)
+		{
+			auto dist = sqrt(pow(point.front() - first_point.front(), 2) + 
+				(pow(point.back() - first_point.back(), 2)));
+			if (dist < STILL_RADIUS)
+				pointsInRadius += 1;
+		}
+		return pointsInRadius == STILL_FRAMES;
 	}
+}
 
-	/*Если сопадение по цвету не нашли, создаем новый трек и добавляем его в 
-	trackList. Трекер будет следить за этим треком*/
-	m_track.reset(new Track(m_bgBox.m_coords, m_trackList.size(), m_bgBox, m_trackerId,
-		calcBoxHist()));
-	m_trackList.emplace_back(m_track);
-	m_pointer = cv::TrackerKCF::create();
-	m_pointer->init(m_frame, m_track->m_coords);
-	return;
+bool benchHistory()
+{
+	/*Случайные блуждания с разным шагом: при маленьком шаге трек то стоит на месте,
+	то нет, поэтому встречаются оба ответа*/
+	constexpr int FRAMES = 1000000;
+	std::srand(1);
+	std::vector<cv::Point> points;
+	cv::Point point(500, 500);
+	for (int i = 0; i < FRAMES; ++i)
+	{
+		const int step = 1 + (i / 1000) % 8;
+		point += cv::Point(std::rand() % (2 * step + 1) - step, std::rand() % (2 * step + 1) - step);
+		points.push_back(point);
+	}
+
+	std::vector<char> legacyStill(FRAMES), still(FRAMES);
+	std::list<std::vector<int>> legacy;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < FRAMES; ++i)
+	{
+		legacyStill[i] = legacyIsStill(legacy);
+		if (legacy.size() >= STILL_FRAMES)
+			legacy.pop_front();
+		legacy.push_back({ points[i].x, points[i].y });
+	}
+	const double legacyTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+	PositionHistory<STILL_FRAMES, STILL_RADIUS> history;
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < FRAMES; ++i)
+	{
+		still[i] = history.isStill();
+		history.push(points[i]);
+	}
+	const double time = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << "frame, ns\tlegacy frame, ns\tstill frames\tsame result" << std::endl;
+	std::cout << time / FRAMES << '\t' << legacyTime / FRAMES << '\t'
+		<< std::count(still.begin(), still.end(), 1) << '\t' << (still == legacyStill ? "yes" : "no") << std::endl;
+	return still == legacyStill;
 }
 
-void MyTracker::drawTracks()
+void benchObjects()
 {
-	for (auto& track : m_trackList)
+	constexpr int FRAMES = 200;
+	constexpr int MEASURED = 100;
+
+	ThreadPool pool;
+	std::cout << "pool threads: " << pool.size() << std::endl;
+	std::cout << "objects\tpool\tframe, ms\ttracks" << std::endl;
+	for (int objects : { 1, 5, 10, 25, 50 })
 	{
-		short id = track->m_trackerId;
-		if (!track->m_expired && id == m_trackerId && track->m_liveFrames > LIVE_FRAMES - 30)
+		SceneOptions options;
+		options.m_objects = objects;
+		options.m_motion = SceneMotion::Orbit;
+		const SyntheticScene scene(options);
+
+		for (bool pooled : { false, true })
 		{
-			cv::rectangle(m_frame, cv::Point(track->m_coords.x, track->m_coords.y),
-				cv::Point(track->m_coords.x + track->m_coords.width, track->m_coords.y + track->m_coords.height),
-				cv::Scalar(0, 255, 0));
-			std::string text = "ID: ";
-			text += std::to_string(track->m_id);
-			cv::putText(m_frame, text, cv::Point(track->m_coords.x, track->m_coords.y + track->m_coords.height / 2), 
-				cv::FONT_HERSHEY_SIMPLEX, 1, cv::Scalar(0, 0, 255));
-			/*cv::putText(m_frame, std::to_string(track->m_liveFrames),
-				cv::Point(track->m_coords.x, track->m_coords.y + track->m_coords.height / 3),
-				cv::FONT_HERSHEY_SIMPLEX, 1, cv::Scalar(0, 0, 255));*/
+			TrackList trackList(makeDescriptorExtractor("bgr"));
+			cv::Mat frame;
+			MyTracker tracker(0, trackList, frame, MotionOptions(), "kcf", pooled ? &pool : nullptr);
+
+			std::vector<TrackEvent> events;
+			double milliseconds = 0;
+			for (int index = 0; index < FRAMES; ++index)
+			{
+				scene.render(index, frame);
+
+				auto start = std::chrono::steady_clock::now();
+				tracker.process();
+				if (index >= FRAMES - MEASURED)
+					milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+				tracker.takeEvents(events);
+			}
+
+			std::cout << objects << '\t' << (pooled ? "yes" : "no") << '\t' << milliseconds / MEASURED << '\t'
+				<< tracker.activeTracks() << std::endl;
 		}
 	}
 }
 
-cv::Mat MyTracker::calcBoxHist() const
+void benchMetrics()
 {
+	/*Стоимость одного замера без записи и с записью в гистограмму*/
+	constexpr int SCOPES = 1000000;
+	double scopeCost[2] = {};
+	for (bool enabled : { false, true })
+	{
+		Metrics::setEnabled(enabled);
+		volatile int sink = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < SCOPES; ++i)
+		{
+			MEASURE_STAGE(Stage::Draw, Metrics::MAX_CAMERAS - 1);
+			sink = sink + 1;
+		}
+		scopeCost[enabled] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+			SCOPES;
+	}
+	std::cout << "scope, ns\tdisabled\t" << scopeCost[0] << "\tenabled\t" << scopeCost[1] << std::endl;
+
+	/*Время кадра трекера с 10 объектами без замеров и с ними. Разница кадров зашумлена,
+	поэтому доля еще оценивается как число замеров на кадр, умноженное на цену замера*/
+	constexpr int FRAMES = 200;
+	constexpr int MEASURED = 100;
+	SceneOptions options;
+	options.m_motion = SceneMotion::Orbit;
+	const SyntheticScene scene(options);
+
+	ThreadPool pool;
+	double frameTime[2] = {};
+	size_t scopes = 0;
+	for (bool enabled : { false, true })
+	{
+		Metrics::reset();
+		Metrics::setEnabled(enabled);
+		TrackList trackList(makeDescriptorExtractor("bgr"));
+		cv::Mat frame;
+		MyTracker tracker(0, trackList, frame, MotionOptions(), "kcf", &pool);
+		std::vector<TrackEvent> events;
+		for (int index = 0; index < FRAMES; ++index)
+		{
+			scene.render(index, frame);
+			auto start = std::chrono::steady_clock::now();
+			tracker.process();
+			if (index >= FRAMES - MEASURED)
+				frameTime[enabled] += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+			tracker.takeEvents(events);
+		}
+		frameTime[enabled] /= MEASURED;
+		for (auto& summary : Metrics::snapshot())
+			scopes += summary.m_count;
+	}
+	Metrics::setEnabled(false);
+	Metrics::reset();
+
+	const double perFrame = double(scopes) / FRAMES;
+	std::cout << "frame, us\tdisabled\t" << frameTime[0] << "\tenabled\t" << frameTime[1] << std::endl;
+	std::cout << "scopes per frame\t" << perFrame << "\testimated overhead, %\t"
+		<< 100 * perFrame * (scopeCost[1] - scopeCost[0]) / 1000 / frameTime[0] << "\tmeasured overhead, %\t"
+		<< 100 * (frameTime[1] - frameTime[0]) / frameTime[0] << std::endl;
+}
 
-	std::vector<std::vector<cv::Point>> boxPoints = {
-		{ cv::Point(m_bgBox.m_coords.x, m_bgBox.m_coords.y),
-		cv::Point(m_bgBox.m_coords.x + m_bgBox.m_coords.width, m_bgBox.m_coords.y),
-		cv::Point(m_bgBox.m_coords.x, m_bgBox.m_coords.y + m_bgBox.m_coords.height),
-		cv::Point(m_bgBox.m_coords.x + m_bgBox.m_coords.width, m_bgBox.m_coords.y + m_bgBox.m_coords.height)} };
-
-	cv::Mat mask(m_frame.rows, m_frame.cols, CV_8UC1, cv::Scalar(0));
-	cv::fillPoly(mask, boxPoints, cv::Scalar(255));
+namespace
+{
+	struct AccuracyRun
+	{
+		size_t m_frames = 0;
+		double m_seconds = 0;
+		size_t m_allocations = 0;
+		TrackingScore m_score;
+	};
+
+	/*Трекер работает как в конвейере: анализ раз в UPDATE_RATE кадров, а треки каждого
+	кадра (те же, что пишутся в tracks.csv) сравниваются с истинными боксами.
+	readFrame(index, frame, truth) возвращает false, когда кадры кончились*/
+	template <class ReadFrame>
+	AccuracyRun runAccuracy(ReadFrame readFrame, ThreadPool* pool)
+	{
+		TrackList trackList(makeDescriptorExtractor("bgr"));
+		cv::Mat frame;
+		MyTracker tracker(0, trackList, frame, MotionOptions(), "kcf", pool);
+		TrackingEvaluator evaluator;
+		SyntheticScene::Boxes truth;
+		std::vector<TrackEvent> events;
+
+		AccuracyRun run;
+		for (int index = 0; readFrame(index, frame, truth); ++index)
+		{
+			/*Выделения считаются только в самом обновлении, а visibleTracks, как и запись
+			tracks.csv, возвращает новый вектор*/
+			auto start = std::chrono::steady_clock::now();
+			if (index % UPDATE_RATE == 0)
+			{
+				const size_t allocations = allocationCount();
+				tracker.process();
+				run.m_allocations += allocationCount() - allocations;
+			}
+			auto tracks = tracker.visibleTracks();
+			run.m_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			++run.m_frames;
 
-	cv::Mat splitted[3];
-	cv::split(m_frame, splitted);
+			tracker.takeEvents(events);
+			evaluator.add(truth, tracks);
+		}
+		run.m_score = evaluator.score();
+		return run;
+	}
 
-	int histSize[] = { 256, 256, 256 };
-	int channels[] = { 0, 1, 2 };
-	float branges[] = { 0, 255 };
-	float granges[] = { 0, 255 };
-	float rranges[] = { 0, 255 };
-	const float* histRanges[] = {branges, granges, rranges};
+	void printAccuracy(const std::string& name, const int objects, const AccuracyRun& run)
+	{
+		const TrackingScore& score = run.m_score;
+		std::cout << name << '\t' << objects << '\t' << (run.m_seconds > 0 ? run.m_frames / run.m_seconds : 0) << '\t'
+			<< (run.m_frames > 0 ? double(run.m_allocations) / run.m_frames : 0) << '\t' << score.mota() << '\t'
+			<< score.motp() << '\t' << score.m_idSwitches << '\t' << score.m_misses << '\t'
+			<< score.m_falsePositives << std::endl;
+	}
+}
 
-	cv::Mat histogram;
-	cv::calcHist(splitted, 3, channels, mask, histogram, 3, histSize, histRanges);
-	cv::normalize(histogram, histogram, 0, 255, cv::NORM_MINMAX, -1, cv::Mat());
+void benchAccuracy(const std::string& path)
+{
+	ThreadPool pool;
+	if (!allocationCountingSupported())
+		std::cout << "allocations are not counted in this build or on this platform" << std::endl;
+	std::cout << "scene\tobjects\tfps\tallocations per frame\tMOTA\tMOTP\tid switches\tmisses\tfalse positives"
+		<< std::endl;
+
+	/*Видео с истинными боксами, например записанное --generate*/
+	if (!path.empty())
+	{
+		std::vector<SyntheticScene::Boxes> truth;
+		cv::VideoCapture video(path);
+		if (!video.isOpened() || !SyntheticScene::readTruth(SyntheticScene::truthPath(path), truth))
+		{
+			std::cout << "cannot open " << path << " or " << SyntheticScene::truthPath(path) << std::endl;
+			return;
+		}
+		auto run = runAccuracy([&](const int index, cv::Mat& frame, SyntheticScene::Boxes& boxes)
+		{
+			if (!video.read(frame))
+				return false;
+			boxes = size_t(index) < truth.size() ? truth[index] : SyntheticScene::Boxes();
+			return true;
+		}, &pool);
+		printAccuracy(path, truth.empty() ? 0 : int(truth.front().size()), run);
+		return;
+	}
 
-	return histogram;
+	/*Сцены строятся в памяти, поэтому замер не зависит от файлов и кодека*/
+	constexpr int FRAMES = 600;
+	for (SceneMotion motion : { SceneMotion::Orbit, SceneMotion::Bounce })
+	{
+		for (int objects : { 1, 5, 10, 20 })
+		{
+			SceneOptions options;
+			options.m_objects = objects;
+			options.m_motion = motion;
+			const SyntheticScene scene(options);
+			auto run = runAccuracy([&](const int index, cv::Mat& frame, SyntheticScene::Boxes& boxes)
+			{
+				if (index >= FRAMES)
+					return false;
+				scene.render(index, frame, &boxes);
+				return true;
+			}, &pool);
+			printAccuracy(motion == SceneMotion::Orbit ? "orbit" : "bounce", objects, run);
+		}
+	}
 }
 
-double MyTracker::compHist(const std::shared_ptr<Track> compTrack) const
+bool checkAllocations(const size_t frames)
 {
+	if (!allocationCountingSupported())
+	{
+		std::cout << "allocations are not counted in this build or on this platform" << std::endl;
+		return false;
+	}
 
-	auto boxHist = calcBoxHist();
-	double comp = std::abs(cv::compareHist(boxHist, compTrack->m_hist, cv::HISTCMP_CORREL));
-	std::cout << comp << std::endl;
+	/*Треки идут за объектами синтетической сцены, как их вел бы трекер объекта*/
+	SceneOptions options;
+	options.m_objects = 20;
+	const SyntheticScene scene(options);
+	cv::Mat frame;
+	SyntheticScene::Boxes objects;
+	scene.render(0, frame, &objects);
+
+	TrackList trackList(makeDescriptorExtractor("bgr"));
+	std::vector<TrackHandle> tracks;
+	for (auto& object : objects)
+		tracks.push_back(trackList.add(Box(object.second), 0, Descriptor()));
+
+	/*Первые кадры заполняют историю положений и очередь событий, их не считаем*/
+	std::vector<TrackEvent> events;
+	events.reserve(objects.size());
+	size_t allocations = 0, updates = 0, still = 0;
+	for (size_t index = 1; index <= frames; ++index)
+	{
+		scene.render(int(index), frame, &objects);
+		const bool counted = index > size_t(STILL_FRAMES);
+		const size_t before = allocationCount();
+		trackList.age(int64_t(index), &events);
+		for (size_t i = 0; i < tracks.size(); ++i)
+		{
+			trackList.update(tracks[i], objects[i].second);
+			still += trackList.isStill(tracks[i]);
+		}
+		if (counted)
+		{
+			allocations += allocationCount() - before;
+			updates += tracks.size();
+		}
+	}
 
-	if (comp >= HIST_THRESHOLD)
-		return true;
-	else
-		return false;
+	std::cout << allocations << " allocations in " << updates << " track updates (" << still << " still)" << std::endl;
+	return allocations == 0;
+}
 
+void benchIou()
+{
+	constexpr int PAIRS = 1024;
+	constexpr int CALLS = 10000000;
+	cv::RNG rng(1);
+	std::vector<cv::Rect> rects;
+	for (int i = 0; i < 2 * PAIRS; ++i)
+		rects.emplace_back(rng.uniform(0, 1200), rng.uniform(0, 640), rng.uniform(10, 120), rng.uniform(10, 160));
+
+	TrackList trackList(makeDescriptorExtractor("bgr"));
+	cv::Mat frame;
+	MyTracker tracker(0, trackList, frame);
+
+	double sum = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < CALLS; ++i)
+	{
+		const int pair = i % PAIRS;
+		sum += tracker.IOU(rects[2 * pair], rects[2 * pair + 1]);
+	}
+	const double time = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "IOU, ns\t" << time / CALLS << "\tmean IOU, %\t" << sum / CALLS << std::endl;
 }
@@ -0,0 +1,233 @@
+#include "Gallery.h"
+#include "../shared/SyntheticScene.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+
+namespace
+{
+	/*Запас на ошибку округления: грубая сумма во float может оказаться чуть меньше точной*/
+	constexpr double COARSE_EPSILON = 1e-5;
+
+	void coarsen(const float* bins, float* coarse)
+	{
+		for (int i = 0; i < COARSE_SIZE; ++i)
+		{
+			float sum = 0;
+			for (int j = 0; j < COARSE_FACTOR; ++j)
+				sum += bins[i * COARSE_FACTOR + j];
+			coarse[i] = sum;
+		}
+	}
+
+	/*Лучшие результаты хранятся в куче, на вершине которой худший из них*/
+	bool betterMatch(const Gallery::Match& match1, const Gallery::Match& match2)
+	{
+		return match1.m_score > match2.m_score;
+	}
+
+	/*Добавляет результат к лучшим и возвращает сходство, которое надо превысить,
+	чтобы попасть в их число*/
+	double keepBest(std::vector<Gallery::Match>& best, const Gallery::Match& match, const size_t count,
+		const double minScore)
+	{
+		best.push_back(match);
+		std::push_heap(best.begin(), best.end(), betterMatch);
+		if (best.size() > count)
+		{
+			std::pop_heap(best.begin(), best.end(), betterMatch);
+			best.pop_back();
+		}
+		return best.size() == count ? std::max(minScore, best.front().m_score) : minScore;
+	}
+}
+
+void Gallery::insert(const int id, const Descriptor& descriptor)
+{
+	size_t row;
+	auto found = m_rows.find(id);
+	if (found != m_rows.end())
+		row = found->second;
+	else
+	{
+		row = m_ids.size();
+		m_rows.emplace(id, row);
+		m_ids.push_back(id);
+		m_coarse.resize(m_coarse.size() + COARSE_SIZE);
+		m_bins.resize(m_bins.size() + DESCRIPTOR_SIZE);
+	}
+
+	std::copy(descriptor.m_bins.begin(), descriptor.m_bins.end(), m_bins.begin() + row * DESCRIPTOR_SIZE);
+	coarsen(descriptor.m_bins.data(), &m_coarse[row * COARSE_SIZE]);
+}
+
+void Gallery::erase(const int id)
+{
+	auto found = m_rows.find(id);
+	if (found == m_rows.end())
+		return;
+
+	/*На место удаляемой строки переносим последнюю, чтобы массивы оставались без дыр*/
+	const size_t row = found->second;
+	const size_t last = m_ids.size() - 1;
+	m_rows.erase(found);
+	if (row != last)
+	{
+		m_ids[row] = m_ids[last];
+		m_rows[m_ids[row]] = row;
+		std::copy_n(m_bins.begin() + last * DESCRIPTOR_SIZE, DESCRIPTOR_SIZE, m_bins.begin() + row * DESCRIPTOR_SIZE);
+		std::copy_n(m_coarse.begin() + last * COARSE_SIZE, COARSE_SIZE, m_coarse.begin() + row * COARSE_SIZE);
+	}
+
+	m_ids.pop_back();
+	m_bins.resize(m_bins.size() - DESCRIPTOR_SIZE);
+	m_coarse.resize(m_coarse.size() - COARSE_SIZE);
+}
+
+std::vector<Gallery::Match> Gallery::query(const Descriptor& descriptor, const size_t count,
+	const double minScore, size_t* compared) const
+{
+	std::vector<Match> best;
+	if (count == 0)
+		return best;
+	best.reserve(count + 1);
+
+	alignas(64) float coarse[COARSE_SIZE];
+	coarsen(descriptor.m_bins.data(), coarse);
+
+	double bound = minScore;
+	for (size_t row = 0; row < m_ids.size(); ++row)
+	{
+		if (intersectHistograms(coarse, &m_coarse[row * COARSE_SIZE], COARSE_SIZE) + COARSE_EPSILON <= bound)
+			continue;
+
+		if (compared != nullptr)
+			++*compared;
+		double score = intersectHistograms(descriptor.m_bins.data(), &m_bins[row * DESCRIPTOR_SIZE], DESCRIPTOR_SIZE);
+		if (score > bound)
+			bound = keepBest(best, { m_ids[row], score }, count, minScore);
+	}
+
+	std::sort(best.begin(), best.end(), betterMatch);
+	return best;
+}
+
+std::vector<Gallery::Match> Gallery::queryExhaustive(const Descriptor& descriptor, const size_t count,
+	const double minScore) const
+{
+	std::vector<Match> best;
+	if (count == 0)
+		return best;
+
+	double bound = minScore;
+	for (size_t row = 0; row < m_ids.size(); ++row)
+	{
+		double score = intersectHistograms(descriptor.m_bins.data(), &m_bins[row * DESCRIPTOR_SIZE], DESCRIPTOR_SIZE);
+		if (score > bound)
+			bound = keepBest(best, { m_ids[row], score }, count, minScore);
+	}
+
+	std::sort(best.begin(), best.end(), betterMatch);
+	return best;
+}
+
+bool benchGallery(const std::string& path)
+{
+	/*Кадры для дескрипторов. Одежда людей на настоящем видео дает плотные гистограммы,
+	в которых заполнены десятки корзин, а не несколько, и грубое отсечение срабатывает реже*/
+	constexpr size_t FRAMES = 40;
+	std::vector<cv::Mat> frames;
+	{
+		cv::VideoCapture video(path);
+		cv::Mat frame;
+		while (frames.size() < FRAMES && video.read(frame))
+			frames.push_back(frame.clone());
+	}
+	if (frames.size() < 2)
+	{
+		std::cout << "cannot read " << path << ", using synthetic scene frames" << std::endl;
+		frames.clear();
+		const SyntheticScene scene{ SceneOptions() };
+		for (size_t i = 0; i < FRAMES; ++i)
+		{
+			frames.emplace_back();
+			scene.render(int(i), frames.back());
+		}
+	}
+
+	std::mt19937 random(42);
+	BgrHistExtractor extractor;
+	const cv::Rect area(0, 0, frames.front().cols, frames.front().rows);
+
+	/*Бокс размером с человека в случайном месте кадра*/
+	auto anyBox = [&]() {
+		const int width = std::uniform_int_distribution<int>(30, std::max(31, area.width / 8))(random);
+		const int height = std::min(area.height, width * 2);
+		return cv::Rect(std::uniform_int_distribution<int>(0, area.width - width)(random),
+			std::uniform_int_distribution<int>(0, area.height - height)(random), width, height);
+	};
+	auto describe = [&](const size_t frame, const cv::Rect& box) {
+		Descriptor descriptor;
+		extractor.compute(frames[frame % frames.size()](box & area), descriptor);
+		return descriptor;
+	};
+
+	const int queries = 200;
+	const size_t count = 5;
+	const double minScore = 0.5;
+	bool allSame = true;
+
+	std::cout << "frames: " << frames.size() << std::endl;
+	std::cout << "gallery size\tnon-zero bins\tcompared rows, %\tpruned query, us\texhaustive query, us\tsame result"
+		<< std::endl;
+	for (size_t size : { 100, 1000, 10000, 20000 })
+	{
+		Gallery gallery;
+		std::vector<Descriptor> probes;
+		size_t nonZero = 0;
+		for (size_t i = 0; i < size; ++i)
+		{
+			const size_t frame = i % frames.size();
+			const cv::Rect box = anyBox();
+			Descriptor descriptor = describe(frame, box);
+			nonZero += std::count_if(descriptor.m_bins.begin(), descriptor.m_bins.end(), [](float bin) { return bin > 0; });
+			gallery.insert(int(i), descriptor);
+
+			/*Тот же человек на следующем кадре, немного сдвинувшийся*/
+			if (probes.size() < queries / 2 && i % (size / (queries / 2)) == 0)
+				probes.push_back(describe(frame + 1, box + cv::Point(3, 2)));
+		}
+
+		/*Половина запросов - уже известные треки, половина - новые*/
+		while (probes.size() < queries)
+			probes.push_back(describe(probes.size(), anyBox()));
+
+		std::vector<std::vector<Gallery::Match>> pruned, exhaustive;
+		size_t compared = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (auto& probe : probes)
+			pruned.push_back(gallery.query(probe, count, minScore, &compared));
+		double prunedTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+		for (auto& probe : probes)
+			exhaustive.push_back(gallery.queryExhaustive(probe, count, minScore));
+		double exhaustiveTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+		bool same = true;
+		for (size_t i = 0; i < probes.size(); ++i)
+		{
+			same = same && pruned[i].size() == exhaustive[i].size();
+			for (size_t j = 0; same && j < pruned[i].size(); ++j)
+				same = pruned[i][j].m_id == exhaustive[i][j].m_id;
+		}
+		allSame = allSame && same;
+
+		std::cout << size << '\t' << double(nonZero) / size << '\t' << 100.0 * compared / (double(size) * queries)
+			<< '\t' << prunedTime / queries << '\t' << exhaustiveTime / queries << '\t' << (same ? "yes" : "no")
+			<< std::endl;
+	}
+	return allSame;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Descriptor.h"
+
+/*Во сколько раз грубая гистограмма меньше дескриптора*/
+constexpr int COARSE_FACTOR = 8;
+constexpr int COARSE_SIZE = DESCRIPTOR_SIZE / COARSE_FACTOR;
+
+/*Галерея дескрипторов треков, которые можно повторно идентифицировать.
+Дескрипторы лежат подряд в одном массиве, поэтому поиск - это последовательный
+проход по памяти векторизованным сравнением. Рядом хранится грубая версия каждого
+дескриптора, где сложены соседние корзины. Пересечение грубых гистограмм не меньше
+пересечения исходных, поэтому строку, у которой оно ниже порога или k-го лучшего
+результата, можно пропустить без полного сравнения. Это точный линейный проход
+с отсечением: результат тот же, что у полного перебора, каждая строка все равно
+проверяется, но большинство - в 8 раз более короткой грубой гистограммой.
+Сколько строк отсекается, зависит от дескрипторов, см. benchGallery*/
+class Gallery
+{
+public:
+	struct Match
+	{
+		int m_id;
+		double m_score;
+	};
+
+	/*Добавляет дескриптор трека id или заменяет уже существующий*/
+	void insert(const int id, const Descriptor& descriptor);
+
+	/*Убирает трек id из галереи, если он там есть*/
+	void erase(const int id);
+
+	bool contains(const int id) const { return m_rows.count(id) > 0; };
+	size_t size() const { return m_ids.size(); };
+
+	/*До count самых похожих треков со сходством выше minScore, по убыванию сходства.
+	Если передан compared, к нему прибавляется количество строк, сравненных полностью*/
+	std::vector<Match> query(const Descriptor& descriptor, const size_t count, const double minScore,
+		size_t* compared = nullptr) const;
+
+	/*То же самое полным перебором, без отсечения. Нужен для замеров*/
+	std::vector<Match> queryExhaustive(const Descriptor& descriptor, const size_t count, const double minScore) const;
+
+private:
+	std::vector<int> m_ids;
+	std::vector<float> m_coarse;
+	std::vector<float> m_bins;
+
+	/*Номер строки массивов по id трека*/
+	std::unordered_map<int, size_t> m_rows;
+};
+
+/*Замер времени запроса к галерее размером от 100 до 20000 треков и доли строк, сравненных
+полностью. Дескрипторы считаются по боксам размером с человека на кадрах видео path (если
+его нет - синтетической сцены), запросы - те же боксы, сдвинутые на соседнем кадре, и новые.
+false, если отсеченный поиск нашел не то же, что полный перебор*/
+bool benchGallery(const std::string& path);
@@ -1,11 +1,19 @@
 ﻿#pragma once
 
 #include <vector>
+#include <atomic>
+#include <deque>
 #include <iostream>
 #include <cstdlib>
 #include <cmath>
 #include <chrono>
 #include <thread>
+#include <list>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -14,6 +22,16 @@
 #include <opencv2/tracking.hpp>
 #include <opencv2/video/background_segm.hpp>
 
+#include "Descriptor.h"
+#include "Gallery.h"
+#include "History.h"
+#include "Motion.h"
+#include "ObjectTracker.h"
+#include "../shared/Metrics.h"
+#include "../shared/ThreadPool.h"
+#include "../shared/SlotMap.h"
+#include "../shared/TrackEvents.h"
+
 
 constexpr int NUM_TRACKERS = 2;
 constexpr int UPDATE_RATE = 3;
@@ -22,8 +40,15 @@ constexpr int STILL_FRAMES = 10;
 constexpr int STILL_RADIUS = 30;
 constexpr int LIVE_FRAMES = 240;
 constexpr int IOU_THRESHOLD = 0;
-constexpr double HIST_THRESHOLD = 0.006;
+/*Минимальное сходство дескрипторов (пересечение гистограмм), при котором трек
+считается тем же самым*/
+constexpr double HIST_THRESHOLD = 0.5;
+/*Сколько самых похожих треков запрашивать из галереи. Если самый похожий успела
+забрать другая камера, пробуем следующие*/
+constexpr int REID_CANDIDATES = 5;
 constexpr int ACTIVATION_FRAMES = 15;
+/*Больше треков одна камера одновременно не ведет, новые движения ждут*/
+constexpr int MAX_OBJECTS = 64;
 
 const std::string DEFAULT_PATH1 = "../test.avi";
 const std::string DEFAULT_PATH2 = "../test1.avi";
@@ -51,46 +76,189 @@ struct Track
 		const size_t id,
 		const Box& bgBox,
 		const size_t trackerId,
-		const cv::Mat hist);
+		const Descriptor& descriptor);
 	Track() {};
 
 	cv::Rect m_coords;
 	int m_id = 0;
 
-	/*Трехмерная гистограмма, необходимая для сравнения похожести.
-	Вычисляется значительно медленнее одномерной, но работает заметно точнее.
-	Из-за этого всякий раз при появлении трека будут подтормаживания*/
-	cv::Mat m_hist;
+	/*Гистограмма цветов, необходимая для сравнения похожести, см. Descriptor.h*/
+	Descriptor m_descriptor;
 
-	/*Вектор координат последних точек, где находился левый верхний угол трека.
-	Он пригодится, чтобы удалить трек, стоящий на месте долгое время. Такое происходит,
+	/*Последние STILL_FRAMES точек, где находился левый верхний угол трека.
+	Они пригодятся, чтобы удалить трек, стоящий на месте долгое время. Такое происходит,
 	когда встроенный трекер opencv постепенно теряет человека и начинает следить за
-	статичным фоном*/
-	std::list<std::vector<int>> m_lastPositions;
+	статичным фоном. Хранятся внутри трека, см. History.h*/
+	PositionHistory<STILL_FRAMES, STILL_RADIUS> m_lastPositions;
 
 	/*Находится ли трек в кадре*/
 	bool m_isPresent = true;
 
-	/*Оставшееся время жизни, в кадрах*/
-	int m_liveFrames = LIVE_FRAMES;
-
-	/*Становится true только когда время жизни истекло*/
-	bool m_expired = false;
+	/*Время общих часов TrackList, когда трек пропал из кадра. Через LIVE_FRAMES кадров
+	после этого трек пропадает и удаляется из хранилища*/
+	int64_t m_lostAt = 0;
 	int m_trackerId = 0;
 };
 
+/*Ссылка на трек в TrackList. Остается верной, пока трек не пропал, после этого
+хранилище ее просто не находит*/
+using TrackHandle = SlotHandle;
+
+/*Хранилище живых треков, общее для всех камер. Служит базой для повторной
+идентификации: трекер любой камеры может забрать себе пропавший трек другой.
+Дескрипторы треков, которые можно забрать, лежат в галерее, см. Gallery.h.
+Треки лежат подряд в SlotMap, а пропавшие удаляются и из галереи, и из хранилища,
+поэтому время кадра и память зависят от количества живых треков, а не от времени работы.
+Трекеры ссылаются на треки через TrackHandle, ссылка на пропавший трек становится
+недействительной. Все обращения к трекам идут под мьютексом. Поиск в галерее только
+читает, поэтому камеры выполняют его одновременно*/
+class TrackList
+{
+public:
+	/*Трек, который можно повторно идентифицировать, и его сходство с боксом*/
+	struct Match
+	{
+		TrackHandle m_track;
+		double m_score;
+	};
+
+	TrackList(std::shared_ptr<const DescriptorExtractor> extractor) : m_extractor(extractor) {};
+	TrackList(const TrackList&) = delete;
+	TrackList& operator=(const TrackList&) = delete;
+
+	/*Двигает общие часы хранилища и удаляет треки, которые отсутствуют в кадре уже
+	LIVE_FRAMES кадров. frame - номер очередного кадра камеры, часы показывают наибольший
+	из номеров всех камер. Поэтому треки камеры, видео которой кончилось или зависло,
+	пропадают по кадрам остальных. Отпущенные треки проверяются по очереди отпускания
+	от самого старого, и хранилище блокируется, только когда пора кого-то удалять, так
+	что обычный вызов не зависит от количества треков и камер. Если передан events,
+	в него добавляется событие Expired с последней камерой и координатами трека*/
+	void age(const int64_t frame, std::vector<TrackEvent>* events = nullptr);
+
+	/*До count отсутствующих в кадре и не пропавших треков, сходство которых с
+	дескриптором выше minScore, по убыванию сходства*/
+	std::vector<Match> match(const Descriptor& descriptor, const size_t count, const double minScore) const;
+
+	/*Забирает трек для трекера trackerId, если после поиска его не забрал
+	кто-то другой и он не пропал, в том числе по часам, но еще не удален age.
+	Иначе возвращает false*/
+	bool claim(const TrackHandle track, const Box& bgBox, const int trackerId, const Descriptor& descriptor);
+
+	/*Создает новый трек с очередным id и добавляет его в хранилище*/
+	TrackHandle add(const Box& bgBox, const int trackerId, const Descriptor& descriptor);
+
+	/*Записывает новые координаты активного трека и добавляет их в список последних положений*/
+	void update(const TrackHandle track, const cv::Rect& coords);
+
+	/*Помечает трек отсутствующим в кадре по текущим часам и кладет в галерею, после
+	чего его можно повторно идентифицировать*/
+	void release(const TrackHandle track);
+
+	/*id трека, либо -1, если трек пропал*/
+	int id(const TrackHandle track) const;
+
+	/*Стоит ли трек на месте последние STILL_FRAMES положений, см. MyTracker::isStill*/
+	bool isStill(const TrackHandle track) const;
+
+	/*Копирует последние положения трека, например для выгрузки траектории. false, если трек пропал*/
+	bool history(const TrackHandle track, PositionHistory<STILL_FRAMES, STILL_RADIUS>& history) const;
+
+	/*id и координаты треков камеры trackerId, которые нужно отобразить: в кадре
+	или пропавших из него не больше 30 кадров назад*/
+	std::vector<std::pair<int, cv::Rect>> visible(const int trackerId) const;
+
+	/*Количество живых треков и всех созданных за время работы*/
+	size_t size() const;
+	size_t created() const;
+
+	/*Способ вычисления дескрипторов, общий для всех камер*/
+	const DescriptorExtractor& extractor() const { return *m_extractor; };
+
+private:
+	std::shared_ptr<const DescriptorExtractor> m_extractor;
+	mutable std::shared_mutex m_mutex;
+
+	/*Галерея хранит треки по номеру ячейки SlotMap: пока трек жив, номер не меняется,
+	а перед удалением трека его дескриптор убирается из галереи*/
+	SlotMap<Track> m_tracks;
+	Gallery m_gallery;
+	int m_nextId = 0;
+
+	/*Общие часы и отпущенные треки с временем отпускания в порядке отпускания. Трек
+	могли забрать и отпустить снова, тогда его прежняя запись просто пропускается.
+	m_nextExpiry - время, когда пропадет первый в очереди, проверяется без блокировки*/
+	std::atomic<int64_t> m_clock{ 0 };
+	std::atomic<int64_t> m_nextExpiry{ INT64_MAX };
+	std::deque<std::pair<TrackHandle, int64_t>> m_lost;
+};
+
+/*Время age и visible на кадр при 100 живых треках после 1000, 10000 и 100000
+созданных за время работы*/
+void benchTrackList();
+
+/*Время добавления положения и проверки isStill на кадр по сравнению с прежним списком
+векторов и совпадение результатов проверки на случайных траекториях. false, если не совпали*/
+bool benchHistory();
+
+/*Трекер одной камеры. Следит сразу за всеми движущимися объектами: у каждого
+найденного движения свой счетчик активации, у каждого активного трека свой трекер
+объекта (KCF или дешевле, см. ObjectTracker.h). Трекеры объектов обновляются
+параллельно в общем пуле потоков*/
 class MyTracker
 {
 private:
-	cv::Ptr<cv::BackgroundSubtractorMOG2> m_bgSub = cv::createBackgroundSubtractorMOG2(500, 150, false);
-	cv::Mat m_fgMask = cv::Mat();
-	Box m_bgBox;
-	std::vector<std::shared_ptr<Track>>& m_trackList;
+	/*Трек, за которым следит эта камера*/
+	struct ActiveTrack
+	{
+		/*Ссылка на трек в trackList*/
+		TrackHandle m_track;
+
+		/*Координаты трека меняет только эта камера, поэтому их копия хранится здесь
+		и читается без блокировки хранилища*/
+		cv::Rect m_coords;
+
+		/*Трекер объекта из m_trackers, после потери трека возвращается туда*/
+		std::unique_ptr<ObjectTracker> m_pointer;
+
+		/*Нашел ли трекер объект на последнем кадре*/
+		bool m_found = false;
+
+		/*id трека для событий, не меняется, пока камера ведет трек*/
+		int m_id = 0;
+	};
+
+	/*Поиск движения, см. Motion.h*/
+	MotionSearch m_motion;
+
+	/*Движения, которые еще не стали треками, со своими счетчиками кадров*/
+	std::vector<Box> m_boxes;
+	std::vector<Box> m_nextBoxes;
+	std::vector<char> m_boxTaken;
+
+	std::vector<ActiveTrack> m_active;
+	TrackList& m_trackList;
+
+	/*Свободные трекеры объектов, см. ObjectTracker.h*/
+	ObjectTrackerPool m_trackers;
+
+	/*nullptr - трекеры объектов обновляются по очереди в потоке камеры*/
+	ThreadPool* m_pool;
+
+	/*События треков с прошлого takeEvents, см. TrackEvents.h*/
+	std::vector<TrackEvent> m_events;
+
+	/*Сколько кадров проанализировала камера, ее время для часов TrackList*/
+	int64_t m_frames = 0;
+
+	void addEvent(const TrackEventType type, const int id, const cv::Rect& box);
 
 
 public:
-	MyTracker(int i, std::vector<std::shared_ptr<Track>>& trackList, cv::Mat& frame) :
-		m_trackerId(i), m_trackList(trackList), m_frame(frame) {};
+	/*objectTracker - вид трекера объектов, см. makeObjectTracker*/
+	MyTracker(int i, TrackList& trackList, cv::Mat& frame, const MotionOptions& motion = MotionOptions(),
+		const std::string& objectTracker = "kcf", ThreadPool* pool = nullptr) :
+		m_motion(motion), m_trackList(trackList), m_trackers(objectTracker), m_pool(pool), m_trackerId(i),
+		m_frame(frame) {};
 
 	/*Все указатели среди членов класса сделал интеллектуальными, поэтому не чищу память явно
 	в деструкторе*/
@@ -98,46 +266,79 @@ public:
 
 	int m_trackerId;
 	cv::Mat& m_frame;
-	cv::Ptr<cv::TrackerKCF> m_pointer = cv::TrackerKCF::create();
-
-	/*Указывает на активный трек. Shared вместо unique, т.к. этот
-	указатель идентичен одному из тех, которые лежат в trackList.
-	То есть, копия не единственная*/
-	std::shared_ptr<Track> m_track = nullptr;
 
 	/*Ищет изменения в фоне и возвращает бокс, который обводит
-	самое большое изменение. Если оно слишком мало, то бокс нулевой*/
+	самое большое изменение. Если оно слишком мало, то бокс нулевой.
+	Координаты бокса всегда в полном кадре, даже если поиск идет по уменьшенному*/
 	Box searchBox();
 
-	/*Подсчет трехмерной гистограммы внутри бокса*/
-	cv::Mat calcBoxHist() const;
-
-	/*Сравнение гистограмм треков*/
-	double compHist(const std::shared_ptr<Track> compTrack) const;
+	/*Подсчет дескриптора по пикселям внутри бокса*/
+	Descriptor calcBoxHist(const cv::Rect& box) const;
 
-	/*Инициализация трекера*/
+	/*Инициализация трекеров объектов для движений, которые живут достаточно долго.
+	Каждое из них становится повторно идентифицированным или новым треком*/
 	void initTracker();
 
-	/*Обновляет время оставшейся жизни отсутствующих в кадре треков.
-	Если время заканчивается, помечает трек как пропавший*/
+	/*Двигает часы хранилища на очередной кадр камеры, см. TrackList::age. Треки, которые
+	отсутствуют в кадре дольше LIVE_FRAMES, удаляются из хранилища с событием Expired*/
 	void updateTrack(); 
 
-	/*Обновляет время существования бокса.
-	Бокс достаточно пересекается с активным треком => зануляем бокс
-	Бокс не пересекается с треком, но пересекается с боксом => увеличиваем время
-	Бокс нулевой => зануляем время
-	Если на данный момент нет активного трека, а также бокс пересекается с боксом
-	из прошлого кадра => увеличиваем время*/
-	void updateBox();
+	/*Обновляет время существования боксов движения на новом кадре.
+	Бокс пересекается с активным треком => бокс не нужен
+	Бокс пересекается с боксом из прошлого кадра => увеличиваем время этого бокса
+	Иначе бокс начинает отсчет заново. Боксы прошлого кадра, которым не нашлось
+	пары, пропадают. Если поиск пропустил этот кадр (--motion-stride), его боксы
+	старые: тогда ничего не меняется и возвращается false*/
+	bool updateBoxes();
+
+	/*Проверяем, стоит ли активный трек i на месте достаточно долго*/
+	bool isStill(const size_t i) const;
 
-	/*Проверяем, стоит ли трек на месте достаточно долго. Проверка идет только когда
-	трек активен*/
-	bool isStill() const;
+	/*Количество треков, за которыми сейчас следит камера*/
+	size_t activeTracks() const { return m_active.size(); };
 
 	/*Площадь пересечения прямоугольников, деленная на площадь их объединения*/
 	double IOU(const cv::Rect& rect1, const cv::Rect& rect2) const;
 
 	/*Отображение треков и их id*/
 	void drawTracks();
+
+	/*id и координаты треков этой камеры, которые нужно отобразить. Снимок можно
+	передать в другой поток и нарисовать там, см. Pipeline.h*/
+	std::vector<std::pair<int, cv::Rect>> visibleTracks() const;
+
+	/*Рисует треки из снимка visibleTracks на кадре*/
+	static void drawTracks(cv::Mat& frame, const std::vector<std::pair<int, cv::Rect>>& tracks);
+
+	/*Полный шаг анализа кадра: время жизни треков, боксы, инициализация трекеров
+	и поиск активных треков на новом кадре. Трек теряется, если трекер объекта его
+	не нашел или если он долго стоит на месте*/
+	void process();
+
+	/*Забирает события, накопленные с прошлого вызова: start или reidentified при
+	активации, update на каждом анализе, lost при потере и expired, когда трек
+	пропадает совсем. Номер кадра и время проставляет вызывающий, см. stampEvents.
+	Прежнее содержимое events выбрасывается, а его память переиспользуется трекером*/
+	void takeEvents(std::vector<TrackEvent>& events);
 };
 
+/*Время кадра и количество треков для синтетического видео с 1-50 движущимися
+объектами, с пулом потоков и без него*/
+void benchObjects();
+
+/*Цена одного замера стадии (см. Metrics.h) и доля замеров во времени кадра
+на синтетическом видео с 10 объектами*/
+void benchMetrics();
+
+/*fps, выделения памяти на кадр и точность (MOTA, MOTP, смены id, см. TrackingScore.h)
+на синтетических сценах с 1-20 объектами, либо на видео path с истинными боксами
+рядом (см. SyntheticScene::write), если path не пустой*/
+void benchAccuracy(const std::string& path);
+
+/*Считает выделения памяти в обновлении треков за frames кадров: age, update и isStill
+для 20 треков синтетической сцены. Возвращает false, если память выделялась или
+счетчика нет в этой сборке, см. shared/Allocations.h*/
+bool checkAllocations(const size_t frames);
+
+/*Время одного вызова MyTracker::IOU*/
+void benchIou();
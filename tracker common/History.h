@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+#include <opencv2/core/core.hpp>
+
+/*Последние Capacity положений трека в кольцевом буфере внутри самого трека, без
+выделений памяти. Проверка, стоит ли трек на месте, ведется по мере добавления точек:
+новая точка сравнивается с каждой из лежащих в буфере, и точки, от которых она дальше
+Radius, помечаются. Трек стоит на месте, если буфер полон, а от самой старой точки
+ни одна следующая не отошла дальше Radius. Расстояния сравниваются в квадратах*/
+template <size_t Capacity, int Radius>
+class PositionHistory
+{
+public:
+	void clear()
+	{
+		m_first = 0;
+		m_size = 0;
+	};
+
+	/*Добавляет точку, самая старая вытесняется, если буфер полон*/
+	void push(const cv::Point& point)
+	{
+		for (size_t i = 0; i < m_size; ++i)
+		{
+			const size_t slot = (m_first + i) % Capacity;
+			const cv::Point offset = point - m_points[slot];
+			if (offset.x * offset.x + offset.y * offset.y >= Radius * Radius)
+				m_moved[slot] = true;
+		}
+
+		size_t slot = (m_first + m_size) % Capacity;
+		if (m_size == Capacity)
+			m_first = (m_first + 1) % Capacity;
+		else
+			++m_size;
+		m_points[slot] = point;
+		m_moved[slot] = false;
+	};
+
+	bool isStill() const { return m_size == Capacity && !m_moved[m_first]; };
+
+	size_t size() const { return m_size; };
+	bool empty() const { return m_size == 0; };
+
+	/*Точка i от самой старой к самой новой, для выгрузки траектории*/
+	const cv::Point& operator[](const size_t i) const { return m_points[(m_first + i) % Capacity]; };
+	const cv::Point& back() const { return (*this)[m_size - 1]; };
+
+private:
+	std::array<cv::Point, Capacity> m_points;
+	//Отошла ли от точки дальше Radius хоть одна из следующих
+	std::array<bool, Capacity> m_moved{};
+	size_t m_first = 0;
+	size_t m_size = 0;
+};
@@ -1,81 +1,208 @@
 #include "Header.h"
+#include "Pipeline.h"
+#include "../shared/SelfTest.h"
+#include "../shared/SyntheticScene.h"
 
-int main() {
+#include <algorithm>
+#include <fstream>
 
-	std::vector<cv::VideoCapture> video { cv::VideoCapture(DEFAULT_PATH2), cv::VideoCapture(DEFAULT_PATH1) };
-	std::vector<cv::Mat> frame { cv::Mat(), cv::Mat() };
+int main(int argc, char* argv[]) {
 
-	/*Массив содержит указатели на все существовавшие треки, пригодится для хранения
-	id треков и сравнения похожести. Не чищу его, т.к. он служит также в качестве своеборазной БД.*/
-	std::vector<std::shared_ptr<Track>> trackList;
-	std::vector<MyTracker> trackers{ MyTracker(0, trackList, frame[0]), MyTracker(1, trackList, frame[1])};
+	std::vector<std::string> args(argv + 1, argv + argc);
 
-	/*Основная единица времени, равная (1 / FPS_видео)*/
-	using FPS = std::chrono::duration<uint64_t, std::ratio<1, 30>>;
+	/*--bench [замер] [видео]:
+	streams - суммарная производительность для разного количества камер,
+	descriptor - память, время и качество дескрипторов повторной идентификации,
+	gallery - время поиска в галерее треков разного размера по боксам из видео,
+	store - время обхода хранилища треков за кадр после долгой работы,
+	history - время проверки, стоит ли трек на месте,
+	motion - время, полнота и точность поиска движения при разных уменьшениях кадра,
+	objects - время кадра одной камеры для 1-50 объектов,
+	trackers - время активации и обновления трекеров объектов,
+	events - накладные расходы и пропускная способность записи событий треков,
+	metrics - цена замеров времени стадий,
+	accuracy - fps, выделения памяти и точность трекинга на синтетических сценах
+	или на видео с истинными боксами,
+	alloc - проверка, что обновление треков не выделяет память,
+	iou - время вычисления IOU,
+	frames - скорость чтения кадров из видео, картинок и Y4M при разном количестве потоков*/
+	if (!args.empty() && args[0] == "--bench")
+	{
+		std::string bench = args.size() > 1 ? args[1] : "streams";
+		std::string path = args.size() > 2 ? args[2] : DEFAULT_PATH1;
+		if (bench == "streams")
+			benchStreams(path, 300);
+		else if (bench == "descriptor")
+			benchDescriptors(path, 12);
+		else if (bench == "gallery")
+			return benchGallery(path) ? 0 : 1;
+		else if (bench == "store")
+			benchTrackList();
+		else if (bench == "history")
+			return benchHistory() ? 0 : 1;
+		else if (bench == "motion")
+			benchMotion(path, 600);
+		else if (bench == "objects")
+			benchObjects();
+		else if (bench == "trackers")
+			benchObjectTrackers();
+		else if (bench == "events")
+			benchEvents();
+		else if (bench == "metrics")
+			benchMetrics();
+		else if (bench == "accuracy")
+			benchAccuracy(args.size() > 2 ? args[2] : "");
+		else if (bench == "alloc")
+			return checkAllocations(600) ? 0 : 1;
+		else if (bench == "iou")
+			benchIou();
+		else if (bench == "frames")
+			benchFrameSources(path, 300);
+		else
+		{
+			std::cout << "unknown benchmark " << bench << std::endl;
+			return 1;
+		}
+		return 0;
+	}
 
-	auto start = std::chrono::system_clock::now();
-	while (video[0].read(frame[0]) && video[1].read(frame[1]))
+	/*--test [проверка]: ringbuffer, threadpool, slotmap, events - проверки поведения
+	общих примитивов, см. SelfTest.h. Код возврата 1, если проверка не прошла*/
+	if (!args.empty() && args[0] == "--test")
 	{
-		auto curTime = std::chrono::system_clock::now();
-		auto elapsed = std::chrono::duration_cast<FPS> (curTime - start);
+		std::string test = args.size() > 1 ? args[1] : "";
+		if (test == "ringbuffer")
+			return testRingBuffer() ? 0 : 1;
+		if (test == "threadpool")
+			return testThreadPool() ? 0 : 1;
+		if (test == "slotmap")
+			return testSlotMap() ? 0 : 1;
+		if (test == "events")
+			return testEventWriter() ? 0 : 1;
+		std::cout << "unknown test " << test << std::endl;
+		return 1;
+	}
 
-		/*Если не прошло времени для UPDATE_RATE кадров с момента start, 
-		просто отображаем треки и продолжаем цикл.*/
-		if (elapsed % FPS(UPDATE_RATE) >= FPS(1))
+	/*--generate FILE [объекты] [кадры] [bounce|orbit]: синтетическое видео с истинными
+	боксами объектов рядом, см. SyntheticScene.h*/
+	if (!args.empty() && args[0] == "--generate")
+	{
+		if (args.size() < 2)
 		{
-
-			for (int i = 0; i < 2; ++i)
-			{
-				MyTracker& tracker = trackers[i];
-				tracker.drawTracks();
-				/*чтобы добавить задержку, иначе imshow может не отработать*/
-				cv::waitKey(1);
-				cv::imshow(std::to_string(tracker.m_trackerId), tracker.m_frame);
-			}
-			
-			std::this_thread::sleep_for(FPS(1));
-			continue;
+			std::cout << "usage: --generate FILE [objects] [frames] [bounce|orbit]" << std::endl;
+			return 1;
 		}
-
-		/*Если дошли до сюда, значит со start прошло столько времени, сколько нужно для UPDATE_RATE
-		кадров. Выполняем анализ трекером*/
-		for (auto& tracker : trackers) 
+		SceneOptions scene;
+		scene.m_objects = args.size() > 2 ? std::stoi(args[2]) : 10;
+		scene.m_motion = args.size() > 4 && args[4] == "orbit" ? SceneMotion::Orbit : SceneMotion::Bounce;
+		const int frames = args.size() > 3 ? std::stoi(args[3]) : 600;
+		if (!SyntheticScene(scene).write(args[1], frames))
 		{
-			tracker.updateTrack();
-			tracker.updateBox();
-
-			tracker.initTracker();
+			std::cout << "cannot write " << args[1] << std::endl;
+			return 1;
+		}
+		return 0;
+	}
 
-			auto& track = tracker.m_track;
-			if (tracker.m_track == nullptr)
-				continue;
+	/*--headless: пакетная обработка без окон и на полной скорости, треки пишутся в файл*/
+	StreamOptions options;
+	if (std::find(args.begin(), args.end(), "--headless") != args.end())
+		options = StreamOptions::headless("tracks.csv");
 
-			/*Трекер ищет на новом кадре текущий объект.
-			Если не находит, либо если трек долго стоит на месте,
-			помечаем его пропавшим. Иначе, добавляем координаты трека
-			в список его последних положений.
-			Жертвую читаемостью во избежание копипасты, которая была в прошлый раз*/
-			if (!tracker.m_pointer->update(tracker.m_frame, track->m_coords) || 
-				(track != nullptr && tracker.isStill()))
+	/*Остальные аргументы - это настройки очередей между стадиями и пути к видео.
+	Видео может быть сколько угодно, у каждой камеры свой конвейер, см. Pipeline.h.
+	Вместо видео можно передать картинки, файл Y4M или "-", см. FrameSource.h*/
+	std::vector<std::string> paths;
+	std::string metricsPath;
+	MetricsFormat metricsFormat = MetricsFormat::Text;
+	for (size_t i = 0; i < args.size(); ++i)
+	{
+		if (args[i] == "--headless")
+			continue;
+		else if (args[i] == "--metrics" && i + 1 < args.size())
+			metricsPath = args[++i];
+		else if (args[i] == "--metrics-format" && i + 1 < args.size())
+		{
+			std::string format = args[++i];
+			if (format != "text" && format != "json")
 			{
-				track->m_isPresent = false;
-				track = nullptr;
+				std::cout << "unknown metrics format " << format << std::endl;
+				return 1;
 			}
-			else 
+			metricsFormat = format == "json" ? MetricsFormat::Json : MetricsFormat::Text;
+		}
+		else if (args[i] == "--tracks" && i + 1 < args.size())
+			options.m_tracksPath = args[++i];
+		else if (args[i] == "--events" && i + 1 < args.size())
+			options.m_eventsPath = args[++i];
+		else if (args[i] == "--events-format" && i + 1 < args.size())
+		{
+			std::string format = args[++i];
+			if (format != "json" && format != "binary")
 			{
-				if (track->m_lastPositions.size() >= STILL_FRAMES)
-					track->m_lastPositions.pop_front();
-				track->m_lastPositions.push_back({ track->m_coords.x, track->m_coords.y });
+				std::cout << "unknown events format " << format << std::endl;
+				return 1;
 			}
+			options.m_eventFormat = format == "binary" ? EventFormat::Binary : EventFormat::Lines;
 		}
+		else if (args[i] == "--descriptor" && i + 1 < args.size())
+			options.m_descriptor = args[++i];
+		else if (args[i] == "--motion" && i + 1 < args.size())
+			options.m_motion.m_detector = args[++i];
+		else if (args[i] == "--motion-scale" && i + 1 < args.size())
+			options.m_motion.m_scale = std::stoi(args[++i]);
+		else if (args[i] == "--motion-stride" && i + 1 < args.size())
+			options.m_motion.m_stride = std::stoi(args[++i]);
+		else if (args[i] == "--motion-gray")
+			options.m_motion.m_gray = true;
+		else if (args[i] == "--object-tracker" && i + 1 < args.size())
+			options.m_objectTracker = args[++i];
+		else if (args[i] == "--threads" && i + 1 < args.size())
+			options.m_threads = std::stoul(args[++i]);
+		else if (args[i] == "--block")
+			options.m_policy = QueuePolicy::Block;
+		else if (args[i] == "--drop")
+			options.m_policy = QueuePolicy::DropOldest;
+		else if (args[i] == "--queue" && i + 1 < args.size())
+			options.m_queueSize = std::stoul(args[++i]);
+		else if (args[i] == "--decode-threads" && i + 1 < args.size())
+			options.m_source.m_threads = std::stoi(args[++i]);
+		else if (args[i] == "--hw-decode")
+			options.m_source.m_hardware = true;
+		else
+			paths.push_back(args[i]);
+	}
 
-		for (int i = 0; i < 2; ++i)
-		{
-			MyTracker& tracker = trackers[i];
-			tracker.drawTracks();
-			/*чтобы добавить задержку, иначе imshow может не отработать*/
-			cv::waitKey(1);
-			cv::imshow(std::to_string(tracker.m_trackerId), tracker.m_frame);
-		}
+	if (paths.empty())
+		paths = { DEFAULT_PATH2, DEFAULT_PATH1 };
+
+	if (makeDescriptorExtractor(options.m_descriptor) == nullptr)
+	{
+		std::cout << "unknown descriptor " << options.m_descriptor << std::endl;
+		return 1;
+	}
+	if (!isObjectTrackerName(options.m_objectTracker))
+	{
+		std::cout << "unknown object tracker " << options.m_objectTracker << std::endl;
+		return 1;
+	}
+	if (makeMotionDetector(options.m_motion.m_detector) == nullptr)
+	{
+		std::cout << "unknown motion detector " << options.m_motion.m_detector << std::endl;
+		return 1;
+	}
+
+	/*--metrics FILE: замеры времени стадий по камерам, в конце пишутся в FILE ("-" - на экран)*/
+	Metrics::setEnabled(!metricsPath.empty());
+
+	auto stats = runStreams(paths, options);
+	printStats(stats);
+
+	if (metricsPath == "-")
+		Metrics::write(std::cout, metricsFormat);
+	else if (!metricsPath.empty())
+	{
+		std::ofstream metricsFile(metricsPath);
+		Metrics::write(metricsFile, metricsFormat);
 	}
 }
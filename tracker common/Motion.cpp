@@ -0,0 +1,186 @@
+#include "Motion.h"
+#include "Header.h"
+#include "../shared/SyntheticScene.h"
+
+namespace
+{
+	/*Доля нового кадра в бегущем среднем и порог разности яркости*/
+	constexpr double BACKGROUND_RATE = 0.05;
+	constexpr double DIFFERENCE_THRESHOLD = 30;
+
+	double intersectionOverUnion(const cv::Rect& rect1, const cv::Rect& rect2)
+	{
+		double intArea = (rect1 & rect2).area();
+		double totalArea = rect1.area() + rect2.area() - intArea;
+		return totalArea > 0 ? intArea / totalArea : 0;
+	}
+}
+
+void RunningAverageDetector::apply(const cv::Mat& frame, cv::Mat& mask)
+{
+	if (m_background.size() != frame.size() || m_background.channels() != frame.channels())
+		frame.convertTo(m_background, CV_32F);
+
+	m_background.convertTo(m_background8u, CV_8U);
+	cv::absdiff(frame, m_background8u, m_difference);
+	if (m_difference.channels() == 3)
+		cv::cvtColor(m_difference, m_difference, cv::COLOR_BGR2GRAY);
+	cv::threshold(m_difference, mask, DIFFERENCE_THRESHOLD, 255, cv::THRESH_BINARY);
+
+	cv::accumulateWeighted(frame, m_background, BACKGROUND_RATE);
+}
+
+std::unique_ptr<MotionDetector> makeMotionDetector(const std::string& name)
+{
+	if (name == "mog2")
+		return std::make_unique<Mog2Detector>();
+	if (name == "diff")
+		return std::make_unique<RunningAverageDetector>();
+	return nullptr;
+}
+
+MotionSearch::MotionSearch(const MotionOptions& options) : m_options(options)
+{
+	m_options.m_scale = std::max(m_options.m_scale, 1);
+	m_options.m_stride = std::max(m_options.m_stride, 1);
+	m_detector = makeMotionDetector(m_options.m_detector);
+	if (m_detector == nullptr)
+		m_detector = makeMotionDetector("mog2");
+}
+
+const std::vector<cv::Rect>& MotionSearch::search(const cv::Mat& frame)
+{
+	/*На пропущенных кадрах фон не обновляется, объекты за это время сдвигаются мало*/
+	m_fresh = m_calls++ % m_options.m_stride == 0;
+	if (!m_fresh)
+		return m_boxes;
+
+	const cv::Mat* input = &frame;
+	if (m_options.m_scale > 1)
+	{
+		cv::resize(frame, m_small, cv::Size(frame.cols / m_options.m_scale, frame.rows / m_options.m_scale), 0, 0,
+			cv::INTER_AREA);
+		input = &m_small;
+	}
+	if (m_options.m_gray && input->channels() == 3)
+	{
+		cv::cvtColor(*input, m_gray, cv::COLOR_BGR2GRAY);
+		input = &m_gray;
+	}
+
+	m_detector->apply(*input, m_mask);
+
+	cv::erode(m_mask, m_mask, cv::Mat(), cv::Point(-1, -1), 1);
+	cv::dilate(m_mask, m_mask, cv::Mat(), cv::Point(-1, -1), 2);
+
+	m_contours.clear();
+	cv::findContours(m_mask, m_contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+
+	/*Порог площади задан для полного кадра*/
+	const double fx = double(frame.cols) / input->cols, fy = double(frame.rows) / input->rows;
+	const double minArea = SEARCH_BOX_AREA / (fx * fy);
+
+	m_boxes.clear();
+	for (auto& ctr : m_contours)
+	{
+		if (cv::contourArea(ctr) <= minArea)
+			continue;
+		cv::Rect box = cv::boundingRect(ctr);
+		if (input != &frame)
+		{
+			box = cv::Rect(cvRound(box.x * fx), cvRound(box.y * fy), cvRound(box.width * fx),
+				cvRound(box.height * fy)) & cv::Rect(0, 0, frame.cols, frame.rows);
+		}
+		m_boxes.push_back(box);
+	}
+
+	/*При равной площади раньше выбирался последний контур, сохраняем этот порядок*/
+	std::reverse(m_boxes.begin(), m_boxes.end());
+	std::stable_sort(m_boxes.begin(), m_boxes.end(),
+		[](const cv::Rect& a, const cv::Rect& b) { return a.area() > b.area(); });
+	return m_boxes;
+}
+
+void benchMotion(const std::string& path, const size_t frames)
+{
+	/*Поиск идет на каждом UPDATE_RATE-м кадре, как в MyTracker*/
+	std::vector<MotionOptions> variants;
+	for (const char* detector : { "mog2", "diff" })
+	{
+		for (int scale : { 1, 2, 4 })
+		{
+			for (bool gray : { false, true })
+				variants.push_back({ scale, gray, 1, detector });
+		}
+	}
+	variants.push_back({ 2, true, 2, "mog2" });
+	variants.push_back({ 4, true, 2, "diff" });
+
+	std::vector<SyntheticScene::Boxes> truth;
+	const std::string truthPath = SyntheticScene::truthPath(path);
+	const bool annotated = cv::VideoCapture(path).isOpened() && SyntheticScene::readTruth(truthPath, truth);
+	const SyntheticScene scene{ SceneOptions() };
+
+	auto matches = [](const cv::Rect& box, const std::vector<cv::Rect>& others) {
+		for (auto& other : others)
+		{
+			if (intersectionOverUnion(box, other) > 0.5)
+				return true;
+		}
+		return false;
+	};
+
+	std::cout << "truth: " << (annotated ? truthPath : std::string("synthetic scene")) << std::endl;
+	std::cout << "detector\tscale\tgray\tstride\tsearch, ms\trecall\tprecision" << std::endl;
+	for (auto& variant : variants)
+	{
+		cv::VideoCapture video;
+		if (annotated)
+			video.open(path);
+
+		MotionSearch search(variant);
+		SyntheticScene::Boxes objects;
+		std::vector<cv::Rect> expected;
+		size_t searches = 0, total = 0, found = 0, detected = 0, correct = 0;
+		double milliseconds = 0;
+		cv::Mat frame;
+		for (size_t index = 0; index < frames; ++index)
+		{
+			if (annotated)
+			{
+				if (!video.read(frame))
+					break;
+				objects = index < truth.size() ? truth[index] : SyntheticScene::Boxes();
+			}
+			else
+				scene.render(int(index), frame, &objects);
+			if (index % UPDATE_RATE != 0)
+				continue;
+
+			auto start = std::chrono::steady_clock::now();
+			auto& boxes = search.search(frame);
+			milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			++searches;
+			if (!search.fresh())
+				continue;
+
+			expected.clear();
+			for (auto& object : objects)
+			{
+				++total;
+				found += matches(object.second, boxes);
+				expected.push_back(object.second);
+			}
+			for (auto& box : boxes)
+			{
+				++detected;
+				correct += matches(box, expected);
+			}
+		}
+
+		std::cout << variant.m_detector << '\t' << variant.m_scale << '\t' << (variant.m_gray ? "yes" : "no") << '\t'
+			<< variant.m_stride << '\t' << (searches > 0 ? milliseconds / searches : 0) << '\t'
+			<< (total > 0 ? double(found) / total : 0) << '\t' << (detected > 0 ? double(correct) / detected : 0)
+			<< std::endl;
+	}
+}
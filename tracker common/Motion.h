@@ -0,0 +1,106 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/video/background_segm.hpp>
+
+/*Способ найти движущиеся пиксели кадра. Получает кадры одного размера и типа
+(см. MotionOptions) и возвращает маску переднего плана того же размера*/
+class MotionDetector
+{
+public:
+	virtual ~MotionDetector() {};
+
+	virtual void apply(const cv::Mat& frame, cv::Mat& mask) = 0;
+
+	virtual const char* name() const = 0;
+};
+
+/*Смесь гауссиан opencv (MOG2). Точнее всего, используется по умолчанию*/
+class Mog2Detector : public MotionDetector
+{
+public:
+	void apply(const cv::Mat& frame, cv::Mat& mask) override { m_subtractor->apply(frame, mask); };
+	const char* name() const override { return "mog2"; };
+
+private:
+	cv::Ptr<cv::BackgroundSubtractorMOG2> m_subtractor = cv::createBackgroundSubtractorMOG2(500, 150, false);
+};
+
+/*Разность с бегущим средним кадров: пиксель движется, если отличается от фона
+больше порога. Во много раз дешевле MOG2, но хуже переносит шум и смену освещения*/
+class RunningAverageDetector : public MotionDetector
+{
+public:
+	void apply(const cv::Mat& frame, cv::Mat& mask) override;
+	const char* name() const override { return "diff"; };
+
+private:
+	cv::Mat m_background;
+	cv::Mat m_background8u;
+	cv::Mat m_difference;
+};
+
+/*Возвращает способ по имени ("mog2" или "diff"), либо nullptr если имя неизвестно*/
+std::unique_ptr<MotionDetector> makeMotionDetector(const std::string& name);
+
+/*Настройки поиска движения*/
+struct MotionOptions
+{
+	/*Во сколько раз уменьшать кадр по каждой стороне перед поиском, 1 - полный размер*/
+	int m_scale = 1;
+
+	/*Искать ли в оттенках серого*/
+	bool m_gray = false;
+
+	/*Искать движение на каждом m_stride-м вызове, на остальных возвращаются прошлые боксы*/
+	int m_stride = 1;
+
+	/*Способ, см. makeMotionDetector*/
+	std::string m_detector = "mog2";
+};
+
+/*Поиск движущихся объектов для MyTracker::updateBoxes. Кадр уменьшается и при
+необходимости переводится в оттенки серого, маска переднего плана очищается эрозией
+и дилатацией, и боксами становятся контуры площадью больше SEARCH_BOX_AREA (в пересчете
+на уменьшенный кадр). Боксы возвращаются в координатах полного кадра, поэтому KCF и
+гистограммы работают как раньше. Буферы уменьшенного кадра и маски выделяются один раз*/
+class MotionSearch
+{
+public:
+	MotionSearch(const MotionOptions& options = MotionOptions());
+
+	/*Боксы всех достаточно больших движений на кадре по убыванию площади. Ссылка
+	действительна до следующего вызова*/
+	const std::vector<cv::Rect>& search(const cv::Mat& frame);
+
+	/*Искал ли последний search движение на своем кадре. false на вызовах, пропущенных
+	из-за m_stride: тогда боксы остались от одного из прошлых кадров*/
+	bool fresh() const { return m_fresh; };
+
+	const MotionOptions& options() const { return m_options; };
+
+private:
+	MotionOptions m_options;
+	std::unique_ptr<MotionDetector> m_detector;
+
+	cv::Mat m_small;
+	cv::Mat m_gray;
+	cv::Mat m_mask;
+
+	std::vector<std::vector<cv::Point>> m_contours;
+
+	size_t m_calls = 0;
+	bool m_fresh = false;
+	std::vector<cv::Rect> m_boxes;
+};
+
+/*Время поиска на кадр, полнота и точность относительно истинных боксов для разных
+уменьшений, серого кадра, пропуска кадров и способов. Истинные боксы берутся из файла
+SyntheticScene::truthPath(path), а если его нет, кадры рисует синтетическая сцена.
+Объект найден, если с ним пересекается бокс поиска с IoU больше половины. Считаются
+только вызовы, которые искали движение, см. MotionSearch::fresh*/
+void benchMotion(const std::string& path, const size_t frames);
@@ -0,0 +1,305 @@
+#include "ObjectTracker.h"
+
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include <opencv2/imgproc.hpp>
+
+namespace
+{
+	/*Ширина гауссианы, которую фильтр должен выдавать на объекте, доля нового кадра
+	в фильтре и порог PSR, ниже которого объект потерян (значения из статьи)*/
+	constexpr double MOSSE_SIGMA = 2;
+	constexpr double MOSSE_RATE = 0.125;
+	constexpr double MOSSE_PSR = 5.7;
+	constexpr double MOSSE_EPSILON = 1e-5;
+	/*Повороты и масштабы окна, на которых фильтр обучается при инициализации*/
+	constexpr int MOSSE_WARPS = 8;
+	constexpr int MOSSE_MIN_SIZE = 8;
+
+	/*Корреляция, ниже которой шаблон не найден, и доля нового вида в шаблоне*/
+	constexpr double TEMPLATE_THRESHOLD = 0.5;
+	constexpr double TEMPLATE_RATE = 0.1;
+
+	/*Центр бокса в координатах пикселей, как его понимает getRectSubPix*/
+	cv::Point2f boxCenter(const cv::Rect& box)
+	{
+		return cv::Point2f(box.x + (box.width - 1) / 2.f, box.y + (box.height - 1) / 2.f);
+	}
+
+	cv::Rect centeredBox(const cv::Point2f& center, const cv::Size& size)
+	{
+		return cv::Rect(cvRound(center.x - (size.width - 1) / 2.f), cvRound(center.y - (size.height - 1) / 2.f),
+			size.width, size.height);
+	}
+
+	void toGray(const cv::Mat& image, cv::Mat& gray)
+	{
+		if (image.channels() == 3)
+			cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+		else
+			image.copyTo(gray);
+	}
+
+	double intersectionOverUnion(const cv::Rect& rect1, const cv::Rect& rect2)
+	{
+		double intArea = (rect1 & rect2).area();
+		double totalArea = rect1.area() + rect2.area() - intArea;
+		return totalArea > 0 ? intArea / totalArea : 0;
+	}
+}
+
+void MosseTracker::init(const cv::Mat& frame, const cv::Rect& box)
+{
+	m_boxSize = box.size();
+	m_center = boxCenter(box);
+	const cv::Size size(std::max(box.width, MOSSE_MIN_SIZE), std::max(box.height, MOSSE_MIN_SIZE));
+
+	/*Окно Ханна и желаемый отклик зависят только от размера, при повторной
+	инициализации на бокс того же размера они остаются от прошлого объекта*/
+	if (size != m_size)
+	{
+		m_size = size;
+		cv::createHanningWindow(m_window, m_size, CV_32F);
+
+		m_input.create(m_size, CV_32F);
+		const float cx = (m_size.width - 1) / 2.f, cy = (m_size.height - 1) / 2.f;
+		for (int y = 0; y < m_size.height; ++y)
+		{
+			float* row = m_input.ptr<float>(y);
+			for (int x = 0; x < m_size.width; ++x)
+				row[x] = float(std::exp(-((x - cx) * (x - cx) + (y - cy) * (y - cy)) / (2 * MOSSE_SIGMA * MOSSE_SIGMA)));
+		}
+		cv::dft(m_input, m_target, cv::DFT_COMPLEX_OUTPUT);
+	}
+
+	extract(frame, m_center);
+	accumulate(0, 1);
+
+	/*Одного окна мало, фильтр на нем переобучается. Как в статье, добавляем
+	слегка повернутые и масштабированные копии*/
+	cv::RNG rng(0x5eed);
+	for (int i = 0; i < MOSSE_WARPS; ++i)
+	{
+		const double angle = rng.uniform(-10., 10.), scale = rng.uniform(0.9, 1.1);
+		cv::Mat rotation = cv::getRotationMatrix2D(cv::Point2f((m_size.width - 1) / 2.f, (m_size.height - 1) / 2.f),
+			angle, scale);
+		cv::warpAffine(m_patch, m_warped, rotation, m_size, cv::INTER_LINEAR, cv::BORDER_REFLECT);
+		prepare(m_warped);
+		accumulate(1, 1);
+	}
+	solve();
+}
+
+bool MosseTracker::update(const cv::Mat& frame, cv::Rect& box)
+{
+	if (m_filter.empty())
+		return false;
+
+	extract(frame, m_center);
+	cv::mulSpectrums(m_spectrum, m_filter, m_product, 0);
+	cv::idft(m_product, m_response, cv::DFT_SCALE | cv::DFT_REAL_OUTPUT);
+
+	double peakValue;
+	cv::Point peak;
+	cv::minMaxLoc(m_response, nullptr, &peakValue, nullptr, &peak);
+
+	/*PSR: насколько пик выше остального отклика без окрестности 11x11 вокруг пика*/
+	m_sidelobe.create(m_size, CV_8U);
+	m_sidelobe.setTo(255);
+	cv::rectangle(m_sidelobe, cv::Rect(peak.x - 5, peak.y - 5, 11, 11), cv::Scalar(0), cv::FILLED);
+	cv::Scalar mean, stddev;
+	cv::meanStdDev(m_response, mean, stddev, m_sidelobe);
+	if ((peakValue - mean[0]) / (stddev[0] + MOSSE_EPSILON) < MOSSE_PSR)
+		return false;
+
+	m_center += cv::Point2f(peak.x - (m_size.width - 1) / 2.f, peak.y - (m_size.height - 1) / 2.f);
+	if (!cv::Rect(0, 0, frame.cols, frame.rows).contains(cv::Point(cvRound(m_center.x), cvRound(m_center.y))))
+		return false;
+
+	extract(frame, m_center);
+	accumulate(1 - MOSSE_RATE, MOSSE_RATE);
+	solve();
+
+	box = centeredBox(m_center, m_boxSize);
+	return true;
+}
+
+void MosseTracker::extract(const cv::Mat& frame, const cv::Point2f& center)
+{
+	cv::getRectSubPix(frame, m_size, center, m_patch);
+	prepare(m_patch);
+}
+
+void MosseTracker::prepare(const cv::Mat& patch)
+{
+	toGray(patch, m_gray);
+	m_gray.convertTo(m_input, CV_32F);
+	cv::add(m_input, cv::Scalar::all(1), m_input);
+	cv::log(m_input, m_input);
+
+	cv::Scalar mean, stddev;
+	cv::meanStdDev(m_input, mean, stddev);
+	const double scale = 1 / (stddev[0] + MOSSE_EPSILON);
+	m_input.convertTo(m_input, CV_32F, scale, -mean[0] * scale);
+	cv::multiply(m_input, m_window, m_input);
+
+	cv::dft(m_input, m_spectrum, cv::DFT_COMPLEX_OUTPUT);
+}
+
+void MosseTracker::accumulate(const double keep, const double add)
+{
+	/*Числитель G * conj(F), знаменатель F * conj(F)*/
+	cv::mulSpectrums(m_target, m_spectrum, m_product, 0, true);
+	cv::mulSpectrums(m_spectrum, m_spectrum, m_energy, 0, true);
+	if (keep == 0)
+	{
+		m_product.convertTo(m_numerator, CV_32F, add);
+		m_energy.convertTo(m_denominator, CV_32F, add);
+		return;
+	}
+	cv::addWeighted(m_numerator, keep, m_product, add, 0, m_numerator);
+	cv::addWeighted(m_denominator, keep, m_energy, add, 0, m_denominator);
+}
+
+void MosseTracker::solve()
+{
+	/*Знаменатель вещественный, поэтому деление - это деление обеих частей числителя*/
+	cv::extractChannel(m_denominator, m_real, 0);
+	cv::add(m_real, cv::Scalar::all(MOSSE_EPSILON), m_real);
+	cv::split(m_numerator, m_channels);
+	cv::divide(m_channels[0], m_real, m_channels[0]);
+	cv::divide(m_channels[1], m_real, m_channels[1]);
+	cv::merge(m_channels, m_filter);
+}
+
+void TemplateTracker::init(const cv::Mat& frame, const cv::Rect& box)
+{
+	cv::getRectSubPix(frame, cv::Size(std::max(box.width, 1), std::max(box.height, 1)), boxCenter(box), m_patch);
+	toGray(m_patch, m_template);
+}
+
+bool TemplateTracker::update(const cv::Mat& frame, cv::Rect& box)
+{
+	/*Ищем в окне вдвое больше бокса вокруг прошлого положения*/
+	const cv::Rect search = cv::Rect(box.x - m_template.cols / 2, box.y - m_template.rows / 2,
+		m_template.cols * 2, m_template.rows * 2) & cv::Rect(0, 0, frame.cols, frame.rows);
+	if (m_template.empty() || search.width < m_template.cols || search.height < m_template.rows)
+		return false;
+
+	toGray(frame(search), m_search);
+	cv::matchTemplate(m_search, m_template, m_result, cv::TM_CCOEFF_NORMED);
+	double score;
+	cv::Point location;
+	cv::minMaxLoc(m_result, nullptr, &score, nullptr, &location);
+	if (score < TEMPLATE_THRESHOLD)
+		return false;
+
+	/*Шаблон понемногу подстраивается под объект, чтобы следовать за медленной сменой вида*/
+	const cv::Rect found(location, m_template.size());
+	cv::addWeighted(m_template, 1 - TEMPLATE_RATE, m_search(found), TEMPLATE_RATE, 0, m_template);
+
+	box = found + search.tl();
+	return true;
+}
+
+bool isObjectTrackerName(const std::string& name)
+{
+	return name == "kcf" || name == "mosse" || name == "template";
+}
+
+std::unique_ptr<ObjectTracker> makeObjectTracker(const std::string& name)
+{
+	if (name == "kcf")
+		return std::make_unique<KcfTracker>();
+	if (name == "mosse")
+		return std::make_unique<MosseTracker>();
+	if (name == "template")
+		return std::make_unique<TemplateTracker>();
+	return nullptr;
+}
+
+ObjectTrackerPool::ObjectTrackerPool(const std::string& name, const size_t prewarm) : m_name(name)
+{
+	assert(isObjectTrackerName(m_name) && "object tracker name must be validated by the caller");
+	for (size_t i = 0; i < prewarm; ++i)
+		m_free.push_back(makeObjectTracker(m_name));
+}
+
+std::unique_ptr<ObjectTracker> ObjectTrackerPool::acquire()
+{
+	if (m_free.empty())
+		return makeObjectTracker(m_name);
+	auto tracker = std::move(m_free.back());
+	m_free.pop_back();
+	return tracker;
+}
+
+void ObjectTrackerPool::release(std::unique_ptr<ObjectTracker> tracker)
+{
+	if (tracker != nullptr)
+		m_free.push_back(std::move(tracker));
+}
+
+void benchObjectTrackers()
+{
+	/*Текстурный объект 60x120 на шумном фоне 1280x720 проходит STEPS кадров по прямой.
+	Объект проведен, если трекер ни разу его не потерял и в конце IoU больше половины*/
+	constexpr int ACTIVATIONS = 100;
+	constexpr int STEPS = 20;
+	const cv::Size frameSize(1280, 720), objectSize(60, 120);
+
+	cv::Mat background(frameSize, CV_8UC3), texture(objectSize, CV_8UC3), frame;
+	cv::randu(background, cv::Scalar::all(60), cv::Scalar::all(140));
+	cv::randu(texture, cv::Scalar::all(0), cv::Scalar::all(256));
+	cv::GaussianBlur(texture, texture, cv::Size(5, 5), 0);
+
+	auto render = [&](const cv::Rect& box)
+	{
+		background.copyTo(frame);
+		texture.copyTo(frame(box));
+	};
+
+	std::cout << "tracker\tpooled\tactivation, us\tupdate, us\ttracked" << std::endl;
+	for (const char* name : { "kcf", "mosse", "template" })
+	{
+		for (bool pooled : { false, true })
+		{
+			ObjectTrackerPool pool(name, 1);
+			double activation = 0, update = 0;
+			int tracked = 0, updates = 0;
+			for (int a = 0; a < ACTIVATIONS; ++a)
+			{
+				cv::Rect truth(100 + (a * 97) % 1000, 100 + (a * 53) % 450, objectSize.width, objectSize.height);
+				const cv::Point velocity(a % 2 ? 3 : -3, a % 3 ? 2 : -2);
+				render(truth);
+
+				auto start = std::chrono::steady_clock::now();
+				auto tracker = pooled ? pool.acquire() : makeObjectTracker(name);
+				tracker->init(frame, truth);
+				activation += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+				cv::Rect box = truth;
+				bool found = true;
+				for (int step = 0; step < STEPS && found; ++step)
+				{
+					truth += velocity;
+					render(truth);
+					start = std::chrono::steady_clock::now();
+					found = tracker->update(frame, box);
+					++updates;
+					update += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+				}
+				tracked += found && intersectionOverUnion(box, truth) > 0.5;
+
+				if (pooled)
+					pool.release(std::move(tracker));
+			}
+
+			std::cout << name << '\t' << (pooled ? "yes" : "no") << '\t' << activation / ACTIVATIONS << '\t'
+				<< update / std::max(updates, 1) << '\t' << double(tracked) / ACTIVATIONS << std::endl;
+		}
+	}
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/tracking.hpp>
+
+/*Трекер одного объекта, который ведет трек между поисками движения. init можно
+вызывать повторно на том же объекте для нового бокса: буферы прошлого объекта
+переиспользуются, поэтому трекеры берутся из пула (см. ObjectTrackerPool), а не
+создаются на каждую активацию*/
+class ObjectTracker
+{
+public:
+	virtual ~ObjectTracker() {};
+
+	virtual void init(const cv::Mat& frame, const cv::Rect& box) = 0;
+
+	/*Ищет объект на новом кадре. box - прошлые координаты, на выходе новые.
+	false, если объект потерян*/
+	virtual bool update(const cv::Mat& frame, cv::Rect& box) = 0;
+
+	virtual const char* name() const = 0;
+};
+
+/*KCF из opencv. Точнее всего, используется по умолчанию*/
+class KcfTracker : public ObjectTracker
+{
+public:
+	void init(const cv::Mat& frame, const cv::Rect& box) override { m_tracker->init(frame, box); };
+	bool update(const cv::Mat& frame, cv::Rect& box) override { return m_tracker->update(frame, box); };
+	const char* name() const override { return "kcf"; };
+
+private:
+	cv::Ptr<cv::TrackerKCF> m_tracker = cv::TrackerKCF::create();
+};
+
+/*MOSSE (Bolme и др., 2010): корреляционный фильтр по одному каналу яркости,
+обучается и применяется в частотной области. Размер бокса не меняется. Объект
+считается потерянным, если пик отклика слабо выделяется над фоном (PSR)*/
+class MosseTracker : public ObjectTracker
+{
+public:
+	void init(const cv::Mat& frame, const cv::Rect& box) override;
+	bool update(const cv::Mat& frame, cv::Rect& box) override;
+	const char* name() const override { return "mosse"; };
+
+private:
+	/*Спектр окна кадра вокруг center в m_spectrum, см. prepare*/
+	void extract(const cv::Mat& frame, const cv::Point2f& center);
+
+	/*Яркость в логарифме, нормированная и умноженная на окно Ханна, и ее спектр*/
+	void prepare(const cv::Mat& patch);
+
+	/*Числитель и знаменатель фильтра становятся keep * старые + add * по m_spectrum*/
+	void accumulate(const double keep, const double add);
+
+	/*Фильтр - поэлементное частное числителя и знаменателя*/
+	void solve();
+
+	cv::Size m_size;
+	cv::Size m_boxSize;
+	cv::Point2f m_center;
+
+	cv::Mat m_window;
+	cv::Mat m_target;
+	cv::Mat m_numerator;
+	cv::Mat m_denominator;
+	cv::Mat m_filter;
+
+	cv::Mat m_patch;
+	cv::Mat m_warped;
+	cv::Mat m_gray;
+	cv::Mat m_input;
+	cv::Mat m_spectrum;
+	cv::Mat m_product;
+	cv::Mat m_energy;
+	cv::Mat m_real;
+	cv::Mat m_response;
+	cv::Mat m_sidelobe;
+	std::vector<cv::Mat> m_channels;
+};
+
+/*Поиск шаблона бокса нормированной корреляцией в окне вокруг прошлого положения.
+Самый дешевый, но теряет объект при повороте и смене масштаба*/
+class TemplateTracker : public ObjectTracker
+{
+public:
+	void init(const cv::Mat& frame, const cv::Rect& box) override;
+	bool update(const cv::Mat& frame, cv::Rect& box) override;
+	const char* name() const override { return "template"; };
+
+private:
+	cv::Mat m_template;
+	cv::Mat m_patch;
+	cv::Mat m_search;
+	cv::Mat m_result;
+};
+
+/*Возвращает трекер по имени ("kcf", "mosse" или "template"), либо nullptr если имя неизвестно*/
+std::unique_ptr<ObjectTracker> makeObjectTracker(const std::string& name);
+
+/*Знает ли makeObjectTracker такое имя. Проверяет без создания трекера*/
+bool isObjectTrackerName(const std::string& name);
+
+/*Пул трекеров одного вида для одной камеры. Освобожденный трекер возвращается
+в пул и при следующей активации инициализируется заново на месте*/
+class ObjectTrackerPool
+{
+public:
+	/*prewarm трекеров создаются сразу. name должно быть известно makeObjectTracker,
+	его проверяет вызывающий (см. isObjectTrackerName), запасного вида у пула нет*/
+	ObjectTrackerPool(const std::string& name, const size_t prewarm = 4);
+
+	std::unique_ptr<ObjectTracker> acquire();
+	void release(std::unique_ptr<ObjectTracker> tracker);
+
+	const std::string& name() const { return m_name; };
+
+private:
+	std::string m_name;
+	std::vector<std::unique_ptr<ObjectTracker>> m_free;
+};
+
+/*Время активации (создание трекера и init против повторного init трекера из пула),
+время update и доля удачно проведенных объектов для каждого вида трекера*/
+void benchObjectTrackers();
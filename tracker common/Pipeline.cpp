@@ -0,0 +1,257 @@
+#include "Pipeline.h"
+#include "../shared/Allocations.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	void trackingStage(const int id, TrackList& trackList, ThreadPool* pool, EventWriter* events,
+		const StreamOptions& options, PipelineStream& stream)
+	{
+		cv::Mat frame;
+		MyTracker tracker(id, trackList, frame, options.m_motion, options.m_objectTracker, pool);
+
+		/*Анализ выполняем раз в UPDATE_RATE кадров. Считаем по номеру кадра, а не
+		по остатку от деления, т.к. часть кадров может быть выброшена из очереди*/
+		size_t nextAnalysis = 0;
+		PipelineFrame item;
+		while (stream.m_captured.pop(item))
+		{
+			frame = item.m_frame.image();
+			if (item.m_index >= nextAnalysis)
+			{
+				MEASURE_STAGE(Stage::Tracking, id);
+				tracker.process();
+				nextAnalysis = item.m_index + UPDATE_RATE;
+			}
+			publishFrame(tracker, events, options, stream, item);
+		}
+
+		stream.m_processed.close();
+	}
+}
+
+PipelineStats runStreams(const std::vector<std::string>& paths, const StreamOptions& options)
+{
+	TrackList trackList(makeDescriptorExtractor(options.m_descriptor));
+	std::unique_ptr<ThreadPool> pool;
+	if (options.m_threads != 1)
+		pool = std::make_unique<ThreadPool>(options.m_threads);
+
+	auto startTracking = [&](const size_t i, PipelineStream& stream, EventWriter* events) {
+		return std::thread(trackingStage, int(i), std::ref(trackList), pool.get(), events, std::cref(options),
+			std::ref(stream));
+	};
+	auto show = [](const size_t i, cv::Mat& canvas, const std::vector<std::pair<int, cv::Rect>>& tracks) {
+		MyTracker::drawTracks(canvas, tracks);
+		cv::imshow(std::to_string(i), canvas);
+	};
+	return runStages(paths, options, startTracking, show);
+}
+
+void benchStreams(const std::string& path, const size_t frames)
+{
+	/*Кадры не выбрасываем, иначе fps будет считаться по разному количеству работы*/
+	StreamOptions options;
+	options.m_display = false;
+	options.m_paced = false;
+	options.m_maxFrames = frames;
+	options.m_policy = QueuePolicy::Block;
+
+	std::cout << "cores: " << std::thread::hardware_concurrency() << std::endl;
+	std::cout << "streams\tframes\tseconds\ttotal fps\tfps per stream" << std::endl;
+	for (size_t count : { 1, 2, 4, 8, 16 })
+	{
+		auto stats = runStreams(std::vector<std::string>(count, path), options);
+		std::cout << count << '\t' << stats.m_frames << '\t' << stats.m_seconds << '\t'
+			<< stats.fps() << '\t' << stats.fps() / count << std::endl;
+	}
+}
+
+void benchEvents()
+{
+	/*Треки двигаются по диагонали, на каждом кадре по событию update на трек, а каждые
+	100 кадров треки теряются и появляются снова. Поток трекинга только собирает события,
+	поэтому замеряется вся его работа с событиями на кадр*/
+	constexpr size_t FRAMES = 20000;
+	constexpr int TRACKS = 50;
+	const std::string path = "events.bench";
+
+	std::cout << "writer\tframe, us\tevents/s\tMB/s\tdropped" << std::endl;
+	for (const char* variant : { "sync json", "json", "binary" })
+	{
+		const bool sync = std::string(variant) == "sync json";
+		const EventFormat format = std::string(variant) == "binary" ? EventFormat::Binary : EventFormat::Lines;
+
+		/*Прежний способ для сравнения: строки пишутся в файл прямо в потоке трекинга*/
+		std::ofstream file;
+		std::unique_ptr<EventWriter> writer;
+		if (sync)
+			file.open(path);
+		else
+			writer = std::make_unique<EventWriter>(path, format);
+
+		std::vector<TrackEvent> events;
+		double producer = 0;
+		auto start = Clock::now();
+		for (size_t frame = 0; frame < FRAMES; ++frame)
+		{
+			auto frameStart = Clock::now();
+			events.clear();
+			for (int id = 0; id < TRACKS; ++id)
+			{
+				TrackEvent event;
+				event.m_type = frame % 100 == 0 ? TrackEventType::Start :
+					frame % 100 == 99 ? TrackEventType::Lost : TrackEventType::Update;
+				event.m_camera = id % NUM_TRACKERS;
+				event.m_id = id;
+				event.m_box = cv::Rect(int(frame % 100) * 5 + id, int(frame % 100) * 3, 40, 80);
+				events.push_back(event);
+			}
+			stampEvents(events, frame);
+
+			if (sync)
+			{
+				for (auto& event : events)
+				{
+					file << "{\"time\":" << event.m_timestamp << ",\"frame\":" << event.m_frame << ",\"camera\":"
+						<< event.m_camera << ",\"id\":" << event.m_id << ",\"event\":\"" << eventName(event.m_type)
+						<< "\",\"box\":[" << event.m_box.x << ',' << event.m_box.y << ',' << event.m_box.width << ','
+						<< event.m_box.height << "]}\n";
+				}
+			}
+			else
+				writer->write(events);
+			producer += std::chrono::duration<double, std::micro>(Clock::now() - frameStart).count();
+		}
+
+		size_t written = FRAMES * TRACKS, dropped = 0, bytes = 0;
+		if (sync)
+		{
+			file.close();
+			bytes = size_t(std::ifstream(path, std::ios::binary | std::ios::ate).tellg());
+		}
+		else
+		{
+			writer->close();
+			written = writer->written();
+			dropped = writer->dropped();
+			bytes = writer->bytes();
+		}
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		std::remove(path.c_str());
+
+		std::cout << variant << '\t' << producer / FRAMES << '\t' << written / seconds << '\t'
+			<< bytes / seconds / (1024 * 1024) << '\t' << dropped << std::endl;
+	}
+}
+namespace
+{
+	/*Кадры в формате Y4M 4:2:0, который читает makeFrameSource*/
+	bool writeY4m(const std::string& path, const std::vector<cv::Mat>& frames)
+	{
+		std::ofstream file(path, std::ios::binary);
+		if (!file.is_open() || frames.empty())
+			return false;
+		file << "YUV4MPEG2 W" << frames.front().cols << " H" << frames.front().rows << " F30:1 Ip A1:1 C420jpeg\n";
+		cv::Mat yuv;
+		for (auto& frame : frames)
+		{
+			cv::cvtColor(frame, yuv, cv::COLOR_BGR2YUV_I420);
+			file << "FRAME\n";
+			file.write(reinterpret_cast<const char*>(yuv.data), std::streamsize(yuv.total()));
+		}
+		return bool(file);
+	}
+}
+
+void benchFrameSources(const std::string& path, const size_t frames)
+{
+	/*Картинки и Y4M делаются из того же видео, размер обрезается до четного для 4:2:0*/
+	const std::string imagePattern = "frames.bench.%05d.jpg";
+	const std::string y4mPath = "frames.bench.y4m";
+	std::vector<cv::Mat> decoded;
+	{
+		cv::VideoCapture video(path);
+		cv::Mat frame;
+		while (decoded.size() < frames && video.read(frame))
+			decoded.push_back(frame(cv::Rect(0, 0, frame.cols & ~1, frame.rows & ~1)).clone());
+	}
+	if (decoded.empty())
+	{
+		std::cout << "cannot read " << path << std::endl;
+		return;
+	}
+	for (size_t i = 0; i < decoded.size(); ++i)
+		cv::imwrite(cv::format(imagePattern.c_str(), int(i)), decoded[i]);
+	if (!writeY4m(y4mPath, decoded))
+		std::cout << "cannot write " << y4mPath << std::endl;
+
+	if (!allocationCountingSupported())
+		std::cout << "allocations are not counted in this build or on this platform" << std::endl;
+	std::cout << decoded.front().cols << 'x' << decoded.front().rows << ", " << decoded.size() << " frames, cores: "
+		<< std::thread::hardware_concurrency() << std::endl;
+	std::cout << "source\tthreads\thardware\tfps\tallocations per frame\tbuffers" << std::endl;
+	decoded.clear();
+
+	/*Чтение без FrameSource, как раньше в стадии захвата: новый cv::Mat на каждый кадр*/
+	{
+		cv::VideoCapture video(path);
+		size_t count = 0, allocations = allocationCount();
+		auto start = Clock::now();
+		for (cv::Mat frame; count < frames && video.read(frame); frame = cv::Mat())
+			++count;
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		allocations = allocationCount() - allocations;
+		std::cout << "video, cv::Mat per frame\t-\tno\t" << (seconds > 0 ? count / seconds : 0) << '\t'
+			<< (count > 0 ? double(allocations) / count : 0) << "\t-" << std::endl;
+	}
+
+	struct Config
+	{
+		const char* m_name;
+		std::string m_path;
+		int m_threads;
+		bool m_hardware;
+	};
+	const Config configs[] = {
+		{ "video", path, 0, false }, { "video", path, 1, false }, { "video", path, 4, false }, { "video", path, 0, true },
+		{ "images", imagePattern, 0, false }, { "images", imagePattern, 2, false }, { "images", imagePattern, 4, false },
+		{ "images", imagePattern, 8, false }, { "y4m", y4mPath, 0, false }, { "y4m", y4mPath, 2, false },
+		{ "y4m", y4mPath, 4, false } };
+
+	for (const Config& config : configs)
+	{
+		FrameSourceOptions options;
+		options.m_threads = config.m_threads;
+		options.m_hardware = config.m_hardware;
+		FramePool pool;
+		auto source = makeFrameSource(config.m_path, pool, options);
+		if (source == nullptr)
+		{
+			std::cout << config.m_name << "\tcannot open " << config.m_path << std::endl;
+			continue;
+		}
+
+		/*Последние кадры держатся, как в очередях конвейера, чтобы пул работал как там*/
+		std::vector<Frame> held(8);
+		size_t count = 0, allocations = allocationCount();
+		auto start = Clock::now();
+		for (Frame frame; count < frames && source->read(frame); ++count)
+			held[count % held.size()] = std::move(frame);
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		allocations = allocationCount() - allocations;
+
+		std::cout << config.m_name << '\t' << config.m_threads << '\t' << (config.m_hardware ? "yes" : "no") << '\t'
+			<< (seconds > 0 ? count / seconds : 0) << '\t' << (count > 0 ? double(allocations) / count : 0) << '\t'
+			<< pool.allocated() << std::endl;
+	}
+
+	for (size_t i = 0; i < frames; ++i)
+		std::remove(cv::format(imagePattern.c_str(), int(i)).c_str());
+	std::remove(y4mPath.c_str());
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Header.h"
+#include "../shared/Pipeline.h"
+
+/*Режим работы с произвольным количеством камер. Каждая камера получает свой
+MyTracker и конвейер из трех стадий (см. shared/Pipeline.h):
+захват кадра -> трекинг (поиск движения, трекеры объектов) -> вывод (отрисовка и imshow).
+Трекинг выдает события треков (TrackEvents.h): их пишет в файл отдельный поток,
+а треки для отрисовки собираются из тех же событий.
+Общие у всех камер только trackList и пул потоков для трекеров объектов*/
+
+struct StreamOptions : StageOptions
+{
+	/*Дескриптор для повторной идентификации, см. makeDescriptorExtractor*/
+	std::string m_descriptor = "bgr";
+
+	/*Масштаб, цвет, пропуск кадров и способ поиска движения, см. Motion.h*/
+	MotionOptions m_motion;
+
+	/*Трекер объектов, см. makeObjectTracker*/
+	std::string m_objectTracker = "kcf";
+
+	/*Потоки пула, в котором камеры обновляют трекеры своих объектов.
+	0 - по числу ядер, 1 - без пула, каждая камера обновляет их по очереди*/
+	size_t m_threads = 0;
+
+	/*Пакетная обработка, см. StageOptions::setHeadless. Анализ идет по номеру кадра,
+	поэтому треки камеры совпадают с обычным режимом с --block*/
+	static StreamOptions headless(const std::string& tracksPath)
+	{
+		StreamOptions options;
+		options.setHeadless(tracksPath);
+		return options;
+	};
+};
+
+/*Запускает по конвейеру на каждое видео из paths и ждет, пока все они закончатся*/
+PipelineStats runStreams(const std::vector<std::string>& paths, const StreamOptions& options);
+
+/*Замер суммарной производительности для 1, 2, 4, 8 и 16 камер. Все камеры читают
+одно и то же видео path, чтобы результат зависел только от количества потоков*/
+void benchStreams(const std::string& path, const size_t frames);
+
+/*Накладные расходы на кадр в потоке трекинга, пропускная способность записи и
+количество выброшенных событий для синтетических кадров с 50 треками: запись
+строк прямо в потоке трекинга против EventWriter в обоих форматах*/
+void benchEvents();
+
+/*Скорость чтения кадров и выделения памяти на кадр для видео path и для картинок и Y4M,
+записанных из его первых frames кадров, при разном количестве потоков декодирования.
+Для сравнения - прежнее чтение VideoCapture::read в новый cv::Mat на каждый кадр*/
+void benchFrameSources(const std::string& path, const size_t frames);
\ No newline at end of file